@@ -0,0 +1,191 @@
+/**
+* \file callable.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief move-only function wrapper with a large inline buffer
+* \version 0.1
+* \date 2020-09-25
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+#include "net.hpp"
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace net
+{
+
+/// bytes of callables stored without allocation. Lambdas of the library capture a few pointers and smart pointers
+inline constexpr u64 callable_inline_size = 64;
+
+template <typename Signature> class callable_t;
+
+/// function wrapper which can hold move-only callables.
+/// Callables no larger than 'callable_inline_size' with nothrow move constructor are stored in place, larger ones are
+/// allocated. Unlike std::function it is not copyable, so a callable is never copied when it is passed along.
+template <typename R, typename... Args> class callable_t<R(Args...)>
+{
+    struct ops_t
+    {
+        R (*invoke)(void *storage, Args &&... args);
+        /// move constructs 'to' from 'from' and destroys 'from'
+        void (*relocate)(void *from, void *to) noexcept;
+        void (*destroy)(void *storage) noexcept;
+    };
+
+    template <typename F>
+    static constexpr bool is_inline = sizeof(F) <= callable_inline_size &&
+                                      alignof(F) <= alignof(std::max_align_t) &&
+                                      std::is_nothrow_move_constructible_v<F>;
+
+    template <typename F> struct inline_ops_t
+    {
+        static R invoke(void *storage, Args &&... args)
+        {
+            return (*static_cast<F *>(storage))(std::forward<Args>(args)...);
+        }
+        static void relocate(void *from, void *to) noexcept
+        {
+            new (to) F(std::move(*static_cast<F *>(from)));
+            static_cast<F *>(from)->~F();
+        }
+        static void destroy(void *storage) noexcept { static_cast<F *>(storage)->~F(); }
+        static constexpr ops_t ops = {&invoke, &relocate, &destroy};
+    };
+
+    /// storage keeps a pointer to the callable
+    template <typename F> struct heap_ops_t
+    {
+        static R invoke(void *storage, Args &&... args)
+        {
+            return (**static_cast<F **>(storage))(std::forward<Args>(args)...);
+        }
+        static void relocate(void *from, void *to) noexcept { *static_cast<F **>(to) = *static_cast<F **>(from); }
+        static void destroy(void *storage) noexcept { delete *static_cast<F **>(storage); }
+        static constexpr ops_t ops = {&invoke, &relocate, &destroy};
+    };
+
+    template <typename F> static bool is_null(const F &f)
+    {
+        if constexpr (std::is_pointer_v<F> || std::is_member_pointer_v<F>)
+            return f == nullptr;
+        else if constexpr (std::is_same_v<F, std::function<R(Args...)>>)
+            return !f;
+        else
+            return false;
+    }
+
+    /// callable is modified by a call even if wrapper is const, like std::function
+    alignas(std::max_align_t) mutable unsigned char storage[callable_inline_size];
+    /// nullptr if empty
+    const ops_t *ops;
+
+    void reset()
+    {
+        if (ops)
+        {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+  public:
+    callable_t()
+        : ops(nullptr)
+    {
+    }
+
+    callable_t(std::nullptr_t)
+        : ops(nullptr)
+    {
+    }
+
+    template <typename F, typename D = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<D, callable_t> && std::is_invocable_r_v<R, D &, Args...>>>
+    callable_t(F &&f)
+        : ops(nullptr)
+    {
+        if (is_null(f))
+            return;
+        if constexpr (is_inline<D>)
+        {
+            new (storage) D(std::forward<F>(f));
+            ops = &inline_ops_t<D>::ops;
+        }
+        else
+        {
+            *reinterpret_cast<D **>(storage) = new D(std::forward<F>(f));
+            ops = &heap_ops_t<D>::ops;
+        }
+    }
+
+    callable_t(callable_t &&other) noexcept
+        : ops(other.ops)
+    {
+        if (ops)
+        {
+            ops->relocate(other.storage, storage);
+            other.ops = nullptr;
+        }
+    }
+
+    callable_t &operator=(callable_t &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.ops)
+            {
+                other.ops->relocate(other.storage, storage);
+                ops = other.ops;
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    callable_t &operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    template <typename F, typename D = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<D, callable_t> && std::is_invocable_r_v<R, D &, Args...>>>
+    callable_t &operator=(F &&f)
+    {
+        return *this = callable_t(std::forward<F>(f));
+    }
+
+    callable_t(const callable_t &) = delete;
+    callable_t &operator=(const callable_t &) = delete;
+
+    ~callable_t() { reset(); }
+
+    explicit operator bool() const { return ops != nullptr; }
+
+    ///\throw std::bad_function_call if it is empty
+    R operator()(Args... args) const
+    {
+        if (ops == nullptr)
+            throw std::bad_function_call();
+        return ops->invoke(storage, std::forward<Args>(args)...);
+    }
+};
+
+} // namespace net
@@ -21,12 +21,14 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 */
 
 #pragma once
+#include "callable.hpp"
 #include "execute_context.hpp"
 #include "net.hpp"
 #include <boost/context/fiber.hpp>
 #include <functional>
 #include <future>
 #include <list>
+#include <vector>
 
 namespace net::co
 {
@@ -65,12 +67,78 @@ template <typename T> class async_result_t
 
 class coroutine_t;
 
+/// stack size of coroutines if it is not specified
+inline constexpr u32 default_stack_size = 128 * 1024;
+/// stack sizes are rounded up to power of 2 classes from 16KiB to 1MiB, larger stacks are not cached
+inline constexpr u32 min_stack_size = 16 * 1024;
+inline constexpr int stack_size_classes = 7;
+/// bytes of free stacks kept by a pool by default
+inline constexpr u64 default_stack_pool_limit = 64 * 1024 * 1024;
+
+struct stack_pool_stat_t
+{
+    /// stacks mapped from system
+    u64 mapped;
+    /// stacks taken from cache
+    u64 reused;
+    /// bytes of free stacks in cache
+    u64 cached_bytes;
+};
+
+/// guarded coroutine stacks cached by size class
+/// A pool per thread, so stacks of a loop are taken from and returned to the pool of the loop thread without lock.
+/// Stacks are mapped with a guard page below them. Released stacks are kept until the pool holds 'limit' bytes.
+class stack_pool_t
+{
+    std::vector<void *> free_stacks[stack_size_classes];
+    u64 cached_bytes;
+    u64 limit;
+    u64 mapped;
+    u64 reused;
+
+    static int size_class(u64 size);
+
+  public:
+    stack_pool_t();
+    stack_pool_t(const stack_pool_t &) = delete;
+    stack_pool_t &operator=(const stack_pool_t &) = delete;
+    ~stack_pool_t();
+
+    /// pool of current thread
+    static stack_pool_t &current();
+
+    /// size of stack allocated for 'size', 0 for the default size
+    static u64 round_size(u64 size);
+
+    ctx::stack_context allocate(u64 size);
+    void deallocate(ctx::stack_context &sctx);
+
+    /// set bytes of free stacks to keep
+    void set_limit(u64 bytes);
+    stack_pool_stat_t get_stat() const;
+};
+
+/// stack allocator of boost.context, takes stacks from the pool of current thread
+class pooled_stack_t
+{
+    u64 size;
+
+  public:
+    pooled_stack_t(u64 size)
+        : size(size)
+    {
+    }
+
+    ctx::stack_context allocate() { return stack_pool_t::current().allocate(size); }
+    void deallocate(ctx::stack_context &sctx) noexcept { stack_pool_t::current().deallocate(sctx); }
+};
+
 /// the main coroutine
 /// coroutine of the main thread, save the default stack information of the thread
 thread_local inline coroutine_t *co_cur = nullptr;
 
 ctx::fiber &&co_wrapper(ctx::fiber &&sink, coroutine_t *co);
-ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, std::function<void()> func);
+ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, callable_t<void()> &func);
 
 /// throw it when wants to stop coroutine
 class coroutine_stop_exception
@@ -82,31 +150,30 @@ class coroutine_t
     /// boost fiber
     ctx::fiber context;
     /// entry function
-    std::function<void()> func;
+    callable_t<void()> func;
     /// previous coroutine
     /// make up a list chain
     coroutine_t *prev;
     friend ctx::fiber &&co_wrapper(ctx::fiber &&sink, coroutine_t *co);
-    friend ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, std::function<void()> func);
+    friend ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, callable_t<void()> &func);
 
     execute_context_t *econtext;
     bool is_stop;
     /// Don't create in the stack
-    coroutine_t(std::function<void()> f)
-        : context(std::bind(co_wrapper, std::placeholders::_1, this))
-        , func(f)
-        , prev(nullptr)
+    coroutine_t()
+        : prev(nullptr)
+        , econtext(nullptr)
         , is_stop(false){};
 
+    friend struct coroutine_free_list_t;
+
   public:
     coroutine_t(const coroutine_t &) = delete;
     coroutine_t &operator=(const coroutine_t &) = delete;
 
-    static coroutine_t *create(std::function<void()> f)
-    {
-        coroutine_t *co = new coroutine_t(f);
-        return co;
-    };
+    /// create coroutine, it is taken from the free list of current thread if possible
+    ///\param stack_size stack size, 0 for default_stack_size
+    static coroutine_t *create(callable_t<void()> f, u64 stack_size = 0);
     /**
      * \brief return current coroutine
      *
@@ -118,7 +185,11 @@ class coroutine_t
 
     static bool in_coroutine(coroutine_t *co) { return co_cur == co; }
 
-    static void remove(coroutine_t *c) { delete c; }
+    /// destroy coroutine or put it to the free list of current thread. Don't remove a running coroutine
+    static void remove(coroutine_t *c);
+
+    /// entry function returns, the stack is released
+    bool is_done() const { return !context; }
 
     /// XXX: Maybe there is a better way to sleep in coroutines
     /// It invalidates the SOLID principle
@@ -139,14 +210,17 @@ class coroutine_t
     }
 
     // switch to this and call func
-    void resume_with(std::function<void()> func)
+    /// func is called on top of this coroutine before the caller frame returns, so it is passed by reference
+    void resume_with(callable_t<void()> func)
     {
         if (is_stop)
             return;
         prev = co_cur;
 
         co_cur = this;
-        context = std::move(context).resume_with(std::bind(co_reschedule_wrapper, std::placeholders::_1, this, func));
+        context = std::move(context).resume_with([this, &func](ctx::fiber &&sink) -> ctx::fiber && {
+            return co_reschedule_wrapper(std::move(sink), this, func);
+        });
     }
 
     static void yield()
@@ -155,10 +229,7 @@ class coroutine_t
         if (cur)
         {
             co_cur = cur->prev;
-            auto next = cur;
             cur->context = std::move(cur->context).resume();
-            if (next->is_stop)
-                remove(next);
             return;
         }
         else
@@ -167,17 +238,15 @@ class coroutine_t
         }
     }
 
-    static void yield(std::function<void()> func)
+    static void yield(callable_t<void()> func)
     {
         coroutine_t *cur = current();
         if (cur)
         {
             co_cur = cur->prev;
-            auto next = cur;
-            cur->context =
-                std::move(cur->context).resume_with(std::bind(co_reschedule_wrapper, std::placeholders::_1, cur, func));
-            if (next->is_stop)
-                remove(next); // delay removal of coroutine
+            cur->context = std::move(cur->context).resume_with([cur, &func](ctx::fiber &&sink) -> ctx::fiber && {
+                return co_reschedule_wrapper(std::move(sink), cur, func);
+            });
             return;
         }
         else
@@ -185,10 +254,147 @@ class coroutine_t
             throw std::exception();
         }
     }
-    /// When returning to the previous coroutine, the stop flag is set and destroyed.
+    /// Don't resume it any more. Finished coroutines are removed by the dispatcher.
     void stop() { is_stop = true; }
 };
 
+/// counters of awaits in current thread
+struct await_stat_t
+{
+    /// times of waiting for unfinished operations
+    u64 waits;
+    /// resumes of waiting coroutines
+    u64 resumes;
+    /// resumes which don't finish the operation. The coroutine keeps waiting or the operation is retried in vain
+    u64 spurious;
+};
+
+thread_local inline await_stat_t await_stat = {};
+
+inline const await_stat_t &get_await_stat() { return await_stat; }
+
+/// registered by an unfinished operation to the object which finishes it, e.g. a socket waits for readiness.
+/// The object keeps a pointer of the waiter in a slot and fires it when one of 'events' happens, the waiting coroutine
+/// is not resumed by other events. The slot is cleared when the waiter fires or is destroyed.
+class waiter_t
+{
+    execute_context_t *context;
+    /// called instead of starting context if it is set, e.g. by awaiters of stackless coroutines
+    void (*resume)(void *arg);
+    void *resume_arg;
+    waiter_t **slot;
+    u64 events;
+    bool fired;
+
+  public:
+    waiter_t()
+        : context(nullptr)
+        , resume(nullptr)
+        , resume_arg(nullptr)
+        , slot(nullptr)
+        , events(0)
+        , fired(false)
+    {
+    }
+    waiter_t(const waiter_t &) = delete;
+    waiter_t &operator=(const waiter_t &) = delete;
+    ~waiter_t() { disarm(); }
+
+    /// call 'func' when it fires. It may be called in the thread of the owner of slot
+    void set_resume(void (*func)(void *arg), void *arg)
+    {
+        resume = func;
+        resume_arg = arg;
+    }
+
+    /// wait for 'events' defined by the owner of 'slot'. Not armed outside coroutines without resume function
+    void arm(waiter_t *&slot, u64 events)
+    {
+        if (resume == nullptr)
+        {
+            auto co = coroutine_t::current();
+            if (co == nullptr || co->get_execute_context() == nullptr)
+                return;
+            context = co->get_execute_context();
+        }
+        disarm();
+        this->slot = &slot;
+        this->events = events;
+        fired = false;
+        slot = this;
+    }
+
+    void disarm()
+    {
+        if (slot && *slot == this)
+            *slot = nullptr;
+        slot = nullptr;
+    }
+
+    bool is_armed() const { return slot != nullptr; }
+    bool is_fired() const { return fired; }
+    bool wants(u64 type) const { return (events & type) != 0; }
+
+    /// resume the waiting coroutine. Called by the owner of slot
+    void fire()
+    {
+        fired = true;
+        disarm();
+        if (resume)
+            resume(resume_arg);
+        else
+            context->start();
+    }
+
+    /// owner of slot is destroyed, the waiter is never fired
+    void detach() { slot = nullptr; }
+};
+
+/// cancellation of awaits with an absolute deadline
+/// A token is canceled when the deadline is reached or 'cancel' is called, and it cancels its children. Nested awaits
+/// take a child of the token of the outer await, so cancellation reaches the innermost wait without callbacks.
+/// One timer is armed in the loop of the waiting context when the first wait begins, it is kept for later waits and
+/// removed when the token is canceled or destroyed. The context is kept in its loop while the timer is armed.
+///\note Not thread-safe, use it in the loop thread of the waiting context
+class cancel_token_t
+{
+    cancel_token_t *parent;
+    /// intrusive list of children
+    cancel_token_t *children, *prev, *next;
+    microsecond_t deadline;
+    bool canceled;
+    /// context which is waiting for the token
+    execute_context_t *waiting;
+    /// context whose loop holds the timer
+    execute_context_t *timer_context;
+    timer_node_t timer;
+
+    void arm(execute_context_t *context);
+    void disarm();
+
+  public:
+    /// token without deadline, it is canceled by 'cancel' only
+    cancel_token_t();
+    explicit cancel_token_t(microsecond_t deadline);
+    /// child of 'parent', it is canceled with parent or at its own deadline
+    ///\param parent nullptr for a root token
+    cancel_token_t(cancel_token_t *parent, microsecond_t deadline = make_timespan_full());
+    cancel_token_t(const cancel_token_t &) = delete;
+    cancel_token_t &operator=(const cancel_token_t &) = delete;
+    ~cancel_token_t();
+
+    /// the earlier deadline of the token and its parents
+    microsecond_t get_deadline() const { return deadline; }
+    bool is_canceled() const { return canceled; }
+
+    /// cancel the token and its children, resume the waiting context
+    void cancel();
+
+    /// called before the coroutine of 'context' yields. The token is canceled if the deadline is passed
+    void begin_wait(execute_context_t *context);
+    void end_wait() { waiting = nullptr; }
+};
+
 class paramter_t
 {
     /// how many times called
@@ -196,36 +402,59 @@ class paramter_t
     //. stop immediately because timeout
     bool stop;
     void *user_ptr;
-    std::vector<std::pair<std::function<void()>, bool>> stop_listener;
+    /// nullptr if the await can't be canceled
+    cancel_token_t *token;
+    waiter_t waiter;
 
   public:
-    paramter_t()
+    paramter_t(cancel_token_t *token = nullptr)
         : times(0)
         , stop(false)
-        , user_ptr(nullptr){};
+        , user_ptr(nullptr)
+        , token(token){};
 
-    bool is_stop() const { return stop; }
+    bool is_stop() const { return stop || (token && token->is_canceled()); }
     int get_times() const { return times; }
     void set_user_ptr(void *ptr) { user_ptr = ptr; }
     void *get_user_ptr() const { return user_ptr; }
-    void stop_wait()
+    void stop_wait() { stop = true; }
+    cancel_token_t *get_token() const { return token; }
+
+    void add_times() { times++; }
+    void clear_times() { times = 0; }
+
+    /// called by an unfinished operation, it is called again only when the owner of 'slot' fires one of 'events'.
+    /// Operations which don't call it are called again whenever the coroutine is resumed
+    void wait_for(waiter_t *&slot, u64 events) { waiter.arm(slot, events); }
+    /// true if the last call waits for an owner by 'wait_for'
+    bool is_waiting_for() const { return waiter.is_armed(); }
+    /// resume by 'func' instead of the current coroutine when the owner fires
+    void set_resume(void (*func)(void *arg), void *arg) { waiter.set_resume(func, arg); }
+
+    /// yield until the operation can be retried or the token is canceled
+    void wait()
     {
-        stop = true;
-        for (auto &i : stop_listener)
+        bool armed = waiter.is_armed();
+        auto context = token ? coroutine_t::current()->get_execute_context() : nullptr;
+        await_stat.waits++;
+        while (1)
         {
-            if (i.second)
-                i.first();
+            if (context)
+            {
+                token->begin_wait(context);
+                if (token->is_canceled())
+                    return;
+            }
+            coroutine_t::yield();
+            if (context)
+                token->end_wait();
+            await_stat.resumes++;
+            if (!armed || waiter.is_fired() || is_stop())
+                return;
+            /// resumed by others, e.g. start_with. Keep waiting
+            await_stat.spurious++;
         }
     }
-    int add_stop_wait_fn(std::function<void()> fn)
-    {
-        stop_listener.emplace_back(fn, true);
-        return (int)stop_listener.size() - 1;
-    }
-    void remove_stop_wait_fn(int idx) { stop_listener[idx].second = false; }
-
-    void add_times() { times++; }
-    void clear_times() { times = 0; }
 };
 
 /// async wait
@@ -245,24 +474,25 @@ template <typename Func, typename... Args> inline static auto await(Func func, A
         {
             return ret();
         }
+        if (param.get_times() > 0)
+            await_stat.spurious++;
         param.add_times();
-        coroutine_t::yield();
+        param.wait();
     }
 }
 
-/// async wait timeout
+/// async wait until token is canceled
 ///
 ///\tparam func function to async wait
 ///\tparam args function args request
-///\param span microseconds for maximum timeout
+///\param token cancellation of the wait. Func sees 'is_stop' when it is canceled
 ///\return return function result when async wait ok
 ///\note All Func with coroutine tag is not reentrant. Don't wait for function calls with the same parameters at the
 /// same time.
 template <typename Func, typename... Args>
-inline static auto await_timeout(microsecond_t span, Func func, Args &&... args)
+inline static auto await_with(cancel_token_t &token, Func func, Args &&... args)
 {
-    paramter_t param;
-    auto co = coroutine_t::current();
+    paramter_t param(&token);
     while (1)
     {
         auto ret = func(param, std::forward<Args>(args)...);
@@ -270,13 +500,28 @@ inline static auto await_timeout(microsecond_t span, Func func, Args &&... args)
         {
             return ret();
         }
-        span = co->get_execute_context()->sleep(span);
-        if (span == 0)
-            param.stop_wait();
+        if (param.get_times() > 0 && !param.is_stop())
+            await_stat.spurious++;
         param.add_times();
+        param.wait();
     }
 }
 
+/// async wait timeout
+///
+///\tparam func function to async wait
+///\tparam args function args request
+///\param span microseconds for maximum timeout
+///\return return function result when async wait ok
+///\note All Func with coroutine tag is not reentrant. Don't wait for function calls with the same parameters at the
+/// same time.
+template <typename Func, typename... Args>
+inline static auto await_timeout(microsecond_t span, Func func, Args &&... args)
+{
+    cancel_token_t token(make_timepoint(span));
+    return await_with(token, func, std::forward<Args>(args)...);
+}
+
 /// async wait
 ///
 ///\tparam func function to async wait
@@ -287,28 +532,9 @@ inline static auto await_timeout(microsecond_t span, Func func, Args &&... args)
 template <typename Func, typename... Args>
 inline static auto await_p(paramter_t &parent_param, Func func, Args &&... args)
 {
-    paramter_t param;
-    int idx = -1;
-    while (1)
-    {
-        auto ret = func(param, std::forward<Args>(args)...);
-        if (ret.is_finish())
-        {
-            if (idx >= 0)
-                parent_param.remove_stop_wait_fn(idx);
-            return ret();
-        }
-        if (param.get_times() == 0)
-        {
-            auto co = coroutine_t::current();
-            idx = parent_param.add_stop_wait_fn([co, &param]() {
-                param.stop_wait();
-                co->resume();
-            });
-        }
-        param.add_times();
-        coroutine_t::yield();
-    }
+    /// canceled with the outer await
+    cancel_token_t token(parent_param.get_token());
+    return await_with(token, func, std::forward<Args>(args)...);
 }
 
 } // namespace net::co
\ No newline at end of file
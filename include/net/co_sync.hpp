@@ -0,0 +1,313 @@
+/**
+* \file co_sync.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief synchronization primitives for coroutines. Channel, mutex, semaphore and event
+* \version 0.1
+* \date 2020-09-28
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+#include "co.hpp"
+#include "lock.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace net::co
+{
+
+/// a coroutine or a thread waiting for a primitive, it lives in the stack of the waiter.
+/// Coroutines yield until they are woken up by 'start' of their execute context, so they can be woken up from any loop
+/// or thread. Threads which are not coroutines block on a condition variable.
+struct sync_waiter_t
+{
+    /// nullptr if the waiter is not a coroutine
+    execute_context_t *context;
+    sync_waiter_t *prev, *next;
+    /// popped by a waker, guarded by the lock of primitive. The waiter can't leave until it is signaled
+    bool claimed;
+    /// set by the loop of coroutine right before it is resumed, or under 'mutex' for threads
+    std::atomic_bool signaled;
+    /// value handed over by channel
+    void *data;
+    /// for threads only
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    sync_waiter_t(void *data = nullptr);
+    sync_waiter_t(const sync_waiter_t &) = delete;
+    sync_waiter_t &operator=(const sync_waiter_t &) = delete;
+};
+
+/// FIFO of waiters, guarded by the lock of its primitive
+class wait_list_t
+{
+    sync_waiter_t *head, *tail;
+
+  public:
+    wait_list_t()
+        : head(nullptr)
+        , tail(nullptr)
+    {
+    }
+
+    bool empty() const { return head == nullptr; }
+    void push(sync_waiter_t *waiter);
+    /// nullptr if it is empty
+    sync_waiter_t *pop();
+    void remove(sync_waiter_t *waiter);
+};
+
+/// lock and waiting of primitives
+class sync_base_t
+{
+  protected:
+    mutable lock::spinlock_t lock;
+
+    sync_base_t() = default;
+    sync_base_t(const sync_base_t &) = delete;
+    sync_base_t &operator=(const sync_base_t &) = delete;
+
+    /// wait after 'waiter' is pushed to 'list' and lock is released
+    ///\param token cancellation of coroutine waiters, ignored by threads
+    ///\return false if token is canceled before the waiter is woken up, the waiter is removed from list
+    bool wait(sync_waiter_t &waiter, wait_list_t &list, cancel_token_t *token);
+
+    /// mark a waiter popped from list as woken up. Called with lock held
+    ///\return context to start, nullptr if the waiter is a thread
+    static execute_context_t *signal(sync_waiter_t *waiter);
+    /// resume the waiter after lock is released
+    static void notify(sync_waiter_t *waiter, execute_context_t *context);
+
+    /// wake up all waiters of list, lock is not held
+    void notify_all(wait_list_t &list);
+};
+
+/// counting semaphore, waiters take permits in FIFO order. Thread-safe
+class semaphore_t : sync_base_t
+{
+    u64 count;
+    wait_list_t waiters;
+
+  public:
+    explicit semaphore_t(u64 count);
+
+    /// take a permit, wait if there is none
+    ///\return false if token is canceled
+    bool acquire(cancel_token_t *token = nullptr);
+    bool try_acquire();
+    void release(u64 n = 1);
+
+    /// permits available, approximate
+    u64 get_count() const { return count; }
+};
+
+/// mutex which suspends waiting coroutines. It is not owned by a thread, so it can be held across yields and
+/// unlocked in other loops. Thread-safe
+class mutex_t
+{
+    semaphore_t semaphore;
+
+  public:
+    mutex_t()
+        : semaphore(1)
+    {
+    }
+
+    ///\return false if token is canceled
+    bool lock(cancel_token_t *token = nullptr) { return semaphore.acquire(token); }
+    bool try_lock() { return semaphore.try_acquire(); }
+    void unlock() { semaphore.release(); }
+};
+
+/// manual reset event. Thread-safe
+class event_t : sync_base_t
+{
+    std::atomic_bool is_set_flag;
+    wait_list_t waiters;
+
+  public:
+    event_t()
+        : is_set_flag(false)
+    {
+    }
+
+    /// wake up all waiters, later waits return at once until 'reset'
+    void set();
+    void reset() { is_set_flag = false; }
+    bool is_set() const { return is_set_flag; }
+
+    /// wait until it is set
+    ///\return false if token is canceled
+    bool wait(cancel_token_t *token = nullptr);
+};
+
+/// bounded MPMC channel
+/// Values are handed to waiting receivers directly, and taken from waiting senders when there is room. Senders wait
+/// when the channel is full, so a slow consumer pushes back on producers. Thread-safe, producers can be threads
+/// which are not coroutines.
+template <typename T> class channel_t : sync_base_t
+{
+    std::deque<T> items;
+    u64 capacity;
+    bool closed;
+    wait_list_t senders;
+    wait_list_t receivers;
+
+    /// put value without waiting. Called with lock held, lock is released
+    void put_unlock(T &value)
+    {
+        if (auto receiver = receivers.pop())
+        {
+            *static_cast<std::optional<T> *>(receiver->data) = std::move(value);
+            auto context = signal(receiver);
+            lock.unlock();
+            notify(receiver, context);
+            return;
+        }
+        items.push_back(std::move(value));
+        lock.unlock();
+    }
+
+    /// take value without waiting. Called with lock held, lock is released
+    std::optional<T> take_unlock()
+    {
+        std::optional<T> result(std::move(items.front()));
+        items.pop_front();
+        if (auto sender = senders.pop())
+        {
+            /// room for a waiting sender
+            items.push_back(std::move(*static_cast<T *>(sender->data)));
+            auto context = signal(sender);
+            lock.unlock();
+            notify(sender, context);
+            return result;
+        }
+        lock.unlock();
+        return result;
+    }
+
+  public:
+    /// capacity is 1 at least
+    explicit channel_t(u64 capacity)
+        : capacity(std::max<u64>(capacity, 1))
+        , closed(false)
+    {
+    }
+
+    /// send value, wait if channel is full
+    ///\return false if channel is closed or token is canceled, value is dropped
+    bool send(T value, cancel_token_t *token = nullptr)
+    {
+        lock.lock();
+        if (closed)
+        {
+            lock.unlock();
+            return false;
+        }
+        if (items.size() < capacity || !receivers.empty())
+        {
+            put_unlock(value);
+            return true;
+        }
+        sync_waiter_t waiter(&value);
+        senders.push(&waiter);
+        lock.unlock();
+        if (!wait(waiter, senders, token))
+            return false;
+        /// data is cleared if channel is closed
+        return waiter.data != nullptr;
+    }
+
+    /// send value if channel is not full
+    ///\return false if channel is full or closed, value is not moved
+    bool try_send(T &value)
+    {
+        lock.lock();
+        if (closed || (items.size() >= capacity && receivers.empty()))
+        {
+            lock.unlock();
+            return false;
+        }
+        put_unlock(value);
+        return true;
+    }
+
+    /// receive value, wait if channel is empty
+    ///\return nullopt if channel is closed and empty, or token is canceled
+    std::optional<T> recv(cancel_token_t *token = nullptr)
+    {
+        lock.lock();
+        if (!items.empty())
+            return take_unlock();
+        if (closed)
+        {
+            lock.unlock();
+            return {};
+        }
+        std::optional<T> result;
+        sync_waiter_t waiter(&result);
+        receivers.push(&waiter);
+        lock.unlock();
+        wait(waiter, receivers, token);
+        return result;
+    }
+
+    /// receive value if channel is not empty
+    std::optional<T> try_recv()
+    {
+        lock.lock();
+        if (items.empty())
+        {
+            lock.unlock();
+            return {};
+        }
+        return take_unlock();
+    }
+
+    /// wake up all waiters. Values in channel can still be received, later sends fail
+    void close()
+    {
+        lock.lock();
+        closed = true;
+        while (auto sender = senders.pop())
+        {
+            sender->data = nullptr;
+            auto context = signal(sender);
+            lock.unlock();
+            notify(sender, context);
+            lock.lock();
+        }
+        lock.unlock();
+        notify_all(receivers);
+    }
+
+    bool is_closed() const { return closed; }
+    /// count of buffered values
+    u64 size() const
+    {
+        lock.lock();
+        u64 n = items.size();
+        lock.unlock();
+        return n;
+    }
+    u64 get_capacity() const { return capacity; }
+};
+
+} // namespace net::co
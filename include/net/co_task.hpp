@@ -0,0 +1,427 @@
+/**
+* \file co_task.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief stackless coroutines of C++20 running in event loops
+* \version 0.1
+* \date 2020-09-30
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+#include "co.hpp"
+#include "event.hpp"
+#include "execute_context.hpp"
+#include "execute_dispatcher.hpp"
+#include "timer.hpp"
+
+/// The library is built as C++17, the front-end is available to code compiled as C++20 (cmake -DUSE_CXX20=ON)
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace net::co
+{
+
+/// interval of retrying operations which don't register a waiter, e.g. rudp
+inline constexpr microsecond_t task_poll_interval = make_timespan(0, 1);
+
+/// counters of stackless coroutine frames in current thread
+struct task_stat_t
+{
+    /// frames alive
+    u64 frames;
+    /// bytes of frames alive
+    u64 frame_bytes;
+};
+
+thread_local inline task_stat_t task_stat = {};
+
+inline const task_stat_t &get_task_stat() { return task_stat; }
+
+/// resume 'handle' in 'loop' by its dispatcher
+inline void post_resume(event_loop_t &loop, std::coroutine_handle<> handle)
+{
+    loop.get_dispatcher().add_task([handle]() { handle.resume(); });
+    loop.wake_up();
+}
+
+template <typename T = void> class task_t;
+
+namespace detail
+{
+class task_promise_base_t
+{
+  public:
+    /// resumed when the task returns, nullptr if nobody awaits it
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+    /// frame is destroyed when the task returns
+    bool detached = false;
+
+    static void *operator new(std::size_t size)
+    {
+        task_stat.frames++;
+        task_stat.frame_bytes += size;
+        return ::operator new(size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size)
+    {
+        task_stat.frames--;
+        task_stat.frame_bytes -= size;
+        ::operator delete(ptr);
+    }
+
+    struct final_awaiter_t
+    {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            auto &promise = handle.promise();
+            if (promise.continuation)
+                return promise.continuation;
+            if (promise.detached)
+                handle.destroy();
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    /// tasks are lazy, they run when awaited or spawned
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter_t final_suspend() noexcept { return {}; }
+
+    void unhandled_exception()
+    {
+        /// nobody can take the exception of a detached task, throw it to the loop like stackful coroutines
+        if (detached)
+            throw;
+        error = std::current_exception();
+    }
+};
+
+template <typename T> class task_promise_t : public task_promise_base_t
+{
+  public:
+    std::optional<T> value;
+
+    task_t<T> get_return_object();
+    template <typename U> void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+    T take()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <> class task_promise_t<void> : public task_promise_base_t
+{
+  public:
+    task_t<void> get_return_object();
+    void return_void() {}
+    void take()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+} // namespace detail
+
+/// stackless coroutine
+/// A task is a frame of a few hundred bytes instead of a stack. It starts when it is awaited by 'co_await' or
+/// given to 'spawn', and it is resumed by the dispatcher of the loop where it waits.
+///\note Not thread-safe. Don't destroy a task while it is waiting
+template <typename T> class [[nodiscard]] task_t
+{
+  public:
+    using promise_type = detail::task_promise_t<T>;
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+
+    template <typename U> friend void spawn(event_loop_t &loop, task_t<U> task);
+
+  public:
+    explicit task_t(std::coroutine_handle<promise_type> handle)
+        : handle(handle)
+    {
+    }
+    task_t(task_t &&other) noexcept
+        : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+    task_t &operator=(task_t &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    task_t(const task_t &) = delete;
+    task_t &operator=(const task_t &) = delete;
+    ~task_t()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool is_done() const { return handle && handle.done(); }
+
+    /// run the task in current loop and resume the awaiting coroutine when it returns
+    auto operator co_await() &&noexcept
+    {
+        struct awaiter_t
+        {
+            std::coroutine_handle<promise_type> handle;
+            bool await_ready() noexcept { return !handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() { return handle.promise().take(); }
+        };
+        return awaiter_t{handle};
+    }
+};
+
+template <typename T> task_t<T> detail::task_promise_t<T>::get_return_object()
+{
+    return task_t<T>(std::coroutine_handle<task_promise_t<T>>::from_promise(*this));
+}
+
+inline task_t<void> detail::task_promise_t<void>::get_return_object()
+{
+    return task_t<void>(std::coroutine_handle<task_promise_t<void>>::from_promise(*this));
+}
+
+/// run the task in 'loop' without waiting for it, the frame is destroyed when it returns. Thread-safe
+template <typename T> void spawn(event_loop_t &loop, task_t<T> task)
+{
+    auto handle = std::exchange(task.handle, nullptr);
+    handle.promise().detached = true;
+    post_resume(loop, handle);
+}
+
+/// wait for a poll-style operation, the stackless counterpart of 'await'
+/// Operations which register a waiter with 'wait_for' are retried when the owner fires it, others are retried every
+/// 'task_poll_interval'.
+template <typename Func, typename... Args> class poll_awaiter_t
+{
+    using result_t = decltype(
+        std::declval<Func &>()(std::declval<paramter_t &>(), std::declval<std::remove_reference_t<Args> &>()...)());
+
+    Func func;
+    /// arguments live until the end of the co_await expression
+    std::tuple<Args &&...> args;
+    paramter_t param;
+    std::optional<result_t> result;
+    std::coroutine_handle<> handle;
+    event_loop_t *loop;
+    timer_node_t retry;
+
+    bool poll()
+    {
+        auto ret = std::apply([this](auto &... values) { return func(param, values...); }, args);
+        if (ret.is_finish())
+        {
+            result.emplace(ret());
+            return true;
+        }
+        param.add_times();
+        /// nobody fires a waiter, try again later
+        if (!param.is_waiting_for())
+        {
+            retry.timepoint = make_timepoint(task_poll_interval);
+            retry.callback = [this]() { post_repoll(); };
+            loop->add_timer(retry);
+        }
+        return false;
+    }
+
+    void repoll()
+    {
+        await_stat.resumes++;
+        if (poll())
+        {
+            handle.resume();
+            return;
+        }
+        await_stat.spurious++;
+    }
+
+    void post_repoll()
+    {
+        loop->get_dispatcher().add_task([this]() { repoll(); });
+        loop->wake_up();
+    }
+
+    /// fired by the owner of waiter, maybe in another thread
+    static void on_fire(void *arg) { static_cast<poll_awaiter_t *>(arg)->post_repoll(); }
+
+  public:
+    poll_awaiter_t(Func func, Args &&... args)
+        : func(func)
+        , args(std::forward<Args>(args)...)
+        , loop(nullptr)
+    {
+        param.set_resume(&on_fire, this);
+    }
+    poll_awaiter_t(const poll_awaiter_t &) = delete;
+    poll_awaiter_t &operator=(const poll_awaiter_t &) = delete;
+    ~poll_awaiter_t()
+    {
+        if (retry.is_linked())
+            loop->remove_timer(retry);
+    }
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> awaiting)
+    {
+        handle = awaiting;
+        loop = &event_loop_t::current();
+        if (poll())
+            return false;
+        await_stat.waits++;
+        return true;
+    }
+    result_t await_resume() { return std::move(*result); }
+};
+
+/// co_await an operation of the same form as 'await', e.g. co_await co::async(socket_aread, socket, buffer)
+template <typename Func, typename... Args> poll_awaiter_t<Func, Args...> async(Func func, Args &&... args)
+{
+    return poll_awaiter_t<Func, Args...>(func, std::forward<Args>(args)...);
+}
+
+/// resume at a time point
+class sleep_awaiter_t
+{
+    microsecond_t timepoint;
+    timer_node_t timer;
+    event_loop_t *loop;
+
+  public:
+    explicit sleep_awaiter_t(microsecond_t timepoint)
+        : timepoint(timepoint)
+        , loop(nullptr)
+    {
+    }
+    sleep_awaiter_t(const sleep_awaiter_t &) = delete;
+    sleep_awaiter_t &operator=(const sleep_awaiter_t &) = delete;
+    ~sleep_awaiter_t()
+    {
+        if (timer.is_linked())
+            loop->remove_timer(timer);
+    }
+
+    bool await_ready() { return get_current_time() >= timepoint; }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        loop = &event_loop_t::current();
+        timer.timepoint = timepoint;
+        /// timer callbacks run in the time wheel, resume after it
+        timer.callback = [this, handle]() { post_resume(*loop, handle); };
+        loop->add_timer(timer);
+    }
+    void await_resume() {}
+};
+
+inline sleep_awaiter_t sleep_for(microsecond_t span) { return sleep_awaiter_t(make_timepoint(span)); }
+inline sleep_awaiter_t sleep_until(microsecond_t timepoint) { return sleep_awaiter_t(timepoint); }
+
+/// continue in another loop. Thread-safe
+class switch_awaiter_t
+{
+    event_loop_t &loop;
+
+  public:
+    explicit switch_awaiter_t(event_loop_t &loop)
+        : loop(loop)
+    {
+    }
+    bool await_ready() { return &loop == &event_loop_t::current(); }
+    void await_suspend(std::coroutine_handle<> handle) { post_resume(loop, handle); }
+    void await_resume() {}
+};
+
+inline switch_awaiter_t switch_to(event_loop_t &loop) { return switch_awaiter_t(loop); }
+
+namespace detail
+{
+template <typename T> struct task_join_t
+{
+    std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+    std::exception_ptr error;
+    execute_context_t *context;
+    bool done = false;
+};
+
+template <typename T> task_t<void> join_task(task_t<T> task, task_join_t<T> *join)
+{
+    try
+    {
+        if constexpr (std::is_void_v<T>)
+        {
+            co_await std::move(task);
+            join->value.emplace(true);
+        }
+        else
+            join->value.emplace(co_await std::move(task));
+    } catch (...)
+    {
+        join->error = std::current_exception();
+    }
+    join->done = true;
+    join->context->start();
+}
+} // namespace detail
+
+/// wait for a task in a stackful coroutine, the task runs in the loop of the coroutine
+///\return value of task
+///\throw exception thrown by task
+template <typename T> T await_task(task_t<T> task)
+{
+    auto co = coroutine_t::current();
+    detail::task_join_t<T> join;
+    join.context = co->get_execute_context();
+    auto loop = join.context->get_loop();
+    spawn(*loop, detail::join_task(std::move(task), &join));
+    await_stat.waits++;
+    while (!join.done)
+    {
+        coroutine_t::yield();
+        await_stat.resumes++;
+        if (!join.done)
+            await_stat.spurious++;
+    }
+    if (join.error)
+        std::rethrow_exception(join.error);
+    if constexpr (!std::is_void_v<T>)
+        return std::move(*join.value);
+}
+
+} // namespace net::co
+
+#endif
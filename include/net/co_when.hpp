@@ -0,0 +1,180 @@
+/**
+* \file co_when.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief wait for several operations in one coroutine
+* \version 0.1
+* \date 2020-09-29
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+#include "callable.hpp"
+#include "co.hpp"
+#include <exception>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace net
+{
+class execute_context_t;
+}
+
+namespace net::co
+{
+
+/// branches of when_any/when_all
+/// Each branch runs in a child coroutine in the loop of the caller, the caller is kept in its loop until all branches
+/// return, so branches and caller never run at the same time. Branches take a child token of the caller's token.
+class branch_group_t
+{
+    execute_context_t *parent;
+    bool parent_pinned;
+    /// canceled when a branch of when_any returns or a branch throws
+    cancel_token_t token;
+    bool any;
+    u64 running;
+    u64 winner;
+    std::exception_ptr error;
+    std::vector<callable_t<void()>> bodies;
+    std::vector<std::unique_ptr<execute_context_t>> branches;
+
+    void run_branch(u64 index);
+
+  public:
+    static constexpr u64 no_winner = ~0ull;
+
+    ///\param parent_token token of caller, nullptr if the wait can't be canceled
+    ///\param any stop other branches when the first one returns
+    ///\throw std::logic_error if it is not called in a coroutine of an execute context
+    branch_group_t(cancel_token_t *parent_token, bool any, u64 count);
+    branch_group_t(const branch_group_t &) = delete;
+    branch_group_t &operator=(const branch_group_t &) = delete;
+    /// cancel and wait for running branches
+    ~branch_group_t();
+
+    cancel_token_t &get_token() { return token; }
+
+    /// start a branch
+    void spawn(callable_t<void()> body);
+
+    /// yield until all branches return
+    ///\throw exception thrown by a branch
+    void wait();
+
+    /// index of the branch which returns first
+    u64 get_winner() const { return winner; }
+};
+
+/// sleep in a branch until the token is canceled
+///\return true if it sleeps for 'span', false if token is canceled before
+bool sleep_with(cancel_token_t &token, microsecond_t span);
+
+/// value of a branch, void is std::monostate
+template <typename Func>
+using branch_result_t = std::conditional_t<std::is_void_v<std::invoke_result_t<Func &, cancel_token_t &>>,
+                                           std::monostate, std::invoke_result_t<Func &, cancel_token_t &>>;
+
+namespace detail
+{
+template <typename Func> branch_result_t<Func> invoke_branch(Func &func, cancel_token_t &token)
+{
+    if constexpr (std::is_void_v<std::invoke_result_t<Func &, cancel_token_t &>>)
+    {
+        func(token);
+        return {};
+    }
+    else
+        return func(token);
+}
+
+template <typename Results, typename Funcs, std::size_t... I>
+void spawn_branches(branch_group_t &group, Results &results, Funcs &funcs, std::index_sequence<I...>)
+{
+    (group.spawn([&group, &result = std::get<I>(results), &func = std::get<I>(funcs)]() {
+        result.emplace(invoke_branch(func, group.get_token()));
+    }),
+     ...);
+}
+
+template <typename Value, typename Results, std::size_t... I>
+void take_winner(std::optional<Value> &value, Results &results, u64 winner, std::index_sequence<I...>)
+{
+    ((I == winner ? (void)value.emplace(std::in_place_index<I>, std::move(*std::get<I>(results))) : (void)0), ...);
+}
+} // namespace detail
+
+/// wait until all branches return
+///
+///\param token cancellation of the wait, branches see it canceled. Branches must return when their token is canceled
+///\param funcs branches called with a cancel_token_t&, e.g. a lambda which calls co::await_with
+///\return tuple of branch values
+///\throw exception thrown by a branch, other branches are canceled
+template <typename... Funcs> auto when_all_with(cancel_token_t &token, Funcs &&... funcs)
+{
+    std::tuple<std::optional<branch_result_t<Funcs>>...> results;
+    std::tuple<Funcs &...> refs(funcs...);
+    {
+        branch_group_t group(&token, false, sizeof...(Funcs));
+        detail::spawn_branches(group, results, refs, std::index_sequence_for<Funcs...>());
+        group.wait();
+    }
+    return std::apply([](auto &... result) { return std::make_tuple(std::move(*result)...); }, results);
+}
+
+/// wait until all branches return
+///\see when_all_with
+template <typename... Funcs> auto when_all(Funcs &&... funcs)
+{
+    cancel_token_t token;
+    return when_all_with(token, std::forward<Funcs>(funcs)...);
+}
+
+/// wait until one of branches returns, others are canceled and waited
+///
+///\param token cancellation of the wait, branches see it canceled. Branches must return when their token is canceled
+///\param funcs branches called with a cancel_token_t&, e.g. a lambda which calls co::await_with
+///\return value of the first branch, 'index' of the variant is the index of the branch
+///\throw exception thrown by a branch, other branches are canceled
+template <typename... Funcs> auto when_any_with(cancel_token_t &token, Funcs &&... funcs)
+{
+    using value_t = std::variant<branch_result_t<Funcs>...>;
+    std::tuple<std::optional<branch_result_t<Funcs>>...> results;
+    std::tuple<Funcs &...> refs(funcs...);
+    u64 winner;
+    {
+        branch_group_t group(&token, true, sizeof...(Funcs));
+        detail::spawn_branches(group, results, refs, std::index_sequence_for<Funcs...>());
+        group.wait();
+        winner = group.get_winner();
+    }
+    std::optional<value_t> value;
+    detail::take_winner(value, results, winner, std::index_sequence_for<Funcs...>());
+    return std::move(*value);
+}
+
+/// wait until one of branches returns
+///\see when_any_with
+template <typename... Funcs> auto when_any(Funcs &&... funcs)
+{
+    cancel_token_t token;
+    return when_any_with(token, std::forward<Funcs>(funcs)...);
+}
+
+} // namespace net::co
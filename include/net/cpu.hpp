@@ -0,0 +1,80 @@
+/**
+* \file cpu.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief cpu topology and thread affinity
+* \version 0.1
+* \date 2020-09-20
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+#include <vector>
+
+namespace net
+{
+
+struct cpu_info_t
+{
+    /// logical cpu id
+    int id;
+    /// physical core id in package
+    int core;
+    int package;
+    /// numa node, 0 if numa is not available
+    int node;
+};
+
+/// cpu topology of current process
+class cpu_topology_t
+{
+    std::vector<cpu_info_t> cpus;
+    int node_count;
+
+  public:
+    cpu_topology_t() = default;
+    /// build from cpu list, used by tests
+    cpu_topology_t(std::vector<cpu_info_t> cpus);
+
+    /// read topology from sysfs, cpus which are not in the affinity mask of the process are skipped.
+    /// Fall back to one node with a core per hardware thread if sysfs is not available.
+    static cpu_topology_t detect();
+
+    const std::vector<cpu_info_t> &get_cpus() const { return cpus; }
+    int get_node_count() const { return node_count; }
+    /// count of physical cores
+    int get_core_count() const;
+
+    /// choose cpus to run loops.
+    /// Physical cores are taken before their hyper-thread siblings, and nodes are taken in turn so loops are spread
+    /// over memory controllers. Cpus are reused when there are more loops than cpus.
+    ///
+    ///\param count count of loops
+    ///\param reserved count of physical cores left for IRQ handling, the lowest cores of the first node are reserved
+    ///\return cpu id of each loop, empty if no cpu is available
+    std::vector<int> plan(int count, int reserved) const;
+};
+
+/// bind current thread to cpu
+///\return false if it is failed or not supported
+bool bind_thread_to_cpu(int cpu);
+
+/// cpu bound by bind_thread_to_cpu in current thread, -1 if the thread is not bound
+int get_thread_cpu();
+
+/// allocate pages touched by current thread on the local numa node, whatever the memory policy of the process is.
+/// Memory of a loop is allocated by the loop thread first, so it is placed on the node of the loop cpu.
+void set_thread_local_memory();
+
+} // namespace net
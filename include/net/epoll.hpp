@@ -23,6 +23,7 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #ifndef OS_WINDOWS
 #include "event.hpp"
 #include <unordered_map>
+#include <vector>
 
 namespace net
 {
@@ -30,14 +31,18 @@ class event_epoll_demultiplexer : public event_demultiplexer
 {
     int fd;
     int ev_fd;
+    /// buffer passed to epoll_wait, grows to the largest batch requested
+    std::vector<epoll_event> events;
 
   public:
     event_epoll_demultiplexer();
     ~event_epoll_demultiplexer();
     void add(handle_t handle, event_type_t type) override;
-    handle_t select(event_type_t *type, microsecond_t *timeout) override;
+    int select(ready_event_t *events, int max_events, microsecond_t *timeout) override;
     void remove(handle_t handle, event_type_t type) override;
     void wake_up(event_loop_t &cur_loop) override;
+    void update(handle_t handle, event_type_t old_type, event_type_t new_type) override;
+    bool is_edge_triggered() const override { return true; }
 };
 } // namespace net
 #endif
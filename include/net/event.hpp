@@ -24,11 +24,15 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #include "lock.hpp"
 #include "net.hpp"
 #include "timer.hpp"
+#include <condition_variable>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace net
 {
@@ -48,6 +52,16 @@ enum : event_type_t
     def = 8,
 };
 };
+/// default count of ready events fetched from demultiplexer per select
+inline constexpr int default_event_batch_size = 128;
+
+/// a ready event returned by demultiplexer
+struct ready_event_t
+{
+    handle_t handle;
+    event_type_t type;
+};
+
 /// forward declaration
 class socket_t;
 class event_context_t;
@@ -58,6 +72,8 @@ enum event_strategy
 {
     select,
     epoll,
+    /// linux completion queue. sockets are created as uring_socket_t
+    io_uring,
     /// TODO: Encapsulation of IOCP
     IOCP,
     AUTO,
@@ -78,12 +94,13 @@ class event_demultiplexer
     ///\note adding an already added event will not affect
     virtual void add(handle_t handle, event_type_t type) = 0;
 
-    /// listen and return a socket handle which happends event
+    /// listen and return a batch of socket handles which happend events
     ///
-    ///\param type a pointer to event_type. return socket event type
+    ///\param events output array of ready events
+    ///\param max_events capacity of 'events', at least 1
     ///\param timeout maximum time to wait. If an error occurs, the parameter is set to 0
-    ///\return socket happends event, return 0 for error, just recall it
-    virtual handle_t select(event_type_t *type, microsecond_t *timeout) = 0;
+    ///\return count of ready events in 'events', return 0 for error or timeout, just recall it
+    virtual int select(ready_event_t *events, int max_events, microsecond_t *timeout) = 0;
 
     /// unregister event on handle
     ///
@@ -94,6 +111,22 @@ class event_demultiplexer
 
     virtual void wake_up(event_loop_t &cur_loop) = 0;
 
+    /// change registered events on handle from 'old_type' to 'new_type'
+    ///
+    ///\param old_type events registered now, 0 if handle is not registered
+    ///\param new_type events to register, 0 to unregister handle
+    virtual void update(handle_t handle, event_type_t old_type, event_type_t new_type)
+    {
+        if (old_type & ~new_type)
+            remove(handle, old_type & ~new_type);
+        if (new_type & ~old_type)
+            add(handle, new_type & ~old_type);
+    }
+
+    /// return true if events are reported once per state change.
+    /// event loop keeps handles registered and caches interest mask on edge triggered demultiplexer.
+    virtual bool is_edge_triggered() const { return false; }
+
     virtual ~event_demultiplexer(){};
 };
 
@@ -107,6 +140,149 @@ class event_handler_t
     virtual ~event_handler_t(){};
 };
 
+/// handle -> event handler table of an event loop
+/// Slots are indexed by handle directly and allocated in chunks on demand, chunks are never freed until the table is
+/// destroyed. 'find' is wait-free and used by the loop thread on every ready event, 'add' and 'remove' can be called
+/// from any thread. Every slot has a generation which is increased on each 'add' and 'remove', so a handle which is
+/// removed or reused during a batch of events can be detected.
+class event_handler_table_t
+{
+  public:
+    /// slots per chunk
+    static constexpr u64 chunk_size = 4096;
+    /// maximum count of chunks, limits the maximum handle
+    static constexpr u64 max_chunks = 4096;
+
+    struct slot_t
+    {
+        std::atomic<event_handler_t *> handler;
+        std::atomic_uint generation;
+        /// event types the handler is waiting for
+        std::atomic<event_type_t> interest;
+        /// event types reported while the handler is not waiting for them
+        std::atomic<event_type_t> pending;
+        /// event types registered in demultiplexer
+        std::atomic<event_type_t> registered;
+    };
+
+  private:
+    std::unique_ptr<std::atomic<slot_t *>[]> chunks;
+    std::atomic_int count;
+    /// lock chunk allocation and writers of slots
+    lock::spinlock_t lock;
+
+    slot_t *alloc_slot(handle_t handle);
+
+  public:
+    event_handler_table_t();
+    ~event_handler_table_t();
+
+    event_handler_table_t(const event_handler_table_t &) = delete;
+    event_handler_table_t &operator=(const event_handler_table_t &) = delete;
+
+    /// get slot of 'handle', nullptr if it is never allocated
+    slot_t *get_slot(handle_t handle) const;
+
+    /// set handler of 'handle', replace the old one
+    ///\return generation of the slot after adding
+    u32 add(handle_t handle, event_handler_t *handler);
+
+    /// remove handler of 'handle' if it is still 'handler'
+    ///\return false if the slot is empty or owned by another handler
+    bool remove(handle_t handle, event_handler_t *handler);
+
+    /// find handler of 'handle'
+    ///\param generation output generation of the slot, can be nullptr
+    ///\return nullptr if no handler
+    event_handler_t *find(handle_t handle, u32 *generation = nullptr) const;
+
+    /// current generation of 'handle', 0 if the slot is never used
+    u32 generation(handle_t handle) const;
+
+    /// count of registered handlers
+    int size() const { return count; }
+};
+
+/// counters of interest mask cache of an event loop
+struct interest_stat_t
+{
+    /// calls to demultiplexer by link/unlink
+    u64 demuxer_calls;
+    /// link/unlink calls served by cached interest mask without calling demultiplexer
+    u64 saved_calls;
+    /// events reported before the handler waits for them, delivered again by link
+    u64 redelivered;
+};
+
+/// counters of work stealing of an event loop
+struct schedule_stat_t
+{
+    /// runnable contexts taken by this loop when it is idle
+    u64 stolen;
+    /// runnable contexts given to idle loops
+    u64 given;
+    /// contexts moved from other loops by balancing
+    u64 migrated_in;
+    /// contexts moved to other loops by balancing
+    u64 migrated_out;
+    /// wake up events written to demultiplexer by other threads
+    u64 wake_ups;
+};
+
+/// profiling histograms of an event loop, times are in microseconds
+struct loop_profile_t
+{
+    /// time of each run iteration
+    histogram_snapshot_t iteration;
+    /// time waiting in demultiplexer, including busy polling
+    histogram_snapshot_t select;
+    /// fire time minus timepoint of timers
+    histogram_snapshot_t timer_lag;
+    /// coroutines resumed per dispatch, dispatches without resume are not recorded
+    histogram_snapshot_t resumes;
+    /// longest single resume per dispatch
+    histogram_snapshot_t longest_resume;
+    /// ready events per wakeup
+    histogram_snapshot_t events;
+};
+
+/// counters of busy polling of an event loop
+struct busy_poll_stat_t
+{
+    /// times the loop spins before blocking
+    u64 spins;
+    /// spins which find events or tasks, the loop doesn't sleep
+    u64 hits;
+    /// spins which run out of budget, the loop blocks in demultiplexer
+    u64 sleeps;
+    /// current adaptive budget
+    microsecond_t budget;
+};
+
+/// default period to check the load of loops in work stealing mode
+inline constexpr microsecond_t default_balance_period = 100000;
+
+/// period to sample load metrics of a loop, metrics are decayed by half per period
+inline constexpr microsecond_t load_sample_period = 50000;
+
+/// maximum count of loops which can be chosen by select_loop
+inline constexpr int max_select_loops = 1024;
+
+/// decayed load metrics of an event loop
+struct load_stat_t
+{
+    /// time spent out of demultiplexer, per-mille of wall time
+    u64 busy;
+    /// count of queued tasks in dispatcher
+    u64 queue_depth;
+    /// bytes read and written by sockets in loop per second
+    u64 bytes_per_second;
+    /// count of registered event handlers
+    u64 handlers;
+    /// contexts assigned by select_loop recently, their load is not sampled yet
+    u64 assigned;
+};
+
 /// event loop
 /// a loop per thread
 /// all event is generate by demultiplexer. it just fetch events and distribute event to event handler and run into
@@ -115,25 +291,87 @@ class event_handler_t
 class event_loop_t
 {
   private:
-    using event_handle_map_t = std::unordered_map<handle_t, event_handler_t *>;
     friend class event_context_t;
     friend class event_fd_handler_t;
     friend class event_apc_handler_t;
+    friend class uring_socket_t;
+    friend class execute_context_t;
+    friend class execute_thread_dispatcher_t;
 
     bool is_exit;
     int exit_code;
+    /// 'run' is not returned
+    std::atomic_bool running;
+    /// monotonic time cached for this loop thread, see get_current_time
+    microsecond_t cached_time;
+    /// cpu the loop thread is bound to, -1 if it is not bound
+    int cpu;
 
     event_demultiplexer *demuxer;
     /// map handle -> event handler
-    event_handle_map_t event_map;
-    /// lock the event map
-    lock::spinlock_t lock;
+    event_handler_table_t handler_table;
+    /// lock registered events of slots
+    lock::spinlock_t interest_lock;
+    std::atomic<u64> demuxer_calls, saved_calls, redelivered;
+
+    /// pending events taken by link, delivered in next loop
+    std::vector<ready_event_t> redeliver_events;
+    std::vector<ready_event_t> redeliver_batch;
+    std::atomic_bool has_redeliver;
+    lock::spinlock_t redeliver_lock;
 
     event_context_t *context;
     std::unique_ptr<time_manager_t> time_manager;
 
     execute_thread_dispatcher_t dispatcher;
-    bool has_wake_up;
+    /// loop is armed to block in demultiplexer, only the producer which clears it writes the wake up event
+    std::atomic_bool sleeping;
+    /// wake up events written by other threads
+    std::atomic<u64> wake_ups;
+
+    /// contexts owned by this loop
+    execute_context_t *contexts;
+    lock::spinlock_t contexts_lock;
+
+    /// work stealing
+    /// blocking in demultiplexer with an empty dispatcher queue, can take runnable contexts
+    std::atomic_bool idle;
+    /// resumes in current balance period
+    u64 window_resumes;
+    /// resumes in last balance period, read by other loops
+    std::atomic<u64> load;
+    microsecond_t balance_timepoint;
+    /// count of continuous overloaded periods
+    int overload_periods;
+    std::atomic<u64> stolen, given, migrated_in, migrated_out;
+
+    /// load metrics, sampled by loop thread every load_sample_period
+    /// timepoint leaving demultiplexer
+    microsecond_t busy_start;
+    /// busy time in current sample period
+    microsecond_t busy_time;
+    std::atomic<microsecond_t> sample_timepoint;
+    /// bytes in current sample period
+    std::atomic<u64> io_bytes;
+    /// decayed metrics, read by other threads
+    std::atomic<u64> busy_avg, queue_avg, bytes_rate;
+    std::atomic<u64> assigned;
+
+    /// busy polling, 'busy_poll_max' is 0 if it is disabled
+    std::atomic<microsecond_t> busy_poll_max;
+    /// written by loop thread, read by 'get_busy_poll_stat' in other threads
+    std::atomic<microsecond_t> busy_poll_budget;
+    std::atomic<u64> busy_poll_spins, busy_poll_hits, busy_poll_sleeps;
+
+    /// profiling, recorded by loop thread
+    histogram_t iteration_histogram, select_histogram, events_histogram;
+    histogram_t resumes_histogram, longest_resume_histogram;
+
+    /// ready events fetched by a select
+    std::vector<ready_event_t> ready_events;
+    /// handlers of ready events and generations of their slots when the batch is resolved
+    std::vector<event_handler_t *> ready_handlers;
+    std::vector<u32> ready_generations;
 
 #ifndef OS_WINDOWS
 #else
@@ -153,12 +391,37 @@ class event_loop_t
 
     event_demultiplexer *get_demuxer() const { return demuxer; }
 
+    void add_context(execute_context_t *exectx);
+    void remove_context(execute_context_t *exectx);
+
+    /// give a runnable context to an idle loop. called by dispatcher
+    ///\param backlog count of items left in the dispatcher queue
+    ///\return true if the context is given
+    bool try_give(dispatch_node_t *node, u64 backlog);
+    /// move overloaded contexts to other loops
+    void balance();
+    /// update load metrics if a sample period is passed
+    void sample_load();
+    /// poll demultiplexer without blocking until budget is exhausted, 'timeout' is reduced by the spinning time
+    ///\return count of ready events
+    int busy_poll(microsecond_t &timeout);
+    /// adjust budget by the time blocked in demultiplexer, it shrinks if nothing arrives
+    void adapt_busy_poll(microsecond_t slept, bool arrived);
+    /// move context from this loop to 'to'. call it in loop thread
+    void migrate_context(execute_context_t *exectx, event_loop_t &to);
+    bool can_migrate(execute_context_t *exectx) const;
+
   private:
+    /// filter event by interest mask of handle, keep the rest in pending mask
+    ///\return event types to deliver
+    event_type_t filter_event(handle_t handle, event_type_t type);
+    void deliver_redeliver_events();
+
     /// run loop util call exit
     int run();
 
   public:
-    event_loop_t(microsecond_t precision);
+    event_loop_t(microsecond_t precision, int event_batch_size = default_event_batch_size);
     ~event_loop_t();
 
     event_loop_t(const event_loop_t &) = delete;
@@ -167,20 +430,73 @@ class event_loop_t
     /// exit event loop with code.
     void exit(int code);
     /// get workload
-    int load_factor();
+    /// Sum of busy per-mille, queue depth, KiB per second divided by 64, handlers and recent assignments. Metrics of a
+    /// loop blocking in demultiplexer decay by time, so it can be called from any thread.
+    u64 load_factor() const;
+
+    /// decayed load metrics
+    load_stat_t get_load_stat() const;
+
+    /// spin before blocking in demultiplexer, trade cpu for latency
+    /// The loop polls dispatcher and demultiplexer without timeout for a budget, which grows when events arrive
+    /// shortly after the loop blocks and shrinks when the loop blocks for a long time. Sockets registered later get
+    /// SO_BUSY_POLL, which takes effect with the net.core.busy_poll sysctl or CAP_NET_ADMIN.
+    ///
+    ///\param max_budget maximum spinning time, 0 to disable
+    ///\note call it in the loop thread or before the loop runs
+    void set_busy_poll(microsecond_t max_budget);
+    microsecond_t get_busy_poll() const { return busy_poll_max; }
+
+    /// counters of busy polling
+    busy_poll_stat_t get_busy_poll_stat() const;
+
+    /// snapshot profiling histograms
+    /// Thread-safe
+    loop_profile_t get_profile() const;
+
+    /// count bytes transferred by sockets of this loop
+    /// Thread-safe
+    void add_io_bytes(u64 bytes) { io_bytes.fetch_add(bytes, std::memory_order_relaxed); }
+
+    /// set how many ready events are fetched from demultiplexer per select
+    ///\note call it in the loop thread or before the loop runs
+    void set_event_batch_size(int size);
+    int get_event_batch_size() const { return (int)ready_events.size(); }
 
     /// register event 'type' on 'handle', call it repeatedly is allowed
+    ///\note On edge triggered demultiplexer, handle with an event handler is registered once and only updated when
+    /// the registered mask grows. The interest mask is kept by loop.
     event_loop_t &link(handle_t handle, event_type_t type);
     /// unregister event 'type' on 'handle'
+    ///\note On edge triggered demultiplexer, it only clears the interest mask. The handle is unregistered by
+    /// 'remove_event_handler'.
     event_loop_t &unlink(handle_t handle, event_type_t type);
 
+    /// counters of interest mask cache
+    interest_stat_t get_interest_stat() const;
+
+    /// interest mask of handle cached by loop, 0 if it is not cached
+    event_type_t get_interest(handle_t handle) const;
+
+    /// counters of work stealing
+    schedule_stat_t get_schedule_stat() const;
+
+    /// resumes in last balance period
+    u64 get_load() const { return load; }
+
     /// map handle -> handler
     /// thread-safety
     void add_event_handler(handle_t handle, event_handler_t *handler);
     void remove_event_handler(handle_t handle, event_handler_t *handler);
+    event_handler_t *find_event_handler(handle_t handle) const { return handler_table.find(handle); }
 
     timer_registered_t add_timer(timer_t timer);
     void remove_timer(timer_registered_t);
+    /// add timer node owned by caller
+    void add_timer(timer_node_t &node);
+    void remove_timer(timer_node_t &node);
+    /// count of timers linked in the loop
+    u64 get_timer_count() const { return time_manager->size(); }
 
     execute_thread_dispatcher_t &get_dispatcher();
 
@@ -188,7 +504,18 @@ class event_loop_t
     ///\note don't call it before run event_context in current thread.
     static event_loop_t &current();
 
+    /// return true if current thread runs an event loop
+    static bool has_current();
+
+    /// return false if the loop doesn't dispatch any more
+    bool is_running() const { return running; }
+
+    /// cpu the loop thread is bound to, -1 if it is not bound
+    int get_cpu() const { return cpu; }
+
     /// wake up if event loop is sleeping.
+    /// Call it after adding work. It writes the wake up event only when the loop is blocking in demultiplexer, calls
+    /// while the loop is running or already woken up only read a flag.
     void wake_up();
 
     event_context_t &get_context() { return *context; }
@@ -198,6 +525,7 @@ class event_loop_t
 /// unique global context in an application
 class event_context_t
 {
+    friend class event_loop_t;
     /// demultiplexing strategy
     event_strategy strategy;
 
@@ -211,17 +539,46 @@ class event_context_t
 
     /// timer precistion
     microsecond_t precision;
+    /// ready events fetched per select in new loops
+    int event_batch_size;
     bool exit;
 
+    /// called for each loop, including loops created later. guarded by loop_mutex
+    std::unordered_map<int, std::function<void(event_loop_t &)>> loop_handlers;
+    int loop_handler_id;
+
+    std::atomic_bool work_stealing;
+    microsecond_t balance_period;
+    /// count of idle loops
+    std::atomic_int idle_loops;
+
+    /// threads started by 'start_loops'
+    std::vector<std::thread> loop_threads;
+
+    /// loops read by select_loop without lock, loops are appended only
+    std::unique_ptr<std::atomic<event_loop_t *>[]> select_loops;
+    std::atomic_int select_loop_count;
+
+    /// find an idle loop and mark it busy
+    event_loop_t *claim_idle_loop(event_loop_t *except);
+    /// find the minimum load loop except 'except'
+    event_loop_t *min_load_loop(event_loop_t *except);
+    /// power of two choices on load factors
+    event_loop_t *pick_loop();
+
     /// init event loop in current thread
     void do_init();
+    /// run event loop in current thread
+    ///\param wait_all wait for all loops to exit before return
+    int run_loop(bool wait_all);
 #ifdef OS_WINDOWS
 
     handle_t iocp_handle;
 #endif
 
   public:
-    event_context_t(event_strategy strategy, microsecond_t precision = timer_min_precision);
+    event_context_t(event_strategy strategy, microsecond_t precision = timer_min_precision,
+                    int event_batch_size = default_event_batch_size);
     /// destroy all loops
     ///\note Wait for all loops to be destroyed and return
     ~event_context_t();
@@ -230,8 +587,28 @@ class event_context_t
     void add_executor(execute_context_t *exectx, event_loop_t *loop);
     void remove_executor(execute_context_t *exectx);
 
-    /// select a event loop which is minimum work load
+    /// select a event loop which has headroom
+    /// Compare load factors of two random loops and take the lower one, no lock is taken.
     event_loop_t &select_loop();
+    /// select 'prefer' unless a loop chosen by select_loop has less than half of its load factor
+    event_loop_t &select_loop(event_loop_t &prefer);
+
+    /// call 'func' with each event loop, loops created by 'run' later are passed to 'func' when they are created.
+    ///\note 'func' is called in the thread which creates the loop
+    ///\return id to remove the handler
+    int add_loop_handler(std::function<void(event_loop_t &)> func);
+    void remove_loop_handler(int id);
+
+    /// enable work stealing between loops.
+    /// Idle loops take runnable contexts which are not bound to handles from overloaded loops. A loop which is
+    /// overloaded for several balance periods moves its hottest context, with its timer and handle registration, to the
+    /// minimum load loop. Handle bound contexts are only moved on edge triggered demultiplexer.
+    ///
+    ///\param enable enable or disable
+    ///\param balance_period period to check the load of loops
+    void set_work_stealing(bool enable, microsecond_t balance_period = default_balance_period);
+    bool is_work_stealing() const { return work_stealing; }
+    microsecond_t get_balance_period() const { return balance_period; }
 
     /// Inform exit all event loop with exit code
     ///\note return immediately
@@ -242,6 +619,17 @@ class event_context_t
 
     int prepare();
 
+    /// start event loops in new threads, each thread is bound to a cpu chosen by the cpu topology before its loop is
+    /// created, so the loop is allocated on the local numa node.
+    ///\note Threads are joined in destructor. The caller still runs a loop by 'run' which is not bound.
+    ///
+    ///\param count count of loops to start, 0 to start a loop per physical core except reserved cores and the core
+    /// of caller
+    ///\param reserved_cpus count of physical cores left for IRQ handling
+    ///\param bind bind loops to cpus
+    ///\return count of loops started
+    int start_loops(int count = 0, int reserved_cpus = 1, bool bind = true);
+
     event_strategy get_strategy() { return strategy; }
 };
 
@@ -20,13 +20,16 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 *
 */
 #pragma once
+#include "execute_dispatcher.hpp"
 #include "timer.hpp"
+#include <atomic>
 
 namespace net
 {
 namespace co
 {
 class coroutine_t;
+class cancel_token_t;
 } // namespace co
 
 class execute_thread_dispatcher_t;
@@ -35,10 +38,30 @@ class event_loop_t;
 class execute_context_t
 {
     co::coroutine_t *co;
-    event_loop_t *loop;
+    std::atomic<event_loop_t *> loop;
     friend class event_context_t;
+    friend class event_loop_t;
     friend class execute_thread_dispatcher_t;
-    timer_registered_t timer;
+    friend class co::cancel_token_t;
+    timer_node_t timer;
+
+    /// link of contexts owned by loop, guarded by the loop
+    execute_context_t *loop_prev, *loop_next;
+    /// resumed times, only touched by the owner loop
+    u64 resume_count;
+    u64 last_resume_count;
+    /// never move to other loops
+    bool pinned;
+    /// class of dispatcher queue when it is started
+    dispatch_priority_t priority;
+    /// deadline timers of cancel tokens armed in the loop, the context is not moved while they are armed
+    u32 armed_deadlines;
+    /// index in context table. Dispatcher entries refer to the context by slot and generation, so entries of a
+    /// canceled or destroyed context are dropped without touching it
+    u32 slot;
+
+    /// current generation of slot
+    static u32 slot_generation(u32 slot);
 
   public:
     /// this sleep can be interrupt by event. Check return value
@@ -49,27 +72,48 @@ class execute_context_t
     microsecond_t sleep(microsecond_t ms);
     void stop();
 
-    void stop_for(microsecond_t ms, std::function<void()> func);
+    void stop_for(microsecond_t ms, callable_t<void()> func);
     void stop_for(microsecond_t ms);
 
     event_loop_t *get_loop() const { return loop; }
-    void set_loop(event_loop_t *loop) { this->loop = loop; }
+    /// move to the loop and register in it
+    void set_loop(event_loop_t *loop);
+
+    /// return true if context waits for events of a handle
+    virtual bool is_bound_to_handle() const { return false; }
+    /// return false if context can't be moved to other loops by work stealing
+    virtual bool can_migrate() const { return !pinned; }
+    /// keep the context in its loop when work stealing
+    void pin_to_loop(bool pin) { pinned = pin; }
+    bool is_pinned() const { return pinned; }
+
+    /// priority of later starts, 'normal' by default
+    void set_priority(dispatch_priority_t priority) { this->priority = priority; }
+    dispatch_priority_t get_priority() const { return priority; }
+    /// called in the thread of loop 'from' when context is moved to loop 'to', before 'get_loop' returns 'to'
+    virtual void migrate(event_loop_t &, event_loop_t &) {}
 
     /// Rerun the coroutine and push it to the dispatcher queue
     void start();
     /// Rerun the coroutine and push it to the dispatcher queue. Call func before resume coroutine.
-    void start_with(std::function<void()> func);
+    void start_with(callable_t<void()> func);
+    /// start with a priority other than the priority of context
+    void start_with(callable_t<void()> func, dispatch_priority_t priority);
 
     /// start coroutine and set function. Push it to dispatcher queue
     ///
     ///\param func the startup function to run.
-    void run(std::function<void()> func);
+    ///\param stack_size stack size of coroutine, rounded up to a size class. 0 for the default size
+    void run(callable_t<void()> func, u64 stack_size = 0);
 
     /// wake up loop to execute coroutine
     void wake_up_thread();
 
+    /// drop all entries of the context in dispatcher queues. Thread-safe
+    void cancel();
+
     execute_context_t();
-    ~execute_context_t();
+    virtual ~execute_context_t();
 };
 
 } // namespace net
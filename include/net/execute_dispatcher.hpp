@@ -19,36 +19,144 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 *
 */
 #pragma once
-#include "lock.hpp"
-#include <functional>
-#include <queue>
-#include <tuple>
-#include <unordered_set>
+#include "callable.hpp"
+#include "net.hpp"
+#include <atomic>
 
 namespace net
 {
 class execute_context_t;
+class event_loop_t;
+struct dispatch_node_cache_t;
 
+using dispatch_priority_t = u8;
+
+/// priority classes of dispatcher queues
+namespace dispatch_priority
+{
+enum : dispatch_priority_t
+{
+    /// control messages and heartbeats, e.g. rudp and tracker
+    high,
+    normal,
+    /// bulk transfers
+    low,
+};
+};
+
+inline constexpr int dispatch_priority_count = 3;
+/// nodes taken from each class per round of deficit round robin. Lower classes always get their share, so they are
+/// delayed by higher classes but never starved
+inline constexpr u32 dispatch_priority_quantum[dispatch_priority_count] = {16, 4, 1};
+
+/// entry of dispatcher queue
+/// Nodes are cached by the thread which allocates them. A node released by other threads is returned to the cache of
+/// its thread through a lock-free stack, so start_with from a producer thread doesn't allocate in steady state.
+struct dispatch_node_t
+{
+    std::atomic<dispatch_node_t *> next;
+    /// nullptr if it is a task
+    execute_context_t *executor;
+    /// context slot and generation when the node is pushed, see execute_context_t::cancel
+    u32 slot;
+    u32 generation;
+    dispatch_priority_t priority;
+    callable_t<void()> func;
+    /// cache of the allocating thread, nullptr if it is not cached
+    dispatch_node_cache_t *cache;
+
+    /// take a node from the cache of current thread
+    static dispatch_node_t *allocate();
+    /// destroy function and put the node back to its cache. Thread-safe
+    static void release(dispatch_node_t *node);
+};
+
+/// intrusive lock-free queue. Multiple producers, single consumer
+class dispatch_queue_t
+{
+    /// producers exchange tail
+    alignas(64) std::atomic<dispatch_node_t *> tail;
+    /// consumer only
+    alignas(64) dispatch_node_t *head;
+    dispatch_node_t stub;
+
+  public:
+    dispatch_queue_t();
+    dispatch_queue_t(const dispatch_queue_t &) = delete;
+    dispatch_queue_t &operator=(const dispatch_queue_t &) = delete;
+
+    /// Thread-safe
+    void push(dispatch_node_t *node);
+
+    ///\return nullptr if queue is empty or a producer is pushing
+    ///\note consumer only
+    dispatch_node_t *pop();
+
+    ///\note consumer only
+    bool empty() const;
+};
+
+/// nodes taken from the queue at once
+constexpr int dispatch_batch_size = 64;
+
+/// dispatcher of a loop with a queue per priority class
+/// Nodes are taken by deficit round robin: each round a class takes up to its quantum of nodes, the round continues
+/// where the last batch stops.
 class execute_thread_dispatcher_t
 {
-    std::queue<std::tuple<execute_context_t *, std::function<void()>>> co_wait_for_resume;
-    std::unordered_set<execute_context_t *> cancel_contexts;
-    lock::spinlock_t lock;
-    /// lock var cancel_contexts
-    lock::spinlock_t cancel_lock;
+    dispatch_queue_t queues[dispatch_priority_count];
+    /// count of nodes in queues, approximate
+    std::atomic<u64> queue_size;
+    /// loop which owns the dispatcher
+    event_loop_t *loop;
+    /// nodes the current class can still take in this round
+    u32 deficits[dispatch_priority_count];
+    /// class taking nodes
+    int current_class;
+    /// tasks called and contexts resumed of each class
+    u64 dispatched[dispatch_priority_count];
+
+    /// take nodes into batch
+    ///\return count of nodes taken
+    int fill_batch(dispatch_node_t **batch);
 
   public:
+    execute_thread_dispatcher_t(event_loop_t *loop);
+    ~execute_thread_dispatcher_t();
+
     ///\note Must be called by the event loop to execute the execute context in the queue.
     ///\note This function is called automatically in event loop.
     ///\note Not thread-safe
     void dispatch();
 
-    /// Cancel an execute context
+    /// Cancel queued entries of an execute context
     /// Thread-safe
     void cancel(execute_context_t *econtext);
 
     /// Add an execute context to the queue and set the wakeup function to execute
+    /// The node takes the priority of the context
+    /// Thread-safe
+    void add(execute_context_t *econtext, callable_t<void()> func);
     /// Thread-safe
-    void add(execute_context_t *econtext, std::function<void()> func);
+    void add(execute_context_t *econtext, callable_t<void()> func, dispatch_priority_t priority);
+
+    /// Add a function to the queue, it is called in loop thread without resuming any coroutine
+    /// Thread-safe
+    void add_task(callable_t<void()> func, dispatch_priority_t priority = dispatch_priority::normal);
+
+    /// Push a node taken from other dispatcher
+    /// Thread-safe
+    void add_node(dispatch_node_t *node);
+
+    /// Not thread-safe, called in loop thread
+    bool empty() const;
+
+    /// count of queued nodes, approximate
+    /// Thread-safe
+    u64 size() const { return queue_size; }
+
+    /// count of tasks called and contexts resumed of a priority class
+    ///\note Not thread-safe, called in loop thread
+    u64 get_dispatched(dispatch_priority_t priority) const { return dispatched[priority]; }
 };
 } // namespace net
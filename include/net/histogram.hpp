@@ -0,0 +1,100 @@
+/**
+* \file histogram.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief fixed bucket histogram for loop profiling
+* \version 0.1
+* \date 2020-09-22
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+#include "net.hpp"
+#include <atomic>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace net
+{
+
+/// copy of a histogram
+struct histogram_snapshot_t
+{
+    static constexpr int bucket_count = 64;
+    /// bucket 0 counts value 0, bucket i counts values in [2^(i-1), 2^i)
+    u64 buckets[bucket_count];
+    u64 count;
+    u64 sum;
+    u64 max;
+
+    /// minimum value of bucket
+    static u64 bucket_lower(int index) { return index == 0 ? 0 : 1ull << (index - 1); }
+    /// maximum value of bucket, the last bucket counts all large values
+    static u64 bucket_upper(int index) { return index >= bucket_count - 1 ? ~0ull : (1ull << index) - 1; }
+
+    u64 mean() const { return count == 0 ? 0 : sum / count; }
+
+    /// upper bound of the bucket which contains the 'p' percentile, 'p' is in [0, 1]
+    u64 percentile(double p) const;
+
+    /// counts recorded after 'old', 'max' is kept
+    histogram_snapshot_t operator-(const histogram_snapshot_t &old) const;
+};
+
+/// histogram with log2 buckets
+/// Single writer. 'record' is a few plain loads and stores, 'snapshot' can be called by other threads at any time, a
+/// snapshot taken during 'record' may miss the value.
+class histogram_t
+{
+    std::atomic<u64> buckets[histogram_snapshot_t::bucket_count];
+    std::atomic<u64> sum;
+    std::atomic<u64> max;
+
+    static void add(std::atomic<u64> &value, u64 delta)
+    {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+  public:
+    histogram_t();
+    histogram_t(const histogram_t &) = delete;
+    histogram_t &operator=(const histogram_t &) = delete;
+
+    static int bucket_of(u64 value)
+    {
+        if (value == 0)
+            return 0;
+#ifdef _MSC_VER
+        unsigned long bit;
+        _BitScanReverse64(&bit, value);
+        int index = (int)bit + 1;
+#else
+        int index = 64 - __builtin_clzll(value);
+#endif
+        return index < histogram_snapshot_t::bucket_count ? index : histogram_snapshot_t::bucket_count - 1;
+    }
+
+    void record(u64 value)
+    {
+        add(buckets[bucket_of(value)], 1);
+        add(sum, value);
+        if (value > max.load(std::memory_order_relaxed))
+            max.store(value, std::memory_order_relaxed);
+    }
+
+    histogram_snapshot_t snapshot() const;
+};
+
+} // namespace net
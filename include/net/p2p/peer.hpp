@@ -28,6 +28,7 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #include "msg.pb.h"
 #include <functional>
 #include <memory>
+#include <queue>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -26,6 +26,8 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #include "msg.hpp"
 #include "msg.pb.h"
 #include <functional>
+#include <queue>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace net::p2p
@@ -215,7 +217,11 @@ class tracker_node_client_t
     void update_nodes();
 
   public:
-    tracker_node_client_t(){};
+    tracker_node_client_t()
+        : request_trackers(false)
+        , wait_next_package(false)
+    {
+    }
     tracker_node_client_t(const tracker_node_client_t &) = delete;
     tracker_node_client_t &operator=(const tracker_node_client_t &) = delete;
 
@@ -92,6 +92,8 @@ class rudp_t
 
     co::async_result_t<io_result> awrite(co::paramter_t &param, rudp_connection_t conn, socket_buffer_t &buffer);
     co::async_result_t<io_result> aread(co::paramter_t &param, rudp_connection_t conn, socket_buffer_t &buffer);
+    /// send slices of chain as one message
+    co::async_result_t<io_result> awritev(co::paramter_t &param, rudp_connection_t conn, socket_buffer_chain_t &chain);
 
     /// call func on connection context
     void run_at(rudp_connection_t conn, std::function<void()> func);
@@ -115,5 +117,7 @@ co::async_result_t<io_result> rudp_awrite(co::paramter_t &param, rudp_t *rudp, r
                                           socket_buffer_t &buffer);
 co::async_result_t<io_result> rudp_aread(co::paramter_t &param, rudp_t *rudp, rudp_connection_t conn,
                                          socket_buffer_t &buffer);
+co::async_result_t<io_result> rudp_awritev(co::paramter_t &param, rudp_t *rudp, rudp_connection_t conn,
+                                           socket_buffer_chain_t &chain);
 
 } // namespace net
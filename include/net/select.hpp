@@ -42,7 +42,7 @@ class event_select_demultiplexer : public event_demultiplexer
     event_select_demultiplexer();
     ~event_select_demultiplexer();
     void add(handle_t handle, event_type_t type) override;
-    handle_t select(event_type_t *type, microsecond_t *timeout) override;
+    int select(ready_event_t *events, int max_events, microsecond_t *timeout) override;
     void remove(handle_t handle, event_type_t type) override;
     void wake_up(event_loop_t &cur_loop) override;
 };
@@ -28,6 +28,8 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #include <queue>
 #ifdef OS_WINDOWS
 #include "iocp.hpp"
+#else
+#include "uring.hpp"
 #endif
 
 namespace net
@@ -41,9 +43,12 @@ class socket_t : public execute_context_t, event_handler_t
     socket_addr_t local;
     socket_addr_t remote;
     bool is_connection_closed;
+    /// operation waiting for readiness of the socket
+    co::waiter_t *waiter;
 
     friend co::async_result_t<io_result> connect_to(co::paramter_t &, socket_t *, socket_addr_t);
     friend co::async_result_t<socket_t *> accept_from(co::paramter_t &, socket_t *in);
+    friend co::async_result_t<io_result> accept_all_from(co::paramter_t &, socket_t *, std::vector<socket_t *> &, int);
     friend class event_loop_t;
 
   public:
@@ -55,11 +60,18 @@ class socket_t : public execute_context_t, event_handler_t
     virtual co::async_result_t<io_result> awrite(co::paramter_t &, socket_buffer_t &buffer) = 0;
     virtual co::async_result_t<io_result> aread(co::paramter_t &, socket_buffer_t &buffer) = 0;
 
+    /// write/read slices of chain in one system call
+    virtual co::async_result_t<io_result> awritev(co::paramter_t &, socket_buffer_chain_t &chain) = 0;
+    virtual co::async_result_t<io_result> areadv(co::paramter_t &, socket_buffer_chain_t &chain) = 0;
+
     virtual co::async_result_t<io_result> awrite_to(co::paramter_t &, socket_buffer_t &buffer,
                                                     socket_addr_t target) = 0;
     virtual co::async_result_t<io_result> aread_from(co::paramter_t &, socket_buffer_t &buffer,
                                                      socket_addr_t &target) = 0;
 
+    /// accept a connection on listening socket
+    virtual co::async_result_t<socket_t *> aaccept(co::paramter_t &) = 0;
+
     socket_addr_t local_addr();
     socket_addr_t remote_addr();
 
@@ -67,12 +79,19 @@ class socket_t : public execute_context_t, event_handler_t
 
     void add_event(event_type_t type);
     void remove_event(event_type_t type);
+    /// register readiness 'type' for an unfinished operation, it is resumed only when 'type' or an error is ready
+    void wait_event(co::paramter_t &param, event_type_t type);
 
     handle_t get_raw_handle() const { return fd; }
 
     bool is_connection_alive() const { return !is_connection_closed; }
 
+    bool is_bound_to_handle() const override { return true; }
+    void migrate(event_loop_t &from, event_loop_t &to) override;
+
     void bind_context(event_context_t &context);
+    /// bind to the specified loop of context
+    void bind_context(event_context_t &context, event_loop_t &loop);
     void unbind_context();
 };
 
@@ -82,9 +101,12 @@ class bsd_socket_t : public socket_t
     using socket_t::socket_t;
     co::async_result_t<io_result> awrite(co::paramter_t &, socket_buffer_t &buffer) override;
     co::async_result_t<io_result> aread(co::paramter_t &, socket_buffer_t &buffer) override;
+    co::async_result_t<io_result> awritev(co::paramter_t &, socket_buffer_chain_t &chain) override;
+    co::async_result_t<io_result> areadv(co::paramter_t &, socket_buffer_chain_t &chain) override;
 
     co::async_result_t<io_result> awrite_to(co::paramter_t &, socket_buffer_t &buffer, socket_addr_t target) override;
     co::async_result_t<io_result> aread_from(co::paramter_t &, socket_buffer_t &buffer, socket_addr_t &target) override;
+    co::async_result_t<socket_t *> aaccept(co::paramter_t &) override;
 };
 
 class iocp_socket_t : public socket_t
@@ -93,14 +115,55 @@ class iocp_socket_t : public socket_t
     using socket_t::socket_t;
     co::async_result_t<io_result> awrite(co::paramter_t &, socket_buffer_t &buffer) override;
     co::async_result_t<io_result> aread(co::paramter_t &, socket_buffer_t &buffer) override;
+    co::async_result_t<io_result> awritev(co::paramter_t &, socket_buffer_chain_t &chain) override;
+    co::async_result_t<io_result> areadv(co::paramter_t &, socket_buffer_chain_t &chain) override;
 
     co::async_result_t<io_result> awrite_to(co::paramter_t &, socket_buffer_t &buffer, socket_addr_t target) override;
     co::async_result_t<io_result> aread_from(co::paramter_t &, socket_buffer_t &buffer, socket_addr_t &target) override;
+    co::async_result_t<socket_t *> aaccept(co::paramter_t &) override;
 };
 
+#ifndef OS_WINDOWS
+/// socket driven by io_uring operations with registered buffers and fixed files.
+/// Fallback to bsd socket operations when it is not called in a coroutine of an io_uring loop.
+/// Vectored operations are bsd socket operations, the slices are not copied to ring buffers.
+class uring_socket_t : public bsd_socket_t
+{
+    /// in-flight operations. one read (read, read_from, accept) and one write at the same time
+    uring_op_t *read_op;
+    uring_op_t *write_op;
+    /// ring which the fixed file is registered to
+    event_uring_demultiplexer *fixed_ring;
+
+    event_uring_demultiplexer *current_ring();
+    uring_op_t *make_op(event_uring_demultiplexer *ring, uring_io_type type, u64 size);
+    /// resume the operation only when op is completed
+    static void wait_op(co::paramter_t &param, uring_op_t *op);
+    /// give up in-flight operation
+    void drop_op(uring_op_t *&op);
+    void delete_op(uring_op_t *&op);
+
+  public:
+    uring_socket_t(int fd);
+    ~uring_socket_t();
+    co::async_result_t<io_result> awrite(co::paramter_t &, socket_buffer_t &buffer) override;
+    co::async_result_t<io_result> aread(co::paramter_t &, socket_buffer_t &buffer) override;
+
+    co::async_result_t<io_result> awrite_to(co::paramter_t &, socket_buffer_t &buffer, socket_addr_t target) override;
+    co::async_result_t<io_result> aread_from(co::paramter_t &, socket_buffer_t &buffer, socket_addr_t &target) override;
+    co::async_result_t<socket_t *> aaccept(co::paramter_t &) override;
+    /// operations in flight are bound to the ring of loop
+    bool can_migrate() const override { return false; }
+};
+#endif
+
 co::async_result_t<io_result> socket_awrite(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer);
 co::async_result_t<io_result> socket_aread(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer);
 
+/// write/read all data of chain, slices are sent/filled in order by gather/scatter io
+co::async_result_t<io_result> socket_awritev(co::paramter_t &param, socket_t *socket, socket_buffer_chain_t &chain);
+co::async_result_t<io_result> socket_areadv(co::paramter_t &param, socket_t *socket, socket_buffer_chain_t &chain);
+
 co::async_result_t<io_result> socket_awrite_to(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer,
                                                socket_addr_t target);
 co::async_result_t<io_result> socket_aread_from(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer,
@@ -120,6 +183,11 @@ co::async_result_t<io_result> connect_udp(co::paramter_t &param, socket_t *socke
 socket_t *bind_at(socket_t *socket, socket_addr_t socket_to_addr);
 socket_t *listen_from(socket_t *socket, int max_wait_client);
 co::async_result_t<socket_t *> accept_from(co::paramter_t &param, socket_t *in);
+/// accept all pending connections on listening socket, wait until one connection is accepted at least
+///\param sockets output accepted sockets
+///\param max_count maximum count of sockets
+co::async_result_t<io_result> accept_all_from(co::paramter_t &param, socket_t *in, std::vector<socket_t *> &sockets,
+                                              int max_count);
 void close_socket(socket_t *socket);
 
 socket_t *set_socket_send_buffer_size(socket_t *socket, int size);
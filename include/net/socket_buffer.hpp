@@ -22,19 +22,56 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #include "net/net.hpp"
 #include <atomic>
 #include <google/protobuf/message.h>
+#include <initializer_list>
 namespace net
 {
 
+/// sizes of pooled blocks are powers of two from 'min_pooled_buffer_size' to 'max_pooled_buffer_size', larger blocks
+/// are allocated by malloc
+constexpr u64 min_pooled_buffer_size = 64;
+constexpr u64 max_pooled_buffer_size = 64 * 1024;
+constexpr u64 buffer_size_class_count = 11;
+
+/// counters of buffer pool in current thread
+struct socket_buffer_pool_stat_t
+{
+    /// blocks allocated
+    u64 allocations;
+    /// blocks taken from cache
+    u64 reused;
+    /// blocks allocated by malloc
+    u64 heap_allocations;
+    /// blocks freed by other threads and returned to this thread
+    u64 remote_frees;
+    /// bytes of free blocks cached by this thread
+    u64 cached_bytes;
+};
+
+const socket_buffer_pool_stat_t &get_socket_buffer_pool_stat();
+
+/// allocate memory from the buffer pool of current thread, it can be freed in any thread
+void *socket_buffer_pool_allocate(u64 size);
+void socket_buffer_pool_free(void *ptr);
+
+struct socket_buffer_cache_t;
+
 /// The buffer container can be initialized by size, or using existing memory. It is managed by the
 /// socket_buffer_t in the first case, and is managed by the user in the second case.
+/// In the first case data and control block are a single block of the buffer pool.
 class socket_buffer_t
 {
   public:
-    /// a control block used by socket buffer
+    /// a control block used by socket buffer, data follows it in the same block
     struct socket_buffer_header_t
     {
         /// shared reference count
         std::atomic_int ref_count;
+        /// size class of block, 'buffer_size_class_count' if it is not pooled
+        u32 size_class;
+        /// cache of the thread which allocates the block, nullptr if it is not pooled
+        socket_buffer_cache_t *cache;
+        /// link of free blocks
+        std::atomic<socket_buffer_header_t *> next;
     };
 
   private:
@@ -46,6 +83,7 @@ class socket_buffer_t
 
   private:
     static socket_buffer_t from_struct_inner(byte *buffer_ptr, u64 buffer_length);
+    void release();
 
   public:
     struct except_buffer_helper_t
@@ -79,6 +117,7 @@ class socket_buffer_t
 
     // move operation
     socket_buffer_t(socket_buffer_t &&buf);
+    socket_buffer_t &operator=(socket_buffer_t &&buf);
     socket_buffer_t &operator()(socket_buffer_t &&buf);
 
     ~socket_buffer_t();
@@ -129,8 +168,49 @@ class socket_buffer_t
             walk_offset = valid_data_length;
     }
 
+    /// get a buffer sharing the block, which views 'len' bytes from 'offset' of the data at current offset
+    socket_buffer_t slice(u64 offset, u64 len) const;
+
     /// memzero to buffer
     void clear();
 };
 
+/// max slices of a buffer chain
+constexpr u64 max_chain_slices = 8;
+
+/// A sequence of socket buffers read or written by one operation. Slices share blocks with the buffers they are copied
+/// from, so a head can be put in front of a payload without copying the payload.
+/// The data of chain is the data at current offset of each slice.
+class socket_buffer_chain_t
+{
+    socket_buffer_t slices[max_chain_slices];
+    u64 count;
+
+  public:
+    socket_buffer_chain_t();
+    socket_buffer_chain_t(std::initializer_list<socket_buffer_t> list);
+
+    /// add slice to the end
+    ///	hrow std::length_error if there are 'max_chain_slices' slices
+    void append(socket_buffer_t slice);
+    /// add slice to the front
+    ///	hrow std::length_error if there are 'max_chain_slices' slices
+    void prepend(socket_buffer_t slice);
+    /// remove all slices
+    void reset();
+
+    u64 get_slice_count() const { return count; }
+    socket_buffer_t &get_slice(u64 index) { return slices[index]; }
+    const socket_buffer_t &get_slice(u64 index) const { return slices[index]; }
+
+    /// get data length of slices start at their current offset
+    u64 get_length() const;
+
+    /// walk across slices
+    void walk_step(u64 delta);
+
+    /// reset offset and set data length to offset of each slice
+    void finish_walk();
+};
+
 }; // namespace net
\ No newline at end of file
@@ -25,10 +25,14 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #include "socket_buffer.hpp"
 #include "timer.hpp"
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace net
 {
 class event_context_t;
+class event_loop_t;
 class socket_t;
 }; // namespace net
 
@@ -87,9 +91,24 @@ class server_t
     handler_t exit_handler;
     error_handler_t error_handler;
 
+    /// listeners of sharded mode, one per event loop
+    std::vector<socket_t *> shard_sockets;
+    std::mutex shard_mutex;
+    int loop_handler_id;
+    bool sharded;
+    socket_addr_t shard_address;
+    int shard_max_client;
+    bool shard_reuse_addr;
+    /// thread calling 'listen_sharded', bind failures are thrown to it
+    std::thread::id shard_caller;
+    /// listeners of loops started later which fail to bind
+    u64 failed_shards;
+
   private:
     void wait_client();
+    void wait_shard_client(socket_t *listener);
     void client_main(socket_t *socket);
+    void listen_at_loop(event_loop_t &loop);
 
   public:
     server_t();
@@ -102,6 +121,23 @@ class server_t
     ///\param reuse_addr create socket by SO_REUSEADDR?
     void listen(event_context_t &context, socket_addr_t address, int max_wait_client, bool reuse_addr = false);
 
+    /// listen port by a SO_REUSEPORT listener per event loop.
+    /// Each loop accepts connections in its own acceptor coroutine and owns the accepted connections. Loops which
+    /// start after calling this get a listener when they are created.
+    ///
+    ///\param context event context
+    ///\param address the address:port to bind
+    ///\param max_wait_client client count in completion queue of each listener
+    ///\param reuse_addr create socket by SO_REUSEADDR?
+    ///\throw net_connect_exception if a listener of the running loops fails to bind
+    ///\note fall back to 'listen' on windows
+    ///\note failures of loops started later are reported to the error handler with a null socket, or counted by
+    /// 'get_failed_shards' if there is no handler
+    void listen_sharded(event_context_t &context, socket_addr_t address, int max_wait_client,
+                        bool reuse_addr = false);
+
+    u64 get_failed_shards();
+
     server_t &on_client_join(handler_t handler);
     server_t &on_client_exit(handler_t handler);
     server_t &on_client_error(error_handler_t handler);
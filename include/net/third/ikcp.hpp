@@ -351,6 +351,9 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len);
 // user/upper level send, returns below zero for error
 int ikcp_send(ikcpcb *kcp, const char *buffer, int len);
 
+// user/upper level send of a message gathered from 'count' buffers, returns below zero for error
+int ikcp_sendv(ikcpcb *kcp, const char * const *buffers, const int *lens, int count);
+
 // update state (call it repeatedly, every 10ms-100ms), or you can ask
 // ikcp_check when to call it again (without ikcp_input/_send calling).
 // 'current' - current timestamp in millisec.
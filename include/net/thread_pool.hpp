@@ -1,7 +1,7 @@
 /**
 * \file thread_pool.hpp
 * \author kadds (itmyxyf@gmail.com)
-* \brief Simple thread pool implementation for high CPU load task runs
+* \brief work-stealing thread pool for high CPU load task runs
 * \version 0.1
 * \date 2020-03-13
 *
@@ -19,48 +19,139 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 *
 */
 #pragma once
+#include "callable.hpp"
+#include "co.hpp"
+#include "execute_context.hpp"
+#include "lock.hpp"
 #include <atomic>
 #include <condition_variable>
-#include <functional>
-#include <queue>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace net
 {
 
+/// thread pool with a task deque per worker
+/// Workers run their own tasks in LIFO order and steal the oldest tasks of others when they run out, so a burst of
+/// tasks is spread over all workers without a shared queue. Tasks committed by a worker go to its own deque, others are
+/// distributed in turn.
 class thread_pool_t
 {
   private:
-    std::vector<std::thread> threads;
-    mutable std::mutex mutex;
+    struct worker_t
+    {
+        lock::spinlock_t lock;
+        std::deque<callable_t<void()>> tasks;
+        std::thread thread;
+        int cpu;
+    };
+
+    std::vector<std::unique_ptr<worker_t>> workers;
+    /// sleeping workers wait for tasks
+    std::mutex mutex;
     std::condition_variable cond;
-    std::queue<std::function<void()>> tasks;
+    /// tasks committed and not taken
+    std::atomic<u64> pending;
+    std::atomic_int sleeping;
+    std::atomic<u64> next_worker;
     // exit flag
-    bool exit;
-    std::atomic_int counter;
-    void wrapper();
+    std::atomic_bool exit;
+
+    void wrapper(u64 index);
+    bool take(u64 index, callable_t<void()> &task);
+    void push(callable_t<void()> task);
 
   public:
     ///\param count thread count in pool
     thread_pool_t(int count);
+    ///\param count thread count in pool
+    ///\param cpus cpu of each thread, threads are not bound if it is empty. See cpu_topology_t::plan
+    thread_pool_t(int count, const std::vector<int> &cpus);
 
     thread_pool_t(const thread_pool_t &) = delete;
     thread_pool_t &operator=(const thread_pool_t &) = delete;
 
-    ///\note we wait all threads to exit at here
+    ///\note we wait all threads to exit at here, committed tasks are run before
     ~thread_pool_t();
 
-    /// commit a task to thread pool
+    /// commit a task to thread pool, it is dropped if pool is exiting and it is not committed by a task. Thread-safe
     ///
     ///\param task to run
     ///\return none
-    void commit(std::function<void()> task);
+    void commit(callable_t<void()> task);
+
+    /// commit tasks at once, they are spread over workers and all sleeping workers are woken up. Thread-safe
+    void commit_bulk(std::vector<callable_t<void()>> tasks);
 
     /// return idle thread count
     int get_idles() const;
 
-    /// return true if there are no tasks in task queue and no threads are running tasks.
+    /// return true if there are no tasks in task queues
     bool empty() const;
+
+    int get_thread_count() const { return (int)workers.size(); }
 };
 
+namespace co
+{
+/// run 'func' in thread pool and wait for its result in current coroutine.
+/// The coroutine is kept in its loop and resumed there when 'func' returns, so CPU heavy work doesn't block the loop.
+///
+///\return return value of func
+///\throw exception thrown by func, std::logic_error if it is not called in a coroutine of an execute context
+template <typename Func> auto await_offload(thread_pool_t &pool, Func func)
+{
+    using result_t = std::invoke_result_t<Func &>;
+    auto co = coroutine_t::current();
+    if (co == nullptr || co->get_execute_context() == nullptr)
+        throw std::logic_error("offload must be waited in a coroutine of an execute context");
+    auto context = co->get_execute_context();
+    bool pinned = context->is_pinned();
+    context->pin_to_loop(true);
+
+    std::optional<std::conditional_t<std::is_void_v<result_t>, bool, result_t>> value;
+    std::exception_ptr error;
+    bool done = false;
+    pool.commit([&func, &value, &error, &done, context]() {
+        try
+        {
+            if constexpr (std::is_void_v<result_t>)
+            {
+                func();
+                value.emplace(true);
+            }
+            else
+                value.emplace(func());
+        } catch (...)
+        {
+            error = std::current_exception();
+        }
+        /// set in the loop thread before resume, the waiting frame is alive until it sees the flag
+        context->start_with([&done]() { done = true; });
+    });
+
+    await_stat.waits++;
+    while (1)
+    {
+        coroutine_t::yield();
+        await_stat.resumes++;
+        if (done)
+            break;
+        await_stat.spurious++;
+    }
+    context->pin_to_loop(pinned);
+    if (error)
+        std::rethrow_exception(error);
+    if constexpr (!std::is_void_v<result_t>)
+        return std::move(*value);
+}
+} // namespace co
+
 } // namespace net
@@ -1,7 +1,7 @@
 /**
 * \file timer.hpp
 * \author kadds (itmyxyf@gmail.com)
-* \brief Timer queue generated by minimum heap
+* \brief Hierarchical timing wheel
 * \version 0.1
 * \date 2020-03-13
 *
@@ -19,18 +19,17 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 *
 */
 #pragma once
+#include "callable.hpp"
+#include "histogram.hpp"
 #include "net.hpp"
 #include <cstdint>
-#include <functional>
-#include <list>
 #include <memory>
-#include <queue>
 #include <vector>
 
 namespace net
 {
 using microsecond_t = u64;
-using timer_callback_t = std::function<void()>;
+using timer_callback_t = callable_t<void()>;
 // 1ms
 inline constexpr microsecond_t timer_min_precision = 1000;
 using timer_id = int64_t;
@@ -39,64 +38,136 @@ struct timer_t
 {
     microsecond_t timepoint;
     timer_callback_t callback;
-    timer_t(microsecond_t timepoint, std::function<void()> callback)
+    timer_t(microsecond_t timepoint, timer_callback_t callback)
         : timepoint(timepoint)
-        , callback(callback)
+        , callback(std::move(callback))
     {
     }
 };
 
-struct timer_slot_t
+timer_t make_timer(microsecond_t span, timer_callback_t callback);
+
+/// current time + span, saturated at the maximum
+microsecond_t make_timepoint(microsecond_t span);
+
+struct timer_registered_t
 {
+    timer_id id;
     microsecond_t timepoint;
-    std::vector<std::pair<timer_callback_t, bool>> callbacks;
-    timer_slot_t(microsecond_t tp)
-        : timepoint(tp)
-    {
-    }
 };
 
-using map_t = std::unordered_map<microsecond_t, timer_slot_t *>;
-
-timer_t make_timer(microsecond_t span, timer_callback_t callback);
+struct time_manager_t;
 
-struct timer_cmp
+struct timer_link_t
 {
-    bool operator()(timer_slot_t *lh, timer_slot_t *rh) const { return lh->timepoint > rh->timepoint; }
+    timer_link_t *prev, *next;
 };
 
-struct timer_registered_t
+/// timer node owned by caller. Set 'timepoint' and 'callback' before inserting it.
+/// The callback is moved out when timer fires, and kept when timer is canceled.
+struct timer_node_t : timer_link_t
 {
-    timer_id id;
     microsecond_t timepoint;
+    timer_callback_t callback;
+
+    /// fields below are managed by time_manager_t
+    /// time manager which the node is linked to, nullptr if not linked
+    time_manager_t *owner;
+    /// aligned tick to fire
+    u64 expire;
+    u16 level, slot;
+    /// index in pool of time manager, -1 if node is owned by caller
+    int pool_index;
+    u32 generation;
+
+    timer_node_t();
+    timer_node_t(const timer_node_t &) = delete;
+    timer_node_t &operator=(const timer_node_t &) = delete;
+    /// remove from time manager
+    ~timer_node_t();
+
+    bool is_linked() const { return owner != nullptr; }
 };
 
+/// Hierarchical timing wheel with 4 levels of 256 slots, the tick of level 0 is 'precision'.
+/// Timers out of range are placed in the last slot of level 3 and cascaded again.
 /// No thread safety. Don't add timers from other threads
 struct time_manager_t
 {
-    microsecond_t precision;
-    /// a minimum heap for timers
-    std::priority_queue<timer_slot_t *, std::vector<timer_slot_t *>, timer_cmp> queue;
-    map_t map;
+    static constexpr int wheel_bits = 8;
+    static constexpr int wheel_size = 1 << wheel_bits;
+    static constexpr u64 wheel_mask = wheel_size - 1;
+    static constexpr int wheel_levels = 4;
+    /// level of nodes not in wheel
+    static constexpr u16 no_level = 0xFFFF;
 
-    time_manager_t() {}
+    microsecond_t precision;
+    /// ticks processed
+    u64 current;
+    timer_link_t wheels[wheel_levels][wheel_size];
+    /// non-empty slots
+    u64 bitmaps[wheel_levels][wheel_size / 64];
+    /// timers inserted after they expire
+    timer_link_t due;
+    /// count of linked timers
+    u64 count;
+
+    /// nodes of insert(timer_t)
+    std::vector<std::unique_ptr<timer_node_t>> pool;
+    std::vector<u32> free_pool;
+
+    /// fire time minus timepoint of timers in microseconds
+    histogram_t lag;
+
+    time_manager_t(microsecond_t precision);
+    time_manager_t(const time_manager_t &) = delete;
+    time_manager_t &operator=(const time_manager_t &) = delete;
+    ~time_manager_t();
 
     void tick();
+    /// fire timers before 'now'
+    void tick(microsecond_t now);
+
     /// add new timer
     timer_registered_t insert(timer_t timer);
-
     /// remove timer
     void cancel(timer_registered_t reg);
 
+    /// add node, the node is moved if it is linked
+    void insert(timer_node_t &node);
+    /// remove node if it is linked
+    void cancel(timer_node_t &node);
+
     /// get the time should be called at next tick 'timepoint'
     microsecond_t next_tick_timepoint();
+
+    u64 size() const { return count; }
+
+  private:
+    void link(timer_node_t *node);
+    void unlink(timer_node_t *node);
+    void cascade();
+    void fire(timer_link_t &list, microsecond_t now);
+    void release(timer_node_t *node);
+    /// find first non-empty slot in [from, to] of level
+    int find_slot(int level, int from, int to) const;
+    /// tick of the first non-empty slot, a slot of upper level is cascaded at that tick
+    u64 next_tick() const;
 };
 
 std::unique_ptr<time_manager_t> create_time_manager(microsecond_t precision = timer_min_precision);
 
+/// monotonic time. In event loop thread it is cached by the loop, which is refreshed when the loop wakes up and before
+/// it blocks. Use get_precise_time to measure time inside a long running callback
 microsecond_t get_current_time();
 
-/// Inner use
+/// read monotonic clock now
+microsecond_t get_precise_time();
+
+/// use 'clock' as cached time of current thread, nullptr to read clock directly. Inner use
+void bind_thread_clock(const microsecond_t *clock);
+
+/// wall clock. Inner use
 microsecond_t get_timestamp();
 
 constexpr microsecond_t make_timespan(int second, int ms = 0, int us = 0)
@@ -0,0 +1,204 @@
+/**
+* \file uring.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief io_uring demultiplexer implementation
+* \version 0.1
+* \date 2020-09-05
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+#ifndef OS_WINDOWS
+#include "co.hpp"
+#include "event.hpp"
+#include "lock.hpp"
+#include "socket_addr.hpp"
+#include <atomic>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <unordered_map>
+#include <vector>
+
+namespace net
+{
+
+enum class uring_request_type
+{
+    /// operation of uring socket
+    io,
+    /// readiness emulation by multishot poll
+    poll,
+    /// read eventfd to wake up
+    wake_up,
+};
+
+enum class uring_io_type
+{
+    read,
+    write,
+    read_from,
+    write_to,
+    accept,
+};
+
+class event_uring_demultiplexer;
+
+/// header of all requests, the address of it is the user_data of sqe
+struct uring_request_t
+{
+    uring_request_type type;
+    /// link of in-flight operations, only touched in loop thread
+    uring_request_t *prev, *next;
+};
+
+/// an operation submitted by uring_socket_t. like io_overlapped of iocp
+struct uring_op_t : uring_request_t
+{
+    enum state_t
+    {
+        pending,
+        done,
+        /// owner gives up waiting, free the op when it is completed
+        orphan,
+    };
+    uring_io_type io_type;
+    std::atomic_int state;
+    /// cqe result
+    int res;
+    /// ring which the op is submitted to, set to nullptr when ring is destroyed
+    event_uring_demultiplexer *ring;
+    /// fired in loop thread when op is completed
+    co::waiter_t *waiter;
+    /// registered buffer index, -1 if heap buffer is used
+    int buffer_index;
+    byte *buffer;
+    u32 buffer_size;
+    iovec iov;
+    msghdr msg;
+    sockaddr_in addr;
+    socklen_t addr_len;
+    uring_op_t();
+    ~uring_op_t();
+};
+
+struct uring_poll_t : uring_request_t
+{
+    handle_t handle;
+    u32 mask;
+    /// POLL_REMOVE is submitted
+    bool removed;
+};
+
+/// io_uring demultiplexer
+/// Completions of uring_socket_t operations fire the waiter of the operation directly. Readiness events which are
+/// registered by 'add' are emulated by multishot poll, so bsd sockets still work on this demultiplexer.
+class event_uring_demultiplexer : public event_demultiplexer
+{
+    int ring_fd;
+    int ev_fd;
+    eventfd_t ev_value;
+    uring_request_t wake_request;
+
+    /// submission queue
+    u32 *sq_head;
+    u32 *sq_tail;
+    u32 sq_mask;
+    u32 sq_entries;
+    u32 *sq_array;
+    io_uring_sqe *sqes;
+    /// completion queue
+    u32 *cq_head;
+    u32 *cq_tail;
+    u32 cq_mask;
+    io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    u64 sq_size;
+    void *cq_ptr;
+    u64 cq_size;
+    u64 sqes_size;
+
+    /// lock submission queue and poll map, sqe can be pushed by other threads
+    lock::spinlock_t sq_lock;
+    /// sqes not submitted yet
+    u32 sq_pending;
+    std::unordered_map<handle_t, uring_poll_t *> polls;
+
+    /// registered buffers
+    byte *buffers;
+    u32 buffer_size;
+    u32 buffer_count;
+    bool buffer_registered;
+    std::vector<int> free_buffers;
+    lock::spinlock_t buffer_lock;
+
+    /// registered files, handle -> slot
+    std::unordered_map<handle_t, int> files;
+    std::vector<int> free_files;
+    lock::spinlock_t file_lock;
+
+    /// in-flight operations
+    uring_request_t inflight;
+
+    /// operations for reuse
+    std::vector<uring_op_t *> free_ops;
+    lock::spinlock_t op_lock;
+
+    /// get sqe at tail, call push_sqe after filling it. lock sq_lock first
+    io_uring_sqe *get_sqe();
+    void push_sqe();
+    /// submit pending sqes. lock sq_lock first
+    void flush();
+    void submit_and_wait(microsecond_t *timeout);
+    void arm_wake_up();
+    void arm_poll(uring_poll_t *poll);
+    /// replace poll of handle by a poll of mask, or only remove it if mask is empty. lock sq_lock first
+    void set_poll(handle_t handle, u32 mask);
+    int complete(io_uring_cqe *cqe, ready_event_t *event);
+
+  public:
+    event_uring_demultiplexer();
+    ~event_uring_demultiplexer();
+    void add(handle_t handle, event_type_t type) override;
+    int select(ready_event_t *events, int max_events, microsecond_t *timeout) override;
+    void remove(handle_t handle, event_type_t type) override;
+    void wake_up(event_loop_t &cur_loop) override;
+
+    /// submit operation in loop thread
+    void submit_op(uring_op_t *op, handle_t handle);
+    /// cancel operation, thread-safe
+    void cancel_op(uring_op_t *op);
+
+    /// take an operation from pool. thread-safe
+    uring_op_t *acquire_op();
+    /// reset a completed or unsubmitted operation and put it back to pool. thread-safe
+    void release_op(uring_op_t *op);
+
+    /// acquire a registered buffer. thread-safe
+    ///\return buffer index, -1 if none is available
+    int acquire_buffer();
+    void release_buffer(int index);
+    byte *get_buffer(int index) const { return buffers + (u64)index * buffer_size; }
+    u32 get_buffer_size() const { return buffer_size; }
+
+    /// register fixed file. thread-safe
+    ///\return fixed file slot, -1 if failed
+    int register_file(handle_t handle);
+    void unregister_file(handle_t handle);
+    int find_file(handle_t handle);
+};
+
+} // namespace net
+#endif
@@ -1,7 +1,328 @@
 #include "net/co.hpp"
+#include "net/event.hpp"
+#include <algorithm>
+#ifndef OS_WINDOWS
+#include <sys/mman.h>
+#endif
 
 namespace net::co
 {
+
+/// coroutines kept by the free list of a thread
+static constexpr u64 max_free_coroutines = 1024;
+
+static u64 page_size()
+{
+#ifndef OS_WINDOWS
+    static u64 size = (u64)sysconf(_SC_PAGESIZE);
+#else
+    static u64 size = []() {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (u64)info.dwPageSize;
+    }();
+#endif
+    return size;
+}
+
+/// map stack with a guard page at the lowest address
+///\return base of mapping
+static void *map_stack(u64 size)
+{
+    u64 total = size + page_size();
+#ifndef OS_WINDOWS
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_STACK
+    flags |= MAP_STACK;
+#endif
+    void *base = mmap(nullptr, total, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (base == MAP_FAILED)
+        throw std::bad_alloc();
+    mprotect(base, page_size(), PROT_NONE);
+#else
+    void *base = VirtualAlloc(nullptr, total, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (base == nullptr)
+        throw std::bad_alloc();
+    DWORD old;
+    VirtualProtect(base, page_size(), PAGE_READWRITE | PAGE_GUARD, &old);
+#endif
+    return base;
+}
+
+static void unmap_stack(void *base, u64 size)
+{
+#ifndef OS_WINDOWS
+    munmap(base, size + page_size());
+#else
+    VirtualFree(base, 0, MEM_RELEASE);
+#endif
+}
+
+int stack_pool_t::size_class(u64 size)
+{
+    for (int i = 0; i < stack_size_classes; i++)
+    {
+        if (size <= ((u64)min_stack_size << i))
+            return i;
+    }
+    return -1;
+}
+
+u64 stack_pool_t::round_size(u64 size)
+{
+    if (size == 0)
+        size = default_stack_size;
+    int index = size_class(size);
+    if (index >= 0)
+        return (u64)min_stack_size << index;
+    return (size + page_size() - 1) / page_size() * page_size();
+}
+
+stack_pool_t::stack_pool_t()
+    : cached_bytes(0)
+    , limit(default_stack_pool_limit)
+    , mapped(0)
+    , reused(0)
+{
+}
+
+stack_pool_t::~stack_pool_t()
+{
+    for (int i = 0; i < stack_size_classes; i++)
+    {
+        for (auto base : free_stacks[i])
+            unmap_stack(base, (u64)min_stack_size << i);
+    }
+}
+
+stack_pool_t &stack_pool_t::current()
+{
+    thread_local stack_pool_t pool;
+    return pool;
+}
+
+ctx::stack_context stack_pool_t::allocate(u64 size)
+{
+    size = round_size(size);
+    int index = size_class(size);
+    void *base;
+    if (index >= 0 && !free_stacks[index].empty())
+    {
+        base = free_stacks[index].back();
+        free_stacks[index].pop_back();
+        cached_bytes -= size;
+        reused++;
+    }
+    else
+    {
+        base = map_stack(size);
+        mapped++;
+    }
+    ctx::stack_context sctx;
+    sctx.size = size;
+    sctx.sp = (char *)base + page_size() + size;
+    return sctx;
+}
+
+void stack_pool_t::deallocate(ctx::stack_context &sctx)
+{
+    u64 size = sctx.size;
+    void *base = (char *)sctx.sp - size - page_size();
+    int index = size_class(size);
+    if (index >= 0 && cached_bytes + size <= limit)
+    {
+        free_stacks[index].push_back(base);
+        cached_bytes += size;
+        return;
+    }
+    unmap_stack(base, size);
+}
+
+void stack_pool_t::set_limit(u64 bytes)
+{
+    limit = bytes;
+    for (int i = stack_size_classes - 1; i >= 0 && cached_bytes > limit; i--)
+    {
+        u64 size = (u64)min_stack_size << i;
+        while (!free_stacks[i].empty() && cached_bytes > limit)
+        {
+            unmap_stack(free_stacks[i].back(), size);
+            free_stacks[i].pop_back();
+            cached_bytes -= size;
+        }
+    }
+}
+
+stack_pool_stat_t stack_pool_t::get_stat() const
+{
+    stack_pool_stat_t stat;
+    stat.mapped = mapped;
+    stat.reused = reused;
+    stat.cached_bytes = cached_bytes;
+    return stat;
+}
+
+/// finished coroutines of a thread, linked by 'prev'
+struct coroutine_free_list_t
+{
+    coroutine_t *head = nullptr;
+    u64 count = 0;
+
+    ~coroutine_free_list_t()
+    {
+        while (head)
+        {
+            auto next = head->prev;
+            delete head;
+            head = next;
+        }
+    }
+};
+
+static coroutine_free_list_t &free_coroutines()
+{
+    thread_local coroutine_free_list_t list;
+    return list;
+}
+
+coroutine_t *coroutine_t::create(callable_t<void()> f, u64 stack_size)
+{
+    auto &list = free_coroutines();
+    coroutine_t *co;
+    if (list.head != nullptr)
+    {
+        co = list.head;
+        list.head = co->prev;
+        list.count--;
+        co->prev = nullptr;
+        co->econtext = nullptr;
+        co->is_stop = false;
+    }
+    else
+    {
+        co = new coroutine_t();
+    }
+    co->func = std::move(f);
+    co->context = ctx::fiber(std::allocator_arg, pooled_stack_t(stack_size),
+                             std::bind(co_wrapper, std::placeholders::_1, co));
+    return co;
+}
+
+void coroutine_t::remove(coroutine_t *c)
+{
+    auto &list = free_coroutines();
+    /// a suspended coroutine is unwound by the fiber destructor
+    if (!c->is_done() || list.count >= max_free_coroutines)
+    {
+        delete c;
+        return;
+    }
+    c->func = nullptr;
+    c->prev = list.head;
+    list.head = c;
+    list.count++;
+}
+cancel_token_t::cancel_token_t()
+    : cancel_token_t(nullptr)
+{
+}
+
+cancel_token_t::cancel_token_t(microsecond_t deadline)
+    : cancel_token_t(nullptr, deadline)
+{
+}
+
+cancel_token_t::cancel_token_t(cancel_token_t *parent, microsecond_t deadline)
+    : parent(parent)
+    , children(nullptr)
+    , prev(nullptr)
+    , next(nullptr)
+    , deadline(deadline)
+    , canceled(false)
+    , waiting(nullptr)
+    , timer_context(nullptr)
+{
+    if (parent == nullptr)
+        return;
+    this->deadline = std::min(deadline, parent->deadline);
+    canceled = parent->canceled;
+    next = parent->children;
+    if (next)
+        next->prev = this;
+    parent->children = this;
+}
+
+cancel_token_t::~cancel_token_t()
+{
+    disarm();
+    for (auto child = children; child != nullptr; child = child->next)
+        child->parent = nullptr;
+    if (parent == nullptr)
+        return;
+    if (prev)
+        prev->next = next;
+    else
+        parent->children = next;
+    if (next)
+        next->prev = prev;
+}
+
+void cancel_token_t::arm(execute_context_t *context)
+{
+    /// parent timer fires first
+    if (timer.is_linked() || deadline == make_timespan_full() || (parent && parent->deadline <= deadline))
+        return;
+    timer.timepoint = deadline;
+    timer.callback = [this]() {
+        disarm();
+        cancel();
+    };
+    context->get_loop()->add_timer(timer);
+    context->armed_deadlines++;
+    timer_context = context;
+}
+
+void cancel_token_t::disarm()
+{
+    if (timer_context == nullptr)
+        return;
+    if (timer.is_linked())
+        timer_context->get_loop()->remove_timer(timer);
+    timer.callback = nullptr;
+    timer_context->armed_deadlines--;
+    timer_context = nullptr;
+}
+
+void cancel_token_t::cancel()
+{
+    if (canceled)
+        return;
+    canceled = true;
+    disarm();
+    for (auto child = children; child != nullptr; child = child->next)
+        child->cancel();
+    if (auto context = waiting)
+    {
+        waiting = nullptr;
+        context->start();
+    }
+}
+
+void cancel_token_t::begin_wait(execute_context_t *context)
+{
+    if (canceled)
+        return;
+    if (deadline != make_timespan_full() && get_current_time() >= deadline)
+    {
+        cancel();
+        return;
+    }
+    /// parents are not waiting, their timers are armed by the innermost wait
+    for (auto token = this; token != nullptr; token = token->parent)
+        token->arm(context);
+    waiting = context;
+}
+
 ctx::fiber &&co_wrapper(ctx::fiber &&sink, coroutine_t *co)
 {
     co->context = std::move(sink);
@@ -12,10 +333,11 @@ ctx::fiber &&co_wrapper(ctx::fiber &&sink, coroutine_t *co)
     {
     }
     co->is_stop = true;
+    co_cur = co->prev;
     return std::move(co->context);
 }
 
-ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, std::function<void()> func)
+ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, callable_t<void()> &func)
 {
     co->context = std::move(sink);
     func();
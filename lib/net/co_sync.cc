@@ -0,0 +1,209 @@
+#include "net/co_sync.hpp"
+#include "net/execute_context.hpp"
+
+namespace net::co
+{
+
+sync_waiter_t::sync_waiter_t(void *data)
+    : context(nullptr)
+    , prev(nullptr)
+    , next(nullptr)
+    , claimed(false)
+    , signaled(false)
+    , data(data)
+{
+    auto co = coroutine_t::current();
+    if (co)
+        context = co->get_execute_context();
+}
+
+void wait_list_t::push(sync_waiter_t *waiter)
+{
+    waiter->next = nullptr;
+    waiter->prev = tail;
+    if (tail)
+        tail->next = waiter;
+    else
+        head = waiter;
+    tail = waiter;
+}
+
+sync_waiter_t *wait_list_t::pop()
+{
+    auto waiter = head;
+    if (waiter)
+        remove(waiter);
+    return waiter;
+}
+
+void wait_list_t::remove(sync_waiter_t *waiter)
+{
+    if (waiter->prev)
+        waiter->prev->next = waiter->next;
+    else
+        head = waiter->next;
+    if (waiter->next)
+        waiter->next->prev = waiter->prev;
+    else
+        tail = waiter->prev;
+    waiter->prev = waiter->next = nullptr;
+}
+
+bool sync_base_t::wait(sync_waiter_t &waiter, wait_list_t &list, cancel_token_t *token)
+{
+    if (waiter.context == nullptr)
+    {
+        std::unique_lock<std::mutex> guard(waiter.mutex);
+        waiter.cond.wait(guard, [&waiter]() { return waiter.signaled.load(); });
+        return true;
+    }
+
+    await_stat.waits++;
+    while (1)
+    {
+        if (token)
+        {
+            token->begin_wait(waiter.context);
+            if (token->is_canceled())
+                break;
+        }
+        coroutine_t::yield();
+        if (token)
+            token->end_wait();
+        await_stat.resumes++;
+        if (waiter.signaled)
+            return true;
+        if (token && token->is_canceled())
+            break;
+        /// resumed by others, keep waiting
+        await_stat.spurious++;
+    }
+
+    lock.lock();
+    if (!waiter.claimed)
+    {
+        list.remove(&waiter);
+        lock.unlock();
+        return false;
+    }
+    lock.unlock();
+    /// woken up before the cancellation is seen, the waker still holds the waiter until the start arrives
+    while (!waiter.signaled)
+    {
+        coroutine_t::yield();
+        await_stat.resumes++;
+    }
+    return true;
+}
+
+execute_context_t *sync_base_t::signal(sync_waiter_t *waiter)
+{
+    /// neither threads nor coroutines leave before 'notify' sets 'signaled'
+    waiter->claimed = true;
+    return waiter->context;
+}
+
+void sync_base_t::notify(sync_waiter_t *waiter, execute_context_t *context)
+{
+    if (context)
+    {
+        /// flag is set in the loop of waiter, so the waiter can't see it and leave before the start is queued
+        context->start_with([waiter]() { waiter->signaled = true; });
+        return;
+    }
+    std::lock_guard<std::mutex> guard(waiter->mutex);
+    waiter->signaled = true;
+    waiter->cond.notify_one();
+}
+
+void sync_base_t::notify_all(wait_list_t &list)
+{
+    while (1)
+    {
+        lock.lock();
+        auto waiter = list.pop();
+        if (waiter == nullptr)
+        {
+            lock.unlock();
+            return;
+        }
+        auto context = signal(waiter);
+        lock.unlock();
+        notify(waiter, context);
+    }
+}
+
+semaphore_t::semaphore_t(u64 count)
+    : count(count)
+{
+}
+
+bool semaphore_t::acquire(cancel_token_t *token)
+{
+    lock.lock();
+    if (count > 0 && waiters.empty())
+    {
+        count--;
+        lock.unlock();
+        return true;
+    }
+    sync_waiter_t waiter;
+    waiters.push(&waiter);
+    lock.unlock();
+    /// permit is handed over by 'release'
+    return wait(waiter, waiters, token);
+}
+
+bool semaphore_t::try_acquire()
+{
+    lock.lock();
+    bool ok = count > 0 && waiters.empty();
+    if (ok)
+        count--;
+    lock.unlock();
+    return ok;
+}
+
+void semaphore_t::release(u64 n)
+{
+    lock.lock();
+    while (n > 0)
+    {
+        auto waiter = waiters.pop();
+        if (waiter == nullptr)
+            break;
+        n--;
+        auto context = signal(waiter);
+        lock.unlock();
+        notify(waiter, context);
+        lock.lock();
+    }
+    count += n;
+    lock.unlock();
+}
+
+void event_t::set()
+{
+    lock.lock();
+    is_set_flag = true;
+    lock.unlock();
+    notify_all(waiters);
+}
+
+bool event_t::wait(cancel_token_t *token)
+{
+    if (is_set_flag)
+        return true;
+    lock.lock();
+    if (is_set_flag)
+    {
+        lock.unlock();
+        return true;
+    }
+    sync_waiter_t waiter;
+    waiters.push(&waiter);
+    lock.unlock();
+    return sync_base_t::wait(waiter, waiters, token);
+}
+
+} // namespace net::co
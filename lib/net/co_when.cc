@@ -0,0 +1,107 @@
+#include "net/co_when.hpp"
+#include "net/execute_context.hpp"
+#include <stdexcept>
+
+namespace net::co
+{
+
+static execute_context_t *current_context()
+{
+    auto co = coroutine_t::current();
+    if (co == nullptr || co->get_execute_context() == nullptr)
+        throw std::logic_error("branches must be waited in a coroutine of an execute context");
+    return co->get_execute_context();
+}
+
+branch_group_t::branch_group_t(cancel_token_t *parent_token, bool any, u64 count)
+    : parent(current_context())
+    , parent_pinned(parent->is_pinned())
+    , token(parent_token)
+    , any(any)
+    , running(0)
+    , winner(no_winner)
+{
+    bodies.reserve(count);
+    branches.reserve(count);
+    /// branches share the loop of caller
+    parent->pin_to_loop(true);
+    /// deadline timers of the caller's tokens are held by caller, they outlive the branches
+    token.begin_wait(parent);
+    token.end_wait();
+}
+
+branch_group_t::~branch_group_t()
+{
+    if (running > 0)
+    {
+        token.cancel();
+        while (running > 0)
+            coroutine_t::yield();
+    }
+    branches.clear();
+    parent->pin_to_loop(parent_pinned);
+}
+
+void branch_group_t::spawn(callable_t<void()> body)
+{
+    u64 index = bodies.size();
+    bodies.emplace_back(std::move(body));
+    auto branch = std::make_unique<execute_context_t>();
+    branch->set_loop(parent->get_loop());
+    branch->pin_to_loop(true);
+    branch->run([this, index]() { run_branch(index); });
+    branches.emplace_back(std::move(branch));
+    running++;
+}
+
+void branch_group_t::run_branch(u64 index)
+{
+    try
+    {
+        bodies[index]();
+    } catch (...)
+    {
+        if (!error)
+            error = std::current_exception();
+        token.cancel();
+    }
+    bodies[index] = nullptr;
+    if (any && winner == no_winner)
+    {
+        winner = index;
+        token.cancel();
+    }
+    if (--running == 0)
+        parent->start();
+}
+
+void branch_group_t::wait()
+{
+    await_stat.waits++;
+    while (running > 0)
+    {
+        coroutine_t::yield();
+        await_stat.resumes++;
+        if (running > 0)
+            await_stat.spurious++;
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+bool sleep_with(cancel_token_t &token, microsecond_t span)
+{
+    auto context = current_context();
+    cancel_token_t timer(&token, make_timepoint(span));
+    while (1)
+    {
+        timer.begin_wait(context);
+        if (timer.is_canceled())
+            break;
+        coroutine_t::yield();
+        timer.end_wait();
+    }
+    return !token.is_canceled();
+}
+
+} // namespace net::co
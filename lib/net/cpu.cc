@@ -0,0 +1,217 @@
+#include "net/cpu.hpp"
+#include "net/net.hpp"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+#ifndef OS_WINDOWS
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+namespace net
+{
+
+thread_local int thread_cpu = -1;
+
+#ifndef OS_WINDOWS
+static const char *sys_cpu_path = "/sys/devices/system/cpu";
+
+/// parse cpu list like "0-3,8,10-11"
+static std::vector<int> read_cpu_list(const std::string &path)
+{
+    std::vector<int> ids;
+    std::ifstream file(path);
+    std::string list;
+    if (!std::getline(file, list))
+        return ids;
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        auto end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        auto range = list.substr(pos, end - pos);
+        pos = end + 1;
+        try
+        {
+            auto dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int id = first; id <= last; id++)
+                ids.push_back(id);
+        } catch (std::exception &)
+        {
+            return {};
+        }
+    }
+    return ids;
+}
+
+static int read_int(const std::string &path, int default_value)
+{
+    std::ifstream file(path);
+    int value;
+    if (file >> value)
+        return value;
+    return default_value;
+}
+
+/// cpu directory has a 'nodeN' link if numa is available
+static int read_node(const std::string &cpu_path)
+{
+    int node = 0;
+    DIR *dir = opendir(cpu_path.c_str());
+    if (dir == nullptr)
+        return node;
+    while (auto entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+            std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        {
+            node = std::stoi(name.substr(4));
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+#endif
+
+cpu_topology_t::cpu_topology_t(std::vector<cpu_info_t> cpus)
+    : cpus(std::move(cpus))
+    , node_count(0)
+{
+    for (auto &cpu : this->cpus)
+        node_count = std::max(node_count, cpu.node + 1);
+}
+
+cpu_topology_t cpu_topology_t::detect()
+{
+    std::vector<cpu_info_t> cpus;
+#ifndef OS_WINDOWS
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    bool has_mask = sched_getaffinity(0, sizeof(mask), &mask) == 0;
+    for (int id : read_cpu_list(std::string(sys_cpu_path) + "/online"))
+    {
+        if (id >= CPU_SETSIZE || (has_mask && !CPU_ISSET(id, &mask)))
+            continue;
+        std::string path = std::string(sys_cpu_path) + "/cpu" + std::to_string(id);
+        cpu_info_t info;
+        info.id = id;
+        info.core = read_int(path + "/topology/core_id", id);
+        info.package = read_int(path + "/topology/physical_package_id", 0);
+        info.node = read_node(path);
+        cpus.push_back(info);
+    }
+#endif
+    if (cpus.empty())
+    {
+        int count = std::max(1u, std::thread::hardware_concurrency());
+        for (int id = 0; id < count; id++)
+            cpus.push_back(cpu_info_t{id, id, 0, 0});
+    }
+    return cpu_topology_t(std::move(cpus));
+}
+
+/// logical cpus of physical cores, sorted by node
+static std::vector<std::vector<const cpu_info_t *>> group_cores(const std::vector<cpu_info_t> &cpus)
+{
+    std::map<std::tuple<int, int, int>, std::vector<const cpu_info_t *>> cores;
+    for (auto &cpu : cpus)
+        cores[std::make_tuple(cpu.node, cpu.package, cpu.core)].push_back(&cpu);
+
+    std::vector<std::vector<const cpu_info_t *>> result;
+    for (auto &it : cores)
+    {
+        auto &threads = it.second;
+        std::sort(threads.begin(), threads.end(),
+                  [](const cpu_info_t *a, const cpu_info_t *b) { return a->id < b->id; });
+        result.push_back(std::move(threads));
+    }
+    return result;
+}
+
+int cpu_topology_t::get_core_count() const { return (int)group_cores(cpus).size(); }
+
+std::vector<int> cpu_topology_t::plan(int count, int reserved) const
+{
+    std::vector<int> result;
+    auto cores = group_cores(cpus);
+    if (cores.empty() || count <= 0)
+        return result;
+    // keep one core at least
+    reserved = std::clamp(reserved, 0, (int)cores.size() - 1);
+
+    // available cores of each node
+    std::vector<std::vector<const std::vector<const cpu_info_t *> *>> nodes(node_count);
+    u64 max_threads = 0;
+    for (auto i = (u64)reserved; i < cores.size(); i++)
+    {
+        nodes[cores[i][0]->node].push_back(&cores[i]);
+        max_threads = std::max(max_threads, (u64)cores[i].size());
+    }
+
+    // first thread of each core, then second thread of each core. take nodes in turn
+    std::vector<int> order;
+    for (u64 thread = 0; thread < max_threads; thread++)
+    {
+        u64 index = 0;
+        bool has_more = true;
+        while (has_more)
+        {
+            has_more = false;
+            for (auto &node : nodes)
+            {
+                if (index >= node.size())
+                    continue;
+                has_more = true;
+                auto &core = *node[index];
+                if (thread < core.size())
+                    order.push_back(core[thread]->id);
+            }
+            index++;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+        result.push_back(order[i % order.size()]);
+    return result;
+}
+
+bool bind_thread_to_cpu(int cpu)
+{
+#ifndef OS_WINDOWS
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) != 0)
+        return false;
+#else
+    if (cpu < 0 || cpu >= 64 || SetThreadAffinityMask(GetCurrentThread(), 1ull << cpu) == 0)
+        return false;
+#endif
+    thread_cpu = cpu;
+    return true;
+}
+
+int get_thread_cpu() { return thread_cpu; }
+
+void set_thread_local_memory()
+{
+#if !defined(OS_WINDOWS) && defined(SYS_set_mempolicy)
+    // not supported without numa, the default policy is local too
+    syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0);
+#endif
+}
+
+} // namespace net
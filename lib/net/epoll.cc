@@ -1,5 +1,6 @@
 #include "net/epoll.hpp"
 #include "net/net_exception.hpp"
+#include <cerrno>
 #include <cstring>
 #ifndef OS_WINDOWS
 namespace net
@@ -21,28 +22,34 @@ event_epoll_demultiplexer::~event_epoll_demultiplexer()
     close(ev_fd);
 }
 
-void event_epoll_demultiplexer::add(handle_t handle, event_type_t type)
+static u32 to_epoll_events(event_type_t type)
 {
-    int e = 0;
+    u32 e = 0;
     if (type & event_type::readable)
         e |= EPOLLIN;
     if (type & event_type::writable)
         e |= EPOLLOUT;
     if (type & event_type::error)
         e |= EPOLLERR;
+    return e;
+}
 
+void event_epoll_demultiplexer::add(handle_t handle, event_type_t type)
+{
     epoll_event ev;
     memset(&ev, 0, sizeof(ev));
-    ev.events = e | EPOLLET;
+    ev.events = to_epoll_events(type) | EPOLLET;
     ev.data.fd = handle;
     epoll_ctl(fd, EPOLL_CTL_ADD, handle, &ev);
 }
 
-handle_t event_epoll_demultiplexer::select(event_type_t *type, microsecond_t *timeout)
+int event_epoll_demultiplexer::select(ready_event_t *ready_events, int max_events, microsecond_t *timeout)
 {
-    epoll_event ev;
+    if (events.size() < (size_t)max_events)
+        events.resize(max_events);
+
     int t = *timeout / 1000;
-    int c = ::epoll_wait(fd, &ev, 1, t);
+    int c = ::epoll_wait(fd, events.data(), max_events, t);
     if (c < 0)
     {
         return 0;
@@ -52,56 +59,63 @@ handle_t event_epoll_demultiplexer::select(event_type_t *type, microsecond_t *ti
         *timeout = 0;
         return 0;
     }
-    int fd = 0;
-    if (ev.events & EPOLLIN)
-    {
-        *type = event_type::readable;
-        fd = ev.data.fd;
-    }
-    else if (ev.events & EPOLLOUT)
+    int count = 0;
+    for (int i = 0; i < c; i++)
     {
-        *type = event_type::writable;
-        fd = ev.data.fd;
-    }
-    else if (ev.events & EPOLLERR)
-    {
-        *type = event_type::error;
-        fd = ev.data.fd;
-    }
-    else
-    {
-        return 0;
-    }
-    if (ev.data.fd == ev_fd)
-    {
-        eventfd_t vl;
-        eventfd_read(fd, &vl);
-        *timeout = 0;
-        return 0;
+        auto &ev = events[i];
+        if (ev.data.fd == ev_fd)
+        {
+            eventfd_t vl;
+            eventfd_read(ev_fd, &vl);
+            *timeout = 0;
+            continue;
+        }
+        event_type_t type = 0;
+        if (ev.events & EPOLLIN)
+            type |= event_type::readable;
+        if (ev.events & EPOLLOUT)
+            type |= event_type::writable;
+        if (ev.events & (EPOLLERR | EPOLLHUP))
+            type |= event_type::error;
+        if (type == 0)
+            continue;
+
+        ready_events[count].handle = ev.data.fd;
+        ready_events[count].type = type;
+        count++;
     }
 
-    return ev.data.fd;
+    return count;
 }
 
 void event_epoll_demultiplexer::remove(handle_t handle, event_type_t type)
 {
-    int e = 0;
-    if (type & event_type::readable)
-        e |= EPOLLIN;
-    if (type & event_type::writable)
-        e |= EPOLLOUT;
-    if (type & event_type::error)
-        e |= EPOLLERR;
-
     epoll_event ev;
     memset(&ev, 0, sizeof(ev));
-    ev.events = e;
+    ev.events = to_epoll_events(type);
     ev.data.fd = handle;
     epoll_ctl(fd, EPOLL_CTL_DEL, handle, &ev);
 }
 
 void event_epoll_demultiplexer::wake_up(event_loop_t &cur_loop) { eventfd_write(ev_fd, 1); }
 
+void event_epoll_demultiplexer::update(handle_t handle, event_type_t old_type, event_type_t new_type)
+{
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = to_epoll_events(new_type) | EPOLLET;
+    ev.data.fd = handle;
+    if (new_type == 0)
+    {
+        epoll_ctl(fd, EPOLL_CTL_DEL, handle, &ev);
+        return;
+    }
+    /// handle may be registered by 'add' before it is cached
+    if (old_type == 0 && (epoll_ctl(fd, EPOLL_CTL_ADD, handle, &ev) == 0 || errno != EEXIST))
+        return;
+    epoll_ctl(fd, EPOLL_CTL_MOD, handle, &ev);
+}
+
 } // namespace net
 
 #endif
\ No newline at end of file
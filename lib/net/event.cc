@@ -1,10 +1,13 @@
 #include "net/event.hpp"
 #include "net/co.hpp"
+#include "net/cpu.hpp"
 #include "net/epoll.hpp"
 #include "net/execute_context.hpp"
 #include "net/iocp.hpp"
+#include "net/net_exception.hpp"
 #include "net/select.hpp"
 #include "net/socket.hpp"
+#include "net/uring.hpp"
 #include <algorithm>
 #include <iostream>
 
@@ -12,13 +15,47 @@ namespace net
 {
 thread_local event_loop_t *thread_in_loop;
 
-event_loop_t::event_loop_t(microsecond_t precision)
+event_loop_t::event_loop_t(microsecond_t precision, int event_batch_size)
     : is_exit(false)
-    , has_wake_up(false)
     , exit_code(0)
+    , running(false)
+    , cached_time(get_precise_time())
+    , cpu(get_thread_cpu())
+    , demuxer_calls(0)
+    , saved_calls(0)
+    , redelivered(0)
+    , has_redeliver(false)
+    , dispatcher(this)
+    , sleeping(false)
+    , wake_ups(0)
+    , contexts(nullptr)
+    , idle(false)
+    , window_resumes(0)
+    , load(0)
+    , balance_timepoint(0)
+    , overload_periods(0)
+    , stolen(0)
+    , given(0)
+    , migrated_in(0)
+    , migrated_out(0)
+    , busy_start(0)
+    , busy_time(0)
+    , sample_timepoint(cached_time)
+    , io_bytes(0)
+    , busy_avg(0)
+    , queue_avg(0)
+    , bytes_rate(0)
+    , assigned(0)
+    , busy_poll_max(0)
+    , busy_poll_budget(0)
+    , busy_poll_spins(0)
+    , busy_poll_hits(0)
+    , busy_poll_sleeps(0)
 {
-    time_manager = create_time_manager(precision);
+    set_event_batch_size(event_batch_size);
     thread_in_loop = this;
+    bind_thread_clock(&cached_time);
+    time_manager = create_time_manager(precision);
 #ifdef OS_WINDOWS
     HANDLE hThreadParent;
     DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &hThreadParent, 0, FALSE,
@@ -30,55 +67,439 @@ event_loop_t::event_loop_t(microsecond_t precision)
 event_loop_t::~event_loop_t()
 {
     thread_in_loop = nullptr;
+    bind_thread_clock(nullptr);
 #ifdef OS_WINDOWS
     CloseHandle(handle);
 #endif
 }
 
+event_handler_table_t::event_handler_table_t()
+    : chunks(new std::atomic<slot_t *>[max_chunks])
+    , count(0)
+{
+    for (u64 i = 0; i < max_chunks; i++)
+        chunks[i] = nullptr;
+}
+
+event_handler_table_t::~event_handler_table_t()
+{
+    for (u64 i = 0; i < max_chunks; i++)
+        delete[] chunks[i].load(std::memory_order_relaxed);
+}
+
+event_handler_table_t::slot_t *event_handler_table_t::get_slot(handle_t handle) const
+{
+    u64 index = (u64)handle;
+    if (index >= chunk_size * max_chunks)
+        return nullptr;
+    auto chunk = chunks[index / chunk_size].load(std::memory_order_acquire);
+    if (chunk == nullptr)
+        return nullptr;
+    return chunk + index % chunk_size;
+}
+
+event_handler_table_t::slot_t *event_handler_table_t::alloc_slot(handle_t handle)
+{
+    u64 index = (u64)handle;
+    if (index >= chunk_size * max_chunks)
+        throw net_param_exception("handle is out of range of event handler table");
+    auto &chunk_ref = chunks[index / chunk_size];
+    auto chunk = chunk_ref.load(std::memory_order_relaxed);
+    if (chunk == nullptr)
+    {
+        chunk = new slot_t[chunk_size];
+        for (u64 i = 0; i < chunk_size; i++)
+        {
+            chunk[i].handler.store(nullptr, std::memory_order_relaxed);
+            chunk[i].generation.store(0, std::memory_order_relaxed);
+            chunk[i].interest.store(0, std::memory_order_relaxed);
+            chunk[i].pending.store(0, std::memory_order_relaxed);
+            chunk[i].registered.store(0, std::memory_order_relaxed);
+        }
+        chunk_ref.store(chunk, std::memory_order_release);
+    }
+    return chunk + index % chunk_size;
+}
+
+u32 event_handler_table_t::add(handle_t handle, event_handler_t *handler)
+{
+    lock::lock_guard g(lock);
+    auto slot = alloc_slot(handle);
+    auto old = slot->handler.load(std::memory_order_relaxed);
+    if (old == nullptr)
+        count++;
+    if (old != handler)
+    {
+        /// a new owner of handle, the registration of old one may be dropped by closing handle
+        slot->interest = 0;
+        slot->pending = 0;
+        slot->registered = 0;
+    }
+    /// the handler is published before the generation, a reader taking the new generation sees the new handler
+    slot->handler.store(handler, std::memory_order_release);
+    return slot->generation.fetch_add(1, std::memory_order_release) + 1;
+}
+
+bool event_handler_table_t::remove(handle_t handle, event_handler_t *handler)
+{
+    lock::lock_guard g(lock);
+    auto slot = get_slot(handle);
+    if (slot == nullptr || slot->handler.load(std::memory_order_relaxed) != handler || handler == nullptr)
+        return false;
+    slot->handler.store(nullptr, std::memory_order_release);
+    slot->generation.fetch_add(1, std::memory_order_release);
+    count--;
+    return true;
+}
+
+event_handler_t *event_handler_table_t::find(handle_t handle, u32 *generation) const
+{
+    auto slot = get_slot(handle);
+    if (slot == nullptr)
+        return nullptr;
+    if (generation)
+        *generation = slot->generation.load(std::memory_order_acquire);
+    return slot->handler.load(std::memory_order_acquire);
+}
+
+u32 event_handler_table_t::generation(handle_t handle) const
+{
+    auto slot = get_slot(handle);
+    if (slot == nullptr)
+        return 0;
+    return slot->generation.load(std::memory_order_acquire);
+}
+
 void event_loop_t::set_demuxer(event_demultiplexer *demuxer) { this->demuxer = demuxer; }
 
 void event_loop_t::add_event_handler(handle_t handle, event_handler_t *handler)
 {
-    lock::lock_guard g(lock);
-    event_map[handle] = handler;
+    handler_table.add(handle, handler);
+#if !defined(OS_WINDOWS) && defined(SO_BUSY_POLL)
+    /// fails on handles which are not sockets
+    int budget = (int)busy_poll_max;
+    if (budget > 0)
+        setsockopt(handle, SOL_SOCKET, SO_BUSY_POLL, &budget, sizeof(budget));
+#endif
 }
 
 void event_loop_t::remove_event_handler(handle_t handle, event_handler_t *handler)
 {
-    unlink(handle, event_type::error | event_type::writable | event_type::readable);
-
-    lock::lock_guard g(lock);
-    auto it = event_map.find(handle);
-    if (it != event_map.end())
-        event_map.erase(it);
+    /// the handle may be reused by another handler already
+    if (handler_table.find(handle) != handler)
+        return;
+    if (demuxer->is_edge_triggered())
+    {
+        auto slot = handler_table.get_slot(handle);
+        lock::lock_guard g(interest_lock);
+        auto registered = slot->registered.exchange(0);
+        slot->interest = 0;
+        slot->pending = 0;
+        if (registered)
+        {
+            demuxer->update(handle, registered, 0);
+            demuxer_calls++;
+        }
+    }
+    else
+    {
+        unlink(handle, event_type::error | event_type::writable | event_type::readable);
+    }
+    handler_table.remove(handle, handler);
 }
 
 event_loop_t &event_loop_t::link(handle_t handle, event_type_t type)
 {
-    demuxer->add(handle, type);
+    auto slot = demuxer->is_edge_triggered() ? handler_table.get_slot(handle) : nullptr;
+    if (slot == nullptr || slot->handler == nullptr)
+    {
+        demuxer->add(handle, type);
+        demuxer_calls++;
+        return *this;
+    }
+
+    slot->interest.fetch_or(type);
+    if ((slot->registered & type) != type)
+    {
+        lock::lock_guard g(interest_lock);
+        auto old = slot->registered.load();
+        if ((old & type) != type)
+        {
+            slot->registered = old | type;
+            /// demultiplexer reports the current state after updating, pending events are out of date
+            slot->pending.fetch_and(~type);
+            demuxer->update(handle, old, old | type);
+            demuxer_calls++;
+            return *this;
+        }
+    }
+    saved_calls++;
+
+    /// the edge is reported before, it won't be reported again
+    event_type_t wanted = type | event_type::error;
+    auto ready = slot->pending.fetch_and(~wanted) & wanted;
+    if (ready)
+    {
+        {
+            lock::lock_guard g(redeliver_lock);
+            redeliver_events.push_back({handle, ready});
+            has_redeliver = true;
+        }
+        redelivered++;
+        wake_up();
+    }
     return *this;
 }
 
 event_loop_t &event_loop_t::unlink(handle_t handle, event_type_t type)
 {
-    demuxer->remove(handle, type);
+    auto slot = demuxer->is_edge_triggered() ? handler_table.get_slot(handle) : nullptr;
+    if (slot == nullptr || slot->handler == nullptr)
+    {
+        demuxer->remove(handle, type);
+        demuxer_calls++;
+        return *this;
+    }
+    /// keep it registered, events are filtered by interest mask
+    slot->interest.fetch_and(~type);
+    saved_calls++;
     return *this;
 }
 
+event_type_t event_loop_t::get_interest(handle_t handle) const
+{
+    auto slot = handler_table.get_slot(handle);
+    return slot ? slot->interest.load() : 0;
+}
+
+void event_loop_t::add_context(execute_context_t *exectx)
+{
+    lock::lock_guard g(contexts_lock);
+    exectx->loop_prev = nullptr;
+    exectx->loop_next = contexts;
+    if (contexts)
+        contexts->loop_prev = exectx;
+    contexts = exectx;
+}
+
+void event_loop_t::remove_context(execute_context_t *exectx)
+{
+    lock::lock_guard g(contexts_lock);
+    if (exectx->loop_prev)
+        exectx->loop_prev->loop_next = exectx->loop_next;
+    else
+        contexts = exectx->loop_next;
+    if (exectx->loop_next)
+        exectx->loop_next->loop_prev = exectx->loop_prev;
+    exectx->loop_prev = exectx->loop_next = nullptr;
+}
+
+bool event_loop_t::can_migrate(execute_context_t *exectx) const
+{
+    if (!exectx->can_migrate() || exectx->armed_deadlines > 0)
+        return false;
+    /// registration can be moved across threads on edge triggered demultiplexer only
+    return !exectx->is_bound_to_handle() || demuxer->is_edge_triggered();
+}
+
+void event_loop_t::migrate_context(execute_context_t *exectx, event_loop_t &to)
+{
+    bool has_timer = exectx->timer.is_linked();
+    if (has_timer)
+    {
+        remove_timer(exectx->timer);
+        /// time manager is not thread-safe, add timer in target loop before the context runs there
+        to.get_dispatcher().add_task([exectx, &to]() {
+            /// callback is cleared if the context is resumed by other events
+            if (exectx->get_loop() == &to && !exectx->timer.is_linked() && exectx->timer.callback)
+                to.add_timer(exectx->timer);
+        });
+    }
+    exectx->migrate(*this, to);
+    /// items of the context in dispatcher queue will be forwarded to the new loop
+    exectx->set_loop(&to);
+    if (has_timer)
+        to.wake_up();
+}
+
+bool event_loop_t::try_give(dispatch_node_t *node, u64 backlog)
+{
+    auto exectx = node->executor;
+    constexpr u64 min_give_backlog = 16;
+    if (backlog < min_give_backlog || !context->work_stealing || context->idle_loops == 0)
+        return false;
+    if (exectx->is_bound_to_handle() || !exectx->can_migrate())
+        return false;
+    auto thief = context->claim_idle_loop(this);
+    if (thief == nullptr)
+        return false;
+
+    migrate_context(exectx, *thief);
+    thief->get_dispatcher().add_node(node);
+    thief->wake_up();
+    given++;
+    thief->stolen++;
+    return true;
+}
+
+void event_loop_t::balance()
+{
+    /// resumes in a period to be considered overloaded
+    constexpr u64 min_balance_load = 64;
+    /// overloaded periods before moving a context
+    constexpr int balance_periods = 3;
+
+    auto now = get_current_time();
+    if (now < balance_timepoint)
+        return;
+    balance_timepoint = now + context->balance_period;
+    u64 cur_load = window_resumes;
+    window_resumes = 0;
+    load = cur_load;
+    if (!context->work_stealing)
+        return;
+
+    auto target = context->min_load_loop(this);
+    if (target == nullptr)
+        return;
+    u64 target_load = target->load;
+    if (cur_load < min_balance_load || cur_load < target_load * 2)
+    {
+        overload_periods = 0;
+        return;
+    }
+    overload_periods++;
+    if (overload_periods < balance_periods - 1)
+        return;
+
+    execute_context_t *hot = nullptr;
+    u64 hot_load = 0;
+    {
+        lock::lock_guard g(contexts_lock);
+        if (overload_periods == balance_periods - 1)
+        {
+            /// begin to measure contexts in next period
+            for (auto exectx = contexts; exectx != nullptr; exectx = exectx->loop_next)
+                exectx->last_resume_count = exectx->resume_count;
+            return;
+        }
+        overload_periods = 0;
+
+        for (auto exectx = contexts; exectx != nullptr; exectx = exectx->loop_next)
+        {
+            u64 exectx_load = exectx->resume_count - exectx->last_resume_count;
+            if (exectx_load > hot_load && can_migrate(exectx))
+            {
+                hot = exectx;
+                hot_load = exectx_load;
+            }
+        }
+    }
+    /// moving it must reduce imbalance, or it just moves the hot spot
+    if (hot == nullptr || target_load + hot_load >= cur_load)
+        return;
+
+    migrate_context(hot, *target);
+    migrated_out++;
+    target->migrated_in++;
+}
+
+schedule_stat_t event_loop_t::get_schedule_stat() const
+{
+    schedule_stat_t stat;
+    stat.stolen = stolen;
+    stat.given = given;
+    stat.migrated_in = migrated_in;
+    stat.migrated_out = migrated_out;
+    stat.wake_ups = wake_ups;
+    return stat;
+}
+
+interest_stat_t event_loop_t::get_interest_stat() const
+{
+    interest_stat_t stat;
+    stat.demuxer_calls = demuxer_calls;
+    stat.saved_calls = saved_calls;
+    stat.redelivered = redelivered;
+    return stat;
+}
+
+event_type_t event_loop_t::filter_event(handle_t handle, event_type_t type)
+{
+    if (!demuxer->is_edge_triggered())
+        return type;
+    auto slot = handler_table.get_slot(handle);
+    if (slot == nullptr)
+        return type;
+
+    auto interest = slot->interest.load();
+    event_type_t wanted = interest ? interest | event_type::error : 0;
+    auto rest = type & ~wanted;
+    if (rest)
+    {
+        slot->pending.fetch_or(rest);
+        /// link in other thread may miss the pending events, check interest again
+        interest = slot->interest.load();
+        wanted = interest ? interest | event_type::error : 0;
+        if (wanted)
+            type |= slot->pending.fetch_and(~wanted) & wanted;
+    }
+    return type & wanted;
+}
+
+void event_loop_t::deliver_redeliver_events()
+{
+    {
+        lock::lock_guard g(redeliver_lock);
+        redeliver_batch.swap(redeliver_events);
+        has_redeliver = false;
+    }
+    for (auto &ev : redeliver_batch)
+    {
+        auto handler = handler_table.find(ev.handle);
+        if (handler == nullptr)
+            continue;
+        auto type = filter_event(ev.handle, ev.type);
+        if (type)
+            handler->on_event(*context, type);
+    }
+    redeliver_batch.clear();
+}
+
+void event_loop_t::set_event_batch_size(int size)
+{
+    if (size < 1)
+        size = 1;
+    ready_events.resize(size);
+    ready_handlers.resize(size);
+    ready_generations.resize(size);
+}
+
 int event_loop_t::run()
 {
-    event_type_t type;
+    running = true;
+    cached_time = get_precise_time();
+    bind_thread_clock(&cached_time);
+    busy_start = cached_time;
+    sample_timepoint = cached_time;
+    microsecond_t iteration_start = cached_time;
     while (!is_exit)
     {
-        microsecond_t cur_time = get_current_time();
+        microsecond_t cur_time = cached_time;
         auto target_time = time_manager->next_tick_timepoint();
         if (cur_time >= target_time)
         {
-            time_manager->tick();
+            time_manager->tick(cur_time);
         }
         dispatcher.dispatch();
         auto next = time_manager->next_tick_timepoint();
-        cur_time = get_current_time();
+        /// contexts may run for a long time
+        cached_time = get_precise_time();
+        cur_time = cached_time;
+        busy_time += cur_time - busy_start;
+        iteration_histogram.record(cur_time - iteration_start);
+        iteration_start = cur_time;
+        sample_load();
         microsecond_t timeout;
         if (next > cur_time)
             timeout = next - cur_time;
@@ -88,24 +509,67 @@ int event_loop_t::run()
         if (is_exit)
             break;
 
-        has_wake_up = false;
-        auto handle = demuxer->select(&type, &timeout);
-        if (handle != 0)
+        balance();
+        if (has_redeliver || !dispatcher.empty())
+            timeout = 0;
+        /// other loops can give runnable contexts when this one is blocking
+        bool wait_work = timeout > 0 && context->work_stealing;
+        if (wait_work)
+        {
+            idle = true;
+            context->idle_loops++;
+        }
+        int count = 0;
+        bool spun = busy_poll_max > 0 && timeout > 0;
+        if (spun)
+            count = busy_poll(timeout);
+        if (count == 0 && !(spun && timeout == 0))
         {
-            event_handle_map_t::iterator ev_it;
+            auto before = spun ? get_precise_time() : cur_time;
+            bool armed = timeout > 0;
+            if (armed)
             {
-                lock::lock_guard g(lock);
-                ev_it = event_map.find(handle);
-                if (ev_it == event_map.end())
-                {
+                /// pairs with the fence in wake_up, either the producer sees the flag or the work is seen here
+                sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (has_redeliver || !dispatcher.empty())
+                    timeout = 0;
+            }
+            count = demuxer->select(ready_events.data(), (int)ready_events.size(), &timeout);
+            if (armed)
+                sleeping.store(false, std::memory_order_relaxed);
+            if (spun)
+                adapt_busy_poll(get_precise_time() - before, count > 0 || has_redeliver || !dispatcher.empty());
+        }
+        cached_time = get_precise_time();
+        busy_start = cached_time;
+        select_histogram.record(cached_time - cur_time);
+        events_histogram.record(count);
+        if (wait_work && idle.exchange(false))
+            context->idle_loops--;
+        if (has_redeliver)
+            deliver_redeliver_events();
+        if (count > 0)
+        {
+            for (int i = 0; i < count; i++)
+                ready_handlers[i] = handler_table.find(ready_events[i].handle, &ready_generations[i]);
+
+            /// handlers only push coroutines to dispatcher, nothing is resumed before the batch is drained
+            for (int i = 0; i < count; i++)
+            {
+                if (ready_handlers[i] == nullptr)
                     continue;
-                }
+                /// handler is removed or the handle is reused by an earlier handler in this batch
+                if (handler_table.generation(ready_events[i].handle) != ready_generations[i])
+                    continue;
+                auto type = filter_event(ready_events[i].handle, ready_events[i].type);
+                if (type)
+                    ready_handlers[i]->on_event(*context, type);
             }
-            auto handler = ev_it->second;
-            handler->on_event(*context, type);
         }
         dispatcher.dispatch();
     }
+    running = false;
     return exit_code;
 }
 
@@ -121,54 +585,194 @@ void event_loop_t::wake_up()
     /// no need for wake in current thread
     if (this == thread_in_loop)
         return;
-    if (!has_wake_up)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false))
+    {
+        wake_ups.fetch_add(1, std::memory_order_relaxed);
         demuxer->wake_up(*this);
-    has_wake_up = true;
+    }
 }
 
-int event_loop_t::load_factor() { return (int)event_map.size(); }
+void event_loop_t::sample_load()
+{
+    microsecond_t now = cached_time;
+    microsecond_t elapsed = now - sample_timepoint;
+    if (elapsed < load_sample_period)
+        return;
+    /// a sample lasts for several periods if the loop is blocked, each period is averaged with the same value
+    auto periods = std::min<u64>(elapsed / load_sample_period, 63);
+    auto decay = [periods](u64 value, u64 sample) { return (value >> periods) + sample - (sample >> periods); };
+
+    busy_avg = decay(busy_avg, std::min<u64>(busy_time * 1000 / elapsed, 1000));
+    queue_avg = decay(queue_avg, dispatcher.size());
+    bytes_rate = decay(bytes_rate, io_bytes.exchange(0) * 1000000 / elapsed);
+    auto recent = assigned.load();
+    assigned -= recent - (recent >> periods);
+    busy_time = 0;
+    sample_timepoint = now;
+}
+
+void event_loop_t::set_busy_poll(microsecond_t max_budget)
+{
+    busy_poll_max = max_budget;
+    busy_poll_budget.store(max_budget, std::memory_order_relaxed);
+}
+
+busy_poll_stat_t event_loop_t::get_busy_poll_stat() const
+{
+    busy_poll_stat_t stat;
+    stat.spins = busy_poll_spins;
+    stat.hits = busy_poll_hits;
+    stat.sleeps = busy_poll_sleeps;
+    stat.budget = busy_poll_budget.load(std::memory_order_relaxed);
+    return stat;
+}
+
+int event_loop_t::busy_poll(microsecond_t &timeout)
+{
+    busy_poll_spins++;
+    auto start = get_precise_time();
+    auto budget = std::min(busy_poll_budget.load(std::memory_order_relaxed), timeout);
+    while (true)
+    {
+        microsecond_t no_wait = 0;
+        int count = demuxer->select(ready_events.data(), (int)ready_events.size(), &no_wait);
+        if (count > 0 || has_redeliver || !dispatcher.empty())
+        {
+            busy_poll_hits++;
+            timeout = 0;
+            return count;
+        }
+        auto spent = get_precise_time() - start;
+        if (spent >= budget)
+        {
+            busy_poll_sleeps++;
+            timeout = timeout > spent ? timeout - spent : 0;
+            return 0;
+        }
+    }
+}
+
+void event_loop_t::adapt_busy_poll(microsecond_t slept, bool arrived)
+{
+    auto budget = busy_poll_budget.load(std::memory_order_relaxed);
+    /// the event would be caught by a longer spin
+    if (arrived && slept <= busy_poll_max)
+        budget = std::min<microsecond_t>(busy_poll_max, std::max<microsecond_t>(budget * 2, 8));
+    /// the event is late or the timeout is empty, spinning is wasted
+    else
+        budget /= 2;
+    busy_poll_budget.store(budget, std::memory_order_relaxed);
+}
+
+loop_profile_t event_loop_t::get_profile() const
+{
+    loop_profile_t profile;
+    profile.iteration = iteration_histogram.snapshot();
+    profile.select = select_histogram.snapshot();
+    profile.timer_lag = time_manager->lag.snapshot();
+    profile.resumes = resumes_histogram.snapshot();
+    profile.longest_resume = longest_resume_histogram.snapshot();
+    profile.events = events_histogram.snapshot();
+    return profile;
+}
+
+load_stat_t event_loop_t::get_load_stat() const
+{
+    /// the loop doesn't sample when it is blocked, decay metrics by time since the last sample
+    microsecond_t now = get_current_time();
+    microsecond_t last = sample_timepoint;
+    u64 periods = now > last ? (now - last) / load_sample_period : 0;
+    auto decay = [periods](u64 value) { return periods >= 64 ? 0 : value >> periods; };
+
+    load_stat_t stat;
+    stat.busy = decay(busy_avg);
+    stat.queue_depth = decay(queue_avg);
+    stat.bytes_per_second = decay(bytes_rate);
+    stat.handlers = handler_table.size();
+    stat.assigned = assigned;
+    return stat;
+}
+
+u64 event_loop_t::load_factor() const
+{
+    auto stat = get_load_stat();
+    return stat.busy + stat.queue_depth + stat.bytes_per_second / 65536 + stat.handlers + stat.assigned;
+}
 
 event_loop_t &event_loop_t::current() { return *thread_in_loop; }
 
-void event_context_t::add_executor(execute_context_t *exectx) { exectx->loop = &select_loop(); }
+bool event_loop_t::has_current() { return thread_in_loop != nullptr; }
 
-void event_context_t::add_executor(execute_context_t *exectx, event_loop_t *loop) { exectx->loop = loop; }
+void event_context_t::add_executor(execute_context_t *exectx) { exectx->set_loop(&select_loop()); }
 
-void event_context_t::remove_executor(execute_context_t *exectx) { exectx->loop = nullptr; }
+void event_context_t::add_executor(execute_context_t *exectx, event_loop_t *loop) { exectx->set_loop(loop); }
 
-timer_registered_t event_loop_t::add_timer(timer_t timer) { return time_manager->insert(timer); }
+void event_context_t::remove_executor(execute_context_t *exectx) { exectx->set_loop(nullptr); }
+
+timer_registered_t event_loop_t::add_timer(timer_t timer) { return time_manager->insert(std::move(timer)); }
 
 void event_loop_t::remove_timer(timer_registered_t reg) { time_manager->cancel(reg); }
 
+void event_loop_t::add_timer(timer_node_t &node) { time_manager->insert(node); }
+
+void event_loop_t::remove_timer(timer_node_t &node) { time_manager->cancel(node); }
+
 execute_thread_dispatcher_t &event_loop_t::get_dispatcher() { return dispatcher; }
 
-event_loop_t &event_context_t::select_loop()
+/// xorshift random number per thread
+static u64 select_random()
+{
+    thread_local u64 state = 0;
+    if (state == 0)
+        state = (get_precise_time() ^ (u64)&state) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+event_loop_t *event_context_t::pick_loop()
 {
-    /// get minimum workload loop
-    event_loop_t *min_load_loop;
+    int count = select_loop_count.load(std::memory_order_acquire);
+    if (count == 0)
+        throw std::logic_error("no event loop to select");
+    /// power of two choices
+    auto random = select_random();
+    event_loop_t *loop = select_loops[random % count];
+    if (count > 1)
     {
-        std::shared_lock<std::shared_mutex> lock(loop_mutex);
-        min_load_loop = loops[0];
-        int min_fac = min_load_loop->load_factor();
-        for (auto loop : loops)
-        {
-            int fac = loop->load_factor();
-            if (fac < min_fac)
-            {
-                min_fac = fac;
-                min_load_loop = loop;
-            }
-        }
+        auto index = (random >> 32) % (count - 1);
+        if (select_loops[index] == loop)
+            index = count - 1;
+        event_loop_t *other = select_loops[index];
+        if (other->load_factor() < loop->load_factor())
+            loop = other;
     }
+    return loop;
+}
 
-    return *min_load_loop;
+event_loop_t &event_context_t::select_loop()
+{
+    auto loop = pick_loop();
+    loop->assigned++;
+    return *loop;
+}
+
+event_loop_t &event_context_t::select_loop(event_loop_t &prefer)
+{
+    auto loop = pick_loop();
+    if (loop->load_factor() * 2 >= prefer.load_factor())
+        loop = &prefer;
+    loop->assigned++;
+    return *loop;
 }
 
 void event_context_t::do_init()
 {
     if (thread_in_loop == nullptr && !exit)
     {
-        auto loop = new event_loop_t(precision);
+        auto loop = new event_loop_t(precision, event_batch_size);
         std::unique_lock<std::shared_mutex> lock(loop_mutex);
         if (exit)
         {
@@ -198,6 +802,13 @@ void event_context_t::do_init()
                 throw std::invalid_argument("not support epoll on windows");
 #else
                 demuxer = new event_epoll_demultiplexer();
+#endif
+                break;
+            case event_strategy::io_uring:
+#ifdef OS_WINDOWS
+                throw std::invalid_argument("not support io_uring on windows");
+#else
+                demuxer = new event_uring_demultiplexer();
 #endif
                 break;
             case event_strategy::IOCP:
@@ -216,15 +827,99 @@ void event_context_t::do_init()
         }
         loop->set_demuxer(demuxer);
         loops.push_back(loop);
+        /// loops beyond the limit are never selected, contexts are added to them explicitly
+        int select_count = select_loop_count;
+        if (select_count < max_select_loops)
+        {
+            select_loops[select_count] = loop;
+            select_loop_count.store(select_count + 1, std::memory_order_release);
+        }
         loop_counter++;
+
+        std::vector<std::function<void(event_loop_t &)>> handlers;
+        for (auto &it : loop_handlers)
+            handlers.push_back(it.second);
+        lock.unlock();
+        for (auto &func : handlers)
+            func(*loop);
+    }
+}
+
+void event_context_t::set_work_stealing(bool enable, microsecond_t balance_period)
+{
+    this->balance_period = balance_period;
+    work_stealing = enable;
+}
+
+event_loop_t *event_context_t::claim_idle_loop(event_loop_t *except)
+{
+    std::shared_lock<std::shared_mutex> lock(loop_mutex);
+    for (auto loop : loops)
+    {
+        bool expect = true;
+        if (loop != except && loop->idle.compare_exchange_strong(expect, false))
+        {
+            idle_loops--;
+            return loop;
+        }
     }
+    return nullptr;
 }
 
-event_context_t::event_context_t(event_strategy strategy, microsecond_t precision)
+event_loop_t *event_context_t::min_load_loop(event_loop_t *except)
+{
+    std::shared_lock<std::shared_mutex> lock(loop_mutex);
+    event_loop_t *min_loop = nullptr;
+    for (auto loop : loops)
+    {
+        if (loop == except)
+            continue;
+        if (min_loop == nullptr || loop->load < min_loop->load)
+            min_loop = loop;
+    }
+    return min_loop;
+}
+
+int event_context_t::add_loop_handler(std::function<void(event_loop_t &)> func)
+{
+    std::vector<event_loop_t *> cur_loops;
+    int id;
+    {
+        std::unique_lock<std::shared_mutex> lock(loop_mutex);
+        id = loop_handler_id++;
+        loop_handlers[id] = func;
+        cur_loops = loops;
+    }
+    try
+    {
+        for (auto loop : cur_loops)
+            func(*loop);
+    } catch (...)
+    {
+        remove_loop_handler(id);
+        throw;
+    }
+    return id;
+}
+
+void event_context_t::remove_loop_handler(int id)
+{
+    std::unique_lock<std::shared_mutex> lock(loop_mutex);
+    loop_handlers.erase(id);
+}
+
+event_context_t::event_context_t(event_strategy strategy, microsecond_t precision, int event_batch_size)
     : strategy(strategy)
     , loop_counter(0)
     , precision(precision)
+    , event_batch_size(event_batch_size)
     , exit(false)
+    , loop_handler_id(0)
+    , work_stealing(false)
+    , balance_period(default_balance_period)
+    , idle_loops(0)
+    , select_loops(new std::atomic<event_loop_t *>[max_select_loops])
+    , select_loop_count(0)
 {
 #ifdef OS_WINDOWS
     iocp_handle = 0;
@@ -232,7 +927,9 @@ event_context_t::event_context_t(event_strategy strategy, microsecond_t precisio
     do_init();
 }
 
-int event_context_t::run()
+int event_context_t::run() { return run_loop(true); }
+
+int event_context_t::run_loop(bool wait_all)
 {
     do_init();
     if (thread_in_loop == nullptr)
@@ -243,7 +940,8 @@ int event_context_t::run()
     loop_counter--;
     std::unique_lock<std::mutex> lock(exit_mutex);
     cond.notify_all();
-    cond.wait(lock, [this]() { return loop_counter == 0; });
+    if (wait_all)
+        cond.wait(lock, [this]() { return loop_counter == 0; });
 
     return code;
 }
@@ -254,6 +952,31 @@ int event_context_t::prepare()
     return 0;
 }
 
+int event_context_t::start_loops(int count, int reserved_cpus, bool bind)
+{
+    auto topology = cpu_topology_t::detect();
+    if (count <= 0)
+        count = topology.get_core_count() - std::max(reserved_cpus, 0) - 1;
+    if (count <= 0)
+        return 0;
+
+    std::vector<int> cpus;
+    if (bind)
+        cpus = topology.plan(count, reserved_cpus);
+    for (int i = 0; i < count; i++)
+    {
+        int cpu = i < (int)cpus.size() ? cpus[i] : -1;
+        loop_threads.emplace_back([this, cpu]() {
+            if (cpu >= 0 && bind_thread_to_cpu(cpu))
+                set_thread_local_memory();
+            /// joined by the destructor, waiting for other loops here deadlocks if the destroying thread registered
+            /// a loop and never ran it
+            run_loop(false);
+        });
+    }
+    return count;
+}
+
 void event_context_t::exit_all(int code)
 {
     exit = true;
@@ -266,6 +989,12 @@ void event_context_t::exit_all(int code)
 
 event_context_t::~event_context_t()
 {
+    if (!loop_threads.empty())
+    {
+        exit_all(0);
+        for (auto &thread : loop_threads)
+            thread.join();
+    }
     std::unique_lock<std::shared_mutex> lock(loop_mutex);
     for (auto loop : loops)
     {
@@ -2,9 +2,77 @@
 #include "net/co.hpp"
 #include "net/event.hpp"
 #include "net/execute_dispatcher.hpp"
+#include "net/lock.hpp"
+#include <vector>
 namespace net
 {
 
+namespace
+{
+constexpr u32 context_chunk_size = 4096;
+constexpr u32 context_max_chunks = 4096;
+
+struct context_slot_t
+{
+    std::atomic_uint32_t generation;
+};
+
+/// chunks are never freed, contexts may be destroyed after static objects
+std::atomic<context_slot_t *> context_chunks[context_max_chunks];
+
+struct context_slot_allocator_t
+{
+    lock::spinlock_t lock;
+    std::vector<u32> free_slots;
+    u32 count = 0;
+};
+
+context_slot_allocator_t &slot_allocator()
+{
+    static context_slot_allocator_t *allocator = new context_slot_allocator_t();
+    return *allocator;
+}
+
+context_slot_t &get_context_slot(u32 slot)
+{
+    return context_chunks[slot / context_chunk_size].load(std::memory_order_acquire)[slot % context_chunk_size];
+}
+
+u32 alloc_context_slot()
+{
+    auto &allocator = slot_allocator();
+    lock::lock_guard g(allocator.lock);
+    if (!allocator.free_slots.empty())
+    {
+        u32 slot = allocator.free_slots.back();
+        allocator.free_slots.pop_back();
+        return slot;
+    }
+    u32 slot = allocator.count;
+    u32 chunk = slot / context_chunk_size;
+    if (chunk >= context_max_chunks)
+        throw std::bad_alloc();
+    if (context_chunks[chunk].load(std::memory_order_relaxed) == nullptr)
+        context_chunks[chunk].store(new context_slot_t[context_chunk_size](), std::memory_order_release);
+    allocator.count++;
+    return slot;
+}
+
+void free_context_slot(u32 slot)
+{
+    get_context_slot(slot).generation++;
+    auto &allocator = slot_allocator();
+    lock::lock_guard g(allocator.lock);
+    allocator.free_slots.push_back(slot);
+}
+
+} // namespace
+
+u32 execute_context_t::slot_generation(u32 slot)
+{
+    return get_context_slot(slot).generation.load(std::memory_order_acquire);
+}
+
 microsecond_t execute_context_t::sleep(microsecond_t ms)
 {
     auto cur = get_current_time();
@@ -17,57 +85,79 @@ microsecond_t execute_context_t::sleep(microsecond_t ms)
 
 void execute_context_t::stop() { co::coroutine_t::yield(); }
 
-void execute_context_t::stop_for(microsecond_t ms, std::function<void()> func)
+void execute_context_t::stop_for(microsecond_t ms, callable_t<void()> func)
 {
-    if (timer.id >= 0)
-        loop->remove_timer(timer);
-    timer = loop->add_timer(make_timer(ms, [this, func]() {
-        timer.id = -1;
-        start();
-    }));
-
-    co::coroutine_t::yield();
-    loop->remove_timer(timer);
+    stop_for(ms);
     func();
 }
 
 void execute_context_t::stop_for(microsecond_t ms)
 {
-    if (timer.id >= 0)
-        loop->remove_timer(timer);
-    timer = loop->add_timer(make_timer(ms, [this]() {
-        timer.id = -1;
-        start();
-    }));
+    timer.timepoint = make_timepoint(ms);
+    timer.callback = [this]() { start(); };
+    get_loop()->add_timer(timer);
     co::coroutine_t::yield();
-    loop->remove_timer(timer);
+    /// woken up by other events before the timer fires
+    get_loop()->remove_timer(timer);
+    timer.callback = nullptr;
 }
 
 void execute_context_t::start()
 {
-    loop->get_dispatcher().add(this, std::function<void()>());
-    wake_up_thread();
+    auto loop = get_loop();
+    loop->get_dispatcher().add(this, nullptr);
+    loop->wake_up();
+}
+
+void execute_context_t::start_with(callable_t<void()> func)
+{
+    auto loop = get_loop();
+    loop->get_dispatcher().add(this, std::move(func));
+    loop->wake_up();
 }
 
-void execute_context_t::start_with(std::function<void()> func)
+void execute_context_t::start_with(callable_t<void()> func, dispatch_priority_t priority)
 {
-    loop->get_dispatcher().add(this, func);
-    wake_up_thread();
+    auto loop = get_loop();
+    loop->get_dispatcher().add(this, std::move(func), priority);
+    loop->wake_up();
 }
 
-void execute_context_t::run(std::function<void()> func)
+void execute_context_t::run(callable_t<void()> func, u64 stack_size)
 {
-    co = co::coroutine_t::create(func);
+    co = co::coroutine_t::create(std::move(func), stack_size);
     co->set_execute_context(this);
     start();
 }
 
-void execute_context_t::wake_up_thread() { loop->wake_up(); }
+void execute_context_t::wake_up_thread() { get_loop()->wake_up(); }
+
+void execute_context_t::cancel() { get_context_slot(slot).generation++; }
+
+void execute_context_t::set_loop(event_loop_t *loop)
+{
+    auto old = this->loop.load();
+    if (old == loop)
+        return;
+    if (old)
+        old->remove_context(this);
+    this->loop = loop;
+    if (loop)
+        loop->add_context(this);
+}
 
 execute_context_t::execute_context_t()
     : co(nullptr)
+    , loop(nullptr)
+    , loop_prev(nullptr)
+    , loop_next(nullptr)
+    , resume_count(0)
+    , last_resume_count(0)
+    , pinned(false)
+    , priority(dispatch_priority::normal)
+    , armed_deadlines(0)
+    , slot(alloc_context_slot())
 {
-    timer.id = -1;
 }
 
 execute_context_t::~execute_context_t()
@@ -76,8 +166,9 @@ execute_context_t::~execute_context_t()
     {
         co->set_execute_context(nullptr);
         co->stop();
-        loop->get_dispatcher().cancel(this);
     }
+    set_loop(nullptr);
+    free_context_slot(slot);
 }
 
 } // namespace net
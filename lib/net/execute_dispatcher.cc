@@ -1,47 +1,352 @@
 #include "net/execute_dispatcher.hpp"
 #include "net/co.hpp"
+#include "net/event.hpp"
 #include "net/execute_context.hpp"
+#include <algorithm>
 namespace net
 {
 
-void execute_thread_dispatcher_t::dispatch()
+/// free nodes kept by a thread
+static constexpr u64 max_cached_dispatch_nodes = 4096;
+
+struct dispatch_node_cache_t
+{
+    /// owner thread only
+    dispatch_node_t *local = nullptr;
+    u64 count = 0;
+    /// nodes released by other threads, linked by 'next'. 'closed_stack' after the owner thread exits
+    std::atomic<dispatch_node_t *> remote{nullptr};
+};
+
+static dispatch_node_t *const closed_stack = reinterpret_cast<dispatch_node_t *>(1);
+
+static void delete_nodes(dispatch_node_t *node)
+{
+    while (node)
+    {
+        auto next = node->next.load(std::memory_order_relaxed);
+        delete node;
+        node = next;
+    }
+}
+
+thread_local dispatch_node_cache_t *thread_node_cache = nullptr;
+thread_local bool thread_node_cache_closed = false;
+
+/// release cached nodes when thread exits.
+/// Nodes of the thread may be still in queues of other loops, the cache header is never freed, they are deleted
+/// by the releasing thread after the stack is closed.
+struct dispatch_node_cache_cleaner_t
+{
+    ~dispatch_node_cache_cleaner_t()
+    {
+        auto cache = thread_node_cache;
+        thread_node_cache = nullptr;
+        thread_node_cache_closed = true;
+        if (cache == nullptr)
+            return;
+        delete_nodes(cache->local);
+        delete_nodes(cache->remote.exchange(closed_stack, std::memory_order_acquire));
+    }
+};
+
+static dispatch_node_cache_t *get_node_cache()
+{
+    if (thread_node_cache == nullptr && !thread_node_cache_closed)
+    {
+        thread_local dispatch_node_cache_cleaner_t cleaner;
+        (void)cleaner;
+        thread_node_cache = new dispatch_node_cache_t();
+    }
+    return thread_node_cache;
+}
+
+dispatch_node_t *dispatch_node_t::allocate()
 {
-    std::tuple<execute_context_t *, std::function<void()>> exec;
+    auto cache = get_node_cache();
+    if (cache == nullptr)
+    {
+        auto node = new dispatch_node_t();
+        node->cache = nullptr;
+        return node;
+    }
+    if (cache->local == nullptr)
+    {
+        /// take back all nodes released by other threads
+        auto node = cache->remote.exchange(nullptr, std::memory_order_acquire);
+        cache->local = node;
+        for (; node != nullptr; node = node->next.load(std::memory_order_relaxed))
+            cache->count++;
+    }
+    if (auto node = cache->local)
+    {
+        cache->local = node->next.load(std::memory_order_relaxed);
+        cache->count--;
+        return node;
+    }
+    auto node = new dispatch_node_t();
+    node->cache = cache;
+    return node;
+}
 
-    while (!co_wait_for_resume.empty())
+void dispatch_node_t::release(dispatch_node_t *node)
+{
+    node->func = nullptr;
+    auto cache = node->cache;
+    if (cache == nullptr)
+    {
+        delete node;
+        return;
+    }
+    if (cache == thread_node_cache)
     {
+        if (cache->count >= max_cached_dispatch_nodes)
         {
-            lock::lock_guard g(lock);
-            exec = co_wait_for_resume.front();
-            co_wait_for_resume.pop();
+            delete node;
+            return;
         }
+        node->next.store(cache->local, std::memory_order_relaxed);
+        cache->local = node;
+        cache->count++;
+        return;
+    }
+    auto head = cache->remote.load(std::memory_order_relaxed);
+    do
+    {
+        if (head == closed_stack)
+        {
+            delete node;
+            return;
+        }
+        node->next.store(head, std::memory_order_relaxed);
+    } while (!cache->remote.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+}
+
+dispatch_queue_t::dispatch_queue_t()
+    : tail(&stub)
+    , head(&stub)
+{
+    stub.next = nullptr;
+}
+
+void dispatch_queue_t::push(dispatch_node_t *node)
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    auto prev = tail.exchange(node, std::memory_order_acq_rel);
+    /// node is invisible to consumer until it is linked
+    prev->next.store(node, std::memory_order_release);
+}
 
-        auto fn = std::get<std::function<void()>>(exec);
-        auto executor = std::get<execute_context_t *>(exec);
+dispatch_node_t *dispatch_queue_t::pop()
+{
+    auto cur = head;
+    auto next = cur->next.load(std::memory_order_acquire);
+    if (cur == &stub)
+    {
+        if (next == nullptr)
+            return nullptr;
+        head = next;
+        cur = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr)
+    {
+        head = next;
+        return cur;
+    }
+    if (cur != tail.load(std::memory_order_acquire))
+        return nullptr;
+    /// cur is the last node, push stub back to take it
+    push(&stub);
+    next = cur->next.load(std::memory_order_acquire);
+    if (next != nullptr)
+    {
+        head = next;
+        return cur;
+    }
+    return nullptr;
+}
+
+bool dispatch_queue_t::empty() const
+{
+    /// stub is at head only when all nodes are taken
+    return head == &stub && tail.load(std::memory_order_acquire) == &stub;
+}
+
+execute_thread_dispatcher_t::execute_thread_dispatcher_t(event_loop_t *loop)
+    : queue_size(0)
+    , loop(loop)
+    , current_class(0)
+{
+    for (int i = 0; i < dispatch_priority_count; i++)
+    {
+        deficits[i] = dispatch_priority_quantum[i];
+        dispatched[i] = 0;
+    }
+}
+
+execute_thread_dispatcher_t::~execute_thread_dispatcher_t()
+{
+    for (auto &queue : queues)
+    {
+        while (auto node = queue.pop())
+            dispatch_node_t::release(node);
+    }
+}
+
+int execute_thread_dispatcher_t::fill_batch(dispatch_node_t **batch)
+{
+    int count = 0;
+    /// classes found empty in a row, stop when all of them are empty
+    int empty_classes = 0;
+    while (count < dispatch_batch_size && empty_classes < dispatch_priority_count)
+    {
+        auto &queue = queues[current_class];
+        auto &deficit = deficits[current_class];
+        int first = count;
+        bool is_empty = false;
+        while (deficit > 0 && count < dispatch_batch_size)
         {
-            lock::lock_guard g(cancel_lock);
-            if (cancel_contexts.find(executor) != cancel_contexts.end())
-                continue;
+            auto node = queue.pop();
+            if (node == nullptr)
+            {
+                is_empty = true;
+                break;
+            }
+            batch[count++] = node;
+            deficit--;
         }
+        if (deficit > 0 && !is_empty)
+            break;
+        /// an empty class doesn't save its share for later rounds
+        empty_classes = count == first ? empty_classes + 1 : 0;
+        deficit = dispatch_priority_quantum[current_class];
+        current_class = (current_class + 1) % dispatch_priority_count;
+    }
+    return count;
+}
+
+void execute_thread_dispatcher_t::dispatch()
+{
+    dispatch_node_t *batch[dispatch_batch_size];
+    u64 resumes = 0;
+    microsecond_t longest_resume = 0;
+    /// end of the previous resume is the start of next one, one clock read per resume. Work between two resumes is
+    /// counted to the later one
+    microsecond_t resume_mark = 0;
 
-        if (fn)
-            executor->co->resume_with(std::move(fn));
-        else
-            executor->co->resume();
+    while (true)
+    {
+        int count = fill_batch(batch);
+        if (count == 0)
+            break;
+        queue_size.fetch_sub(count, std::memory_order_relaxed);
+
+        for (int i = 0; i < count; i++)
+        {
+            auto node = batch[i];
+            auto executor = node->executor;
+            if (executor == nullptr)
+            {
+                dispatched[node->priority]++;
+                node->func();
+                dispatch_node_t::release(node);
+                continue;
+            }
+            /// context is canceled or destroyed
+            if (execute_context_t::slot_generation(node->slot) != node->generation)
+            {
+                dispatch_node_t::release(node);
+                continue;
+            }
+            /// context is moved to other loop after it is added
+            auto owner = executor->get_loop();
+            if (owner != loop && owner != nullptr)
+            {
+                owner->get_dispatcher().add_node(node);
+                owner->wake_up();
+                continue;
+            }
+            u64 backlog = count - i - 1 + queue_size.load(std::memory_order_relaxed);
+            if (loop->try_give(node, backlog))
+                continue;
+
+            executor->resume_count++;
+            loop->window_resumes++;
+            dispatched[node->priority]++;
+            auto fn = std::move(node->func);
+            dispatch_node_t::release(node);
+            /// coroutine is finished
+            auto co = executor->co;
+            if (co == nullptr)
+                continue;
+            if (resume_mark == 0)
+                resume_mark = get_precise_time();
+            if (fn)
+                co->resume_with(std::move(fn));
+            else
+                co->resume();
+            /// the executor may be destroyed in coroutine, it clears the back pointer
+            if (co->is_done())
+            {
+                if (auto owner = co->get_execute_context())
+                    owner->co = nullptr;
+                co::coroutine_t::remove(co);
+            }
+            resumes++;
+            auto now = get_precise_time();
+            longest_resume = std::max(longest_resume, now - resume_mark);
+            resume_mark = now;
+        }
+    }
+    if (resumes > 0)
+    {
+        loop->resumes_histogram.record(resumes);
+        loop->longest_resume_histogram.record(longest_resume);
     }
-    lock::lock_guard g(cancel_lock);
-    cancel_contexts.clear();
 }
 
-void execute_thread_dispatcher_t::add(execute_context_t *econtext, std::function<void()> func)
+void execute_thread_dispatcher_t::add(execute_context_t *econtext, callable_t<void()> func)
 {
-    lock::lock_guard g(lock);
-    co_wait_for_resume.emplace(econtext, std::move(func));
+    add(econtext, std::move(func), econtext->priority);
 }
 
-void execute_thread_dispatcher_t::cancel(execute_context_t *econtext)
+void execute_thread_dispatcher_t::add(execute_context_t *econtext, callable_t<void()> func,
+                                      dispatch_priority_t priority)
 {
-    lock::lock_guard g(cancel_lock);
-    cancel_contexts.insert(econtext);
+    auto node = dispatch_node_t::allocate();
+    node->executor = econtext;
+    node->slot = econtext->slot;
+    node->generation = execute_context_t::slot_generation(econtext->slot);
+    node->priority = priority;
+    node->func = std::move(func);
+    add_node(node);
 }
+
+void execute_thread_dispatcher_t::add_task(callable_t<void()> func, dispatch_priority_t priority)
+{
+    auto node = dispatch_node_t::allocate();
+    node->executor = nullptr;
+    node->priority = priority;
+    node->func = std::move(func);
+    add_node(node);
+}
+
+void execute_thread_dispatcher_t::add_node(dispatch_node_t *node)
+{
+    queue_size.fetch_add(1, std::memory_order_relaxed);
+    queues[node->priority].push(node);
+}
+
+bool execute_thread_dispatcher_t::empty() const
+{
+    for (auto &queue : queues)
+    {
+        if (!queue.empty())
+            return false;
+    }
+    return true;
+}
+
+void execute_thread_dispatcher_t::cancel(execute_context_t *econtext) { econtext->cancel(); }
 } // namespace net
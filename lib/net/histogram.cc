@@ -0,0 +1,59 @@
+#include "net/histogram.hpp"
+#include <algorithm>
+
+namespace net
+{
+
+u64 histogram_snapshot_t::percentile(double p) const
+{
+    if (count == 0)
+        return 0;
+    u64 target = (u64)(p * count);
+    if (target >= count)
+        target = count - 1;
+    u64 seen = 0;
+    for (int i = 0; i < bucket_count; i++)
+    {
+        seen += buckets[i];
+        if (seen > target)
+            return std::min(bucket_upper(i), max);
+    }
+    return max;
+}
+
+histogram_snapshot_t histogram_snapshot_t::operator-(const histogram_snapshot_t &old) const
+{
+    histogram_snapshot_t result = *this;
+    result.count = 0;
+    for (int i = 0; i < bucket_count; i++)
+    {
+        result.buckets[i] = buckets[i] - old.buckets[i];
+        result.count += result.buckets[i];
+    }
+    result.sum = sum - old.sum;
+    return result;
+}
+
+histogram_t::histogram_t()
+    : sum(0)
+    , max(0)
+{
+    for (auto &bucket : buckets)
+        bucket = 0;
+}
+
+histogram_snapshot_t histogram_t::snapshot() const
+{
+    histogram_snapshot_t snapshot;
+    snapshot.count = 0;
+    for (int i = 0; i < histogram_snapshot_t::bucket_count; i++)
+    {
+        snapshot.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.buckets[i];
+    }
+    snapshot.sum = sum.load(std::memory_order_relaxed);
+    snapshot.max = max.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+} // namespace net
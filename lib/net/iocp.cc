@@ -33,7 +33,8 @@ void event_iocp_demultiplexer::add(handle_t handle, event_type_t type)
     }
 }
 
-handle_t event_iocp_demultiplexer::select(event_type_t *type, microsecond_t *timeout)
+/// XXX: one completion per select, GetQueuedCompletionStatusEx loses the per-packet error code
+int event_iocp_demultiplexer::select(ready_event_t *events, int max_events, microsecond_t *timeout)
 {
     DWORD ioSize = 0;
     void *key = NULL;
@@ -59,13 +60,16 @@ handle_t event_iocp_demultiplexer::select(event_type_t *type, microsecond_t *tim
         {
             return 0;
         }
-        return *(int *)key;
+        events[0].handle = *(int *)key;
+        events[0].type = event_type::def;
+        return 1;
     }
-    *type = event_type::def;
     io->buffer_do_len = ioSize;
     io->err = err;
     io->done = true;
-    return (handle_t)io->sock;
+    events[0].handle = (handle_t)io->sock;
+    events[0].type = event_type::def;
+    return 1;
 }
 
 void event_iocp_demultiplexer::remove(handle_t handle, event_type_t type)
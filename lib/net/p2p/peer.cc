@@ -4,9 +4,47 @@
 #include "net/load_balance.hpp"
 #include "net/socket.hpp"
 #include "net/socket_buffer.hpp"
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 namespace net::p2p
 {
 
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
+
+/// bytes of a package head made by 'fragment_head'
+static u64 fragment_head_size(const google::protobuf::Message &msg, int field, int data_field, u64 data_len)
+{
+    u64 inner_len = msg.ByteSizeLong() +
+                    CodedOutputStream::VarintSize32(
+                        WireFormatLite::MakeTag(data_field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED)) +
+                    CodedOutputStream::VarintSize64(data_len) + data_len;
+    return CodedOutputStream::VarintSize32(WireFormatLite::MakeTag(field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED)) +
+           CodedOutputStream::VarintSize64(inner_len) + inner_len - data_len;
+}
+
+/// Serialize a package holding 'msg' as field 'field' except the bytes of 'data_field', which is empty in 'msg' and
+/// has 'data_len' bytes in the package. The data field is the last field of 'msg', so the package is the head
+/// followed by the data.
+static socket_buffer_t fragment_head(const google::protobuf::Message &msg, int field, int data_field, u64 data_len)
+{
+    auto head_len = fragment_head_size(msg, field, data_field, data_len);
+    auto data_tag = WireFormatLite::MakeTag(data_field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+    u64 inner_len = msg.GetCachedSize() + CodedOutputStream::VarintSize32(data_tag) +
+                    CodedOutputStream::VarintSize64(data_len) + data_len;
+
+    socket_buffer_t head(head_len);
+    head.expect().origin_length();
+    auto ptr = head.get();
+    ptr = CodedOutputStream::WriteTagToArray(WireFormatLite::MakeTag(field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED),
+                                             ptr);
+    ptr = CodedOutputStream::WriteVarint64ToArray(inner_len, ptr);
+    ptr = msg.SerializeWithCachedSizesToArray(ptr);
+    ptr = CodedOutputStream::WriteTagToArray(data_tag, ptr);
+    CodedOutputStream::WriteVarint64ToArray(data_len, ptr);
+    return head;
+}
+
 peer_t::peer_t(session_id_t sid)
     : sid(sid)
 {
@@ -56,42 +94,38 @@ peer_info_t *peer_t::add_peer()
 
 void peer_t::send_fragments(fragment_id_t fid, socket_buffer_t buffer, rudp_connection_t conn)
 {
-    Package pkg;
-    auto &rsp = *pkg.mutable_fragment_rsp();
+    /// heads are put in front of slices of the fragment, the fragment is not copied until it is sent by kcp
+    FragmentRsp rsp;
     rsp.set_fragment_id(fid);
     rsp.set_length(buffer.get_length());
-    rsp.set_data("");
-    auto mtu = udp.get_mtu();
-    auto base_len = mtu - pkg.ByteSizeLong() - 8;
+    u64 mtu = udp.get_mtu();
+    auto base_len = mtu - fragment_head_size(rsp, Package::kFragmentRspFieldNumber, FragmentRsp::kDataFieldNumber, mtu);
 
     auto len = std::min(buffer.get_length(), base_len);
-    rsp.set_data(buffer.get(), len);
-    auto pkg_len = pkg.ByteSizeLong();
-    if (pkg_len > mtu)
+    socket_buffer_chain_t chain = {
+        fragment_head(rsp, Package::kFragmentRspFieldNumber, FragmentRsp::kDataFieldNumber, len), buffer.slice(0, len)};
+    if (chain.get_length() > mtu)
     {
         throw net_io_exception("length too large");
     }
-    socket_buffer_t send_buffer(pkg_len);
-    send_buffer.expect().origin_length();
-    pkg.SerializeWithCachedSizesToArray(send_buffer.get());
 
-    co::await(rudp_awrite, &udp, conn, send_buffer);
+    co::await(rudp_awritev, &udp, conn, chain);
     buffer.walk_step(len);
     /// send rest fragments
 
-    auto &rsp_rest = *pkg.mutable_fragment_rsp_rest();
+    FragmentRspRest rsp_rest;
     while (buffer.get_length() > 0)
     {
         len = std::min(buffer.get_length(), base_len);
-        rsp_rest.set_data(buffer.get(), len);
-        pkg_len = pkg.ByteSizeLong();
-        if (pkg_len > mtu)
+        chain.reset();
+        chain.append(
+            fragment_head(rsp_rest, Package::kFragmentRspRestFieldNumber, FragmentRspRest::kDataFieldNumber, len));
+        chain.append(buffer.slice(0, len));
+        if (chain.get_length() > mtu)
         {
             throw net_io_exception("length too large");
         }
-        send_buffer.expect().length(pkg_len);
-        pkg.SerializeWithCachedSizesToArray(send_buffer.get());
-        co::await(rudp_awrite, &udp, conn, send_buffer);
+        co::await(rudp_awritev, &udp, conn, chain);
         buffer.walk_step(len);
     }
 }
@@ -56,6 +56,7 @@ void tracker_server_t::update_tracker(socket_addr_t addr, tcp::connection_t conn
 
 void tracker_server_t::server_main(tcp::connection_t conn)
 {
+    conn.get_socket()->set_priority(dispatch_priority::high);
     tcp::package_head_t head;
     auto remote_addr = conn.get_socket()->remote_addr();
     Package pkg;
@@ -281,6 +282,7 @@ void tracker_server_t::server_main(tcp::connection_t conn)
 
 void tracker_server_t::client_main(tcp::connection_t conn)
 {
+    conn.get_socket()->set_priority(dispatch_priority::high);
     auto remote_addr = conn.get_socket()->remote_addr();
 
     int local_tcp_port = server.get_socket()->local_addr().get_port();
@@ -445,7 +447,8 @@ void tracker_server_t::bind(event_context_t &context, socket_addr_t addr, int ma
             }
         });
 
-    server.listen(context, addr, max_client_count, reuse_addr);
+    /// connections are accepted by every loop
+    server.listen_sharded(context, addr, max_client_count, reuse_addr);
 
     udp.on_unknown_packet([this](socket_addr_t addr) {
         udp.add_connection(addr, 0, make_timespan(10));
@@ -578,6 +581,7 @@ void init_long_connection(tcp::connection_t conn, u64 sid, std::string key)
 
 void tracker_node_client_t::tmain(tcp::connection_t conn)
 {
+    conn.get_socket()->set_priority(dispatch_priority::high);
     if (!is_peer_client)
     {
         init_long_connection(conn, sid, key);
@@ -4,6 +4,7 @@
 #include "net/socket.hpp"
 #include "net/third/ikcp.hpp"
 #include <memory>
+#include <queue>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -12,6 +13,13 @@ namespace net
 
 int udp_output(const char *buf, int len, ikcpcb *kcp, void *user);
 
+static void *kcp_malloc(size_t size) { return socket_buffer_pool_allocate(size); }
+
+static void kcp_free(void *ptr) { socket_buffer_pool_free(ptr); }
+
+/// writers wait when the send queue holds more segments than this many send windows
+constexpr int send_queue_windows = 2;
+
 struct rudp_endpoint_t
 {
     socket_addr_t remote_address;
@@ -21,13 +29,27 @@ struct rudp_endpoint_t
     microsecond_t last_alive;
     microsecond_t inactive_timeout;
     /// next timer
-    timer_registered_t timer_reg;
+    timer_node_t timer;
     bool wait_for_io;
     bool is_closing;
     execute_context_t econtext;
+    /// runs kcp updates and input at high priority, its coroutine only parks. econtext stays at normal priority
+    execute_context_t kcontext;
     std::queue<socket_buffer_t> recv_queue;
     lock::spinlock_t queue_lock;
     lock::spinlock_t endpoint_lock;
+    /// reader waiting for a message, fired when input arrives
+    co::waiter_t *reader;
+    /// writer waiting for the send queue, fired when acks open the window
+    co::waiter_t *writer;
+
+    ~rudp_endpoint_t()
+    {
+        if (reader)
+            reader->detach();
+        if (writer)
+            writer->detach();
+    }
 };
 
 struct hash_so_t
@@ -63,32 +85,41 @@ class rudp_impl_t
 
         auto time_point = delta + cur + base_time;
 
-        if (ep->timer_reg.id >= 0 && ep->timer_reg.timepoint <= time_point + 5000 &&
-            ep->timer_reg.timepoint >= time_point - 5000)
+        if (ep->timer.is_linked() && ep->timer.timepoint <= time_point + 5000 &&
+            ep->timer.timepoint >= time_point - 5000)
         {
             // no need change timer
             return;
         }
 
-        if (ep->timer_reg.id >= 0)
-        {
-            ep->econtext.get_loop()->remove_timer(ep->timer_reg);
-        }
-
-        ep->timer_reg = ep->econtext.get_loop()->add_timer(make_timer(delta, [this, ep]() {
-            ep->econtext.start_with([ep, this]() {
+        /// node is moved if it is linked
+        ep->timer.timepoint = make_timepoint(delta);
+        /// acks and retransmissions go first, bulk senders in the endpoint context stay at normal priority
+        ep->timer.callback = [this, ep]() {
+            ep->kcontext.start_with([ep, this]() {
+                if (ep->ikcp == nullptr)
+                    return;
                 update_endpoint(ep);
                 ikcp_update(ep->ikcp, (get_current_time() - base_time) / 1000);
                 set_timer(ep);
+                /// closing or refused sends are retried by ticks, other waits are fired by waiters
+                if (ep->wait_for_io && ep->reader == nullptr && ep->writer == nullptr)
+                    ep->econtext.start();
             });
-        }));
+        };
+        ep->econtext.get_loop()->add_timer(ep->timer);
     }
 
   public:
     rudp_impl_t()
         : recv_buffer(1472)
     {
+        /// segments of kcp are taken from the buffer pool, installed before any kcp object is created
+        static bool kcp_pooled = (ikcp_allocator(&kcp_malloc, &kcp_free), true);
+        (void)kcp_pooled;
         socket = new_udp_socket();
+        /// acks and retransmissions are not delayed by bulk senders
+        socket->set_priority(dispatch_priority::high);
         base_time = get_current_time();
     }
 
@@ -103,7 +134,6 @@ class rudp_impl_t
             reuse_addr_socket(socket, true);
         socket->bind_context(context);
         socket->run(std::bind(&rudp_impl_t::rudp_server_main, this));
-        socket->wake_up_thread();
     }
 
     void bind(event_context_t &context)
@@ -113,7 +143,6 @@ class rudp_impl_t
         bind_at(socket, address);
         socket->bind_context(context);
         socket->run(std::bind(&rudp_impl_t::rudp_server_main, this));
-        socket->wake_up_thread();
     }
 
     void config(rudp_connection_t conn, int level)
@@ -198,10 +227,11 @@ class rudp_impl_t
         endpoint->inactive_timeout = inactive_timeout;
         endpoint->remote_address = addr;
         endpoint->impl = this;
-        endpoint->timer_reg.id = -1;
         endpoint->channel = channel;
         endpoint->wait_for_io = false;
         endpoint->is_closing = false;
+        endpoint->reader = nullptr;
+        endpoint->writer = nullptr;
 
         ikcp_setoutput(pcb, udp_output);
         ikcp_wndsize(pcb, 128, 128);
@@ -209,6 +239,16 @@ class rudp_impl_t
 
         auto &loop = context->select_loop();
         endpoint->econtext.set_loop(&loop);
+        /// kcp and its timer belong to this loop, both contexts stay in it
+        endpoint->econtext.pin_to_loop(true);
+        endpoint->kcontext.set_loop(&loop);
+        endpoint->kcontext.pin_to_loop(true);
+        endpoint->kcontext.set_priority(dispatch_priority::high);
+        /// started before the endpoint can be found, work queued by input or timer needs the coroutine
+        endpoint->kcontext.run([ptr]() {
+            while (1)
+                ptr->kcontext.stop();
+        });
 
         auto point = endpoint.get();
         {
@@ -306,6 +346,12 @@ class rudp_impl_t
             buffer.finish_walk();
             return io_result::timeout;
         }
+        if (is_send_queue_full(endpoint))
+        {
+            endpoint->wait_for_io = true;
+            param.wait_for(endpoint->writer, event_type::writable);
+            return {};
+        }
         auto pcb = endpoint->ikcp;
         if (ikcp_send(pcb, (const char *)buffer.get(), buffer.get_length()) >= 0) // wnd full, wait...
         {
@@ -318,6 +364,44 @@ class rudp_impl_t
         return {};
     }
 
+    co::async_result_t<io_result> awritev(co::paramter_t &param, rudp_connection_t conn, socket_buffer_chain_t &chain)
+    {
+        assert(chain.get_length() <= INT32_MAX);
+        auto endpoint = find(conn);
+        if (endpoint == nullptr)
+            return io_result::failed;
+        if (param.is_stop())
+        {
+            endpoint->wait_for_io = false;
+            chain.finish_walk();
+            return io_result::timeout;
+        }
+        if (is_send_queue_full(endpoint))
+        {
+            endpoint->wait_for_io = true;
+            param.wait_for(endpoint->writer, event_type::writable);
+            return {};
+        }
+        const char *buffers[max_chain_slices];
+        int lens[max_chain_slices];
+        auto count = chain.get_slice_count();
+        for (u64 i = 0; i < count; i++)
+        {
+            buffers[i] = (const char *)chain.get_slice(i).get();
+            lens[i] = chain.get_slice(i).get_length();
+        }
+        /// slices are copied to kcp segments directly
+        if (ikcp_sendv(endpoint->ikcp, buffers, lens, count) >= 0)
+        {
+            set_timer(endpoint);
+            endpoint->wait_for_io = false;
+            chain.finish_walk();
+            return io_result::ok;
+        }
+        endpoint->wait_for_io = true;
+        return {};
+    }
+
     bool check_unknown(socket_addr_t target, int conv, rudp_endpoint_t *&endpoint)
     {
         std::unordered_map<socket_addr_t, std::unordered_map<int, std::unique_ptr<rudp_endpoint_t>>>::iterator it;
@@ -386,14 +470,32 @@ class rudp_impl_t
                 lock::lock_guard l(endpoint->queue_lock);
                 endpoint->recv_queue.push(std::move(recv_buffer));
             }
-            endpoint->econtext.start();
+            /// waiters are fired in the loop of endpoint
+            endpoint->kcontext.start_with([this, endpoint]() { update_endpoint(endpoint); });
 
             recv_buffer = socket_buffer_t(1472);
         }
     }
 
+    bool is_send_queue_full(rudp_endpoint_t *endpoint)
+    {
+        return ikcp_waitsnd(endpoint->ikcp) >= (int)endpoint->ikcp->snd_wnd * send_queue_windows;
+    }
+
+    /// fire waiters which can go on, they see failure if the endpoint is closed. Called in the loop of endpoint
+    void wake_waiters(rudp_endpoint_t *endpoint)
+    {
+        bool closed = endpoint->ikcp == nullptr;
+        if (endpoint->reader && (closed || ikcp_peeksize(endpoint->ikcp) >= 0))
+            endpoint->reader->fire();
+        if (endpoint->writer && (closed || !is_send_queue_full(endpoint)))
+            endpoint->writer->fire();
+    }
+
     void update_endpoint(rudp_endpoint_t *endpoint)
     {
+        if (endpoint->ikcp == nullptr)
+            return;
         while (!endpoint->recv_queue.empty())
         {
             socket_buffer_t recv_buffer;
@@ -414,6 +516,7 @@ class rudp_impl_t
                 break;
             }
         }
+        wake_waiters(endpoint);
     }
 
     co::async_result_t<io_result> aread(co::paramter_t &param, rudp_connection_t conn, socket_buffer_t &buffer)
@@ -441,7 +544,7 @@ class rudp_impl_t
             endpoint->wait_for_io = false;
             return io_result::ok;
         }
-
+        param.wait_for(endpoint->reader, event_type::readable);
         return {};
     }
 
@@ -469,11 +572,9 @@ class rudp_impl_t
         ikcp_release(endpoint->ikcp);
         endpoint->ikcp = nullptr;
 
-        if (endpoint->timer_reg.id >= 0)
-        {
-            endpoint->econtext.get_loop()->remove_timer(endpoint->timer_reg);
-            endpoint->timer_reg.id = -1;
-        }
+        if (endpoint->timer.is_linked())
+            endpoint->econtext.get_loop()->remove_timer(endpoint->timer);
+        wake_waiters(endpoint);
     }
 
     void close_all_peer()
@@ -489,11 +590,13 @@ class rudp_impl_t
 
                 if (endpoint->ikcp != nullptr)
                 {
-                    if (endpoint->timer_reg.id >= 0)
+                    if (endpoint->timer.is_linked())
                     {
-                        if (endpoint->econtext.get_loop() == &event_loop_t::current())
+                        auto loop = endpoint->econtext.get_loop();
+                        /// the timer can be removed here if the loop is stopped
+                        if (loop == &event_loop_t::current() || !loop->is_running())
                         {
-                            endpoint->econtext.get_loop()->remove_timer(endpoint->timer_reg);
+                            endpoint->econtext.get_loop()->remove_timer(endpoint->timer);
                         }
                         else
                         {
@@ -501,10 +604,9 @@ class rudp_impl_t
                             lock.lock();
                             /// Wait other thread
                             endpoint->econtext.start_with([endpoint, &lock]() {
-                                endpoint->econtext.get_loop()->remove_timer(endpoint->timer_reg);
+                                endpoint->econtext.get_loop()->remove_timer(endpoint->timer);
                                 lock.unlock();
                             });
-                            endpoint->timer_reg.id = -1;
                             lock.lock();
                         }
                     }
@@ -534,11 +636,14 @@ class rudp_impl_t
 int udp_output(const char *buf, int len, ikcpcb *kcp, void *user)
 {
     rudp_endpoint_t *endpoint = (rudp_endpoint_t *)user;
-    socket_buffer_t buffer((byte *)(buf), len);
-    buffer.expect().origin_length();
+    auto addr = endpoint->remote_address.get_raw_addr();
+    int flag = 0;
+#ifndef OS_WINDOWS
+    flag = MSG_DONTWAIT;
+#endif
     // output data to kernel, sendto udp will return immediately forever.
-    // so there is no need to switch to socket coroutine.
-    co::await(socket_awrite_to, endpoint->impl->socket, buffer, endpoint->remote_address);
+    // kcp is flushing, it must not switch to other coroutines which touch it, so the socket is not awaited.
+    sendto(endpoint->impl->socket->get_raw_handle(), buf, len, flag, (sockaddr *)&addr, (socklen_t)sizeof(addr));
     // send failed when kernel buffer is full.
     // KCP will not receive this package's ACK.
     // trigger resend after next tick
@@ -623,6 +728,12 @@ co::async_result_t<io_result> rudp_t::aread(co::paramter_t &param, rudp_connecti
     return impl->aread(param, conn, buffer);
 }
 
+co::async_result_t<io_result> rudp_t::awritev(co::paramter_t &param, rudp_connection_t conn,
+                                             socket_buffer_chain_t &chain)
+{
+    return impl->awritev(param, conn, chain);
+}
+
 co::async_result_t<io_result> rudp_awrite(co::paramter_t &param, rudp_t *rudp, rudp_connection_t conn,
                                           socket_buffer_t &buffer)
 {
@@ -635,4 +746,10 @@ co::async_result_t<io_result> rudp_aread(co::paramter_t &param, rudp_t *rudp, ru
     return rudp->aread(param, conn, buffer);
 }
 
+co::async_result_t<io_result> rudp_awritev(co::paramter_t &param, rudp_t *rudp, rudp_connection_t conn,
+                                           socket_buffer_chain_t &chain)
+{
+    return rudp->awritev(param, conn, chain);
+}
+
 } // namespace net
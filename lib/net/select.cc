@@ -24,7 +24,7 @@ void event_select_demultiplexer::add(handle_t handle, event_type_t type)
         FD_SET(handle, &error_set);
 } // namespace net
 
-handle_t event_select_demultiplexer::select(event_type_t *type, microsecond_t *timeout)
+int event_select_demultiplexer::select(ready_event_t *events, int max_events, microsecond_t *timeout)
 {
     fd_set rs = read_set;
     fd_set ws = write_set;
@@ -41,36 +41,33 @@ handle_t event_select_demultiplexer::select(event_type_t *type, microsecond_t *t
         *timeout = 0;
         return 0;
     }
-    for (int i = 3; i < FD_SETSIZE; i++)
+    int count = 0;
+    for (int i = 3; i < FD_SETSIZE && count < max_events; i++)
     {
         int j = i;
+        event_type_t type = 0;
         if (FD_ISSET(j, &rs))
-        {
-            *type = event_type::readable;
-        }
-        else if (FD_ISSET(j, &ws))
-        {
-            *type = event_type::writable;
-        }
-        else if (FD_ISSET(j, &es))
-        {
-            *type = event_type::error;
-        }
-        else
-        {
+            type |= event_type::readable;
+        if (FD_ISSET(j, &ws))
+            type |= event_type::writable;
+        if (FD_ISSET(j, &es))
+            type |= event_type::error;
+        if (type == 0)
             continue;
-        }
+
         if (j == fd)
         {
             // wake up
             eventfd_t vl;
             eventfd_read(fd, &vl);
             *timeout = 0;
-            return 0;
+            continue;
         }
-        return j;
+        events[count].handle = j;
+        events[count].type = type;
+        count++;
     }
-    return 0;
+    return count;
 }
 
 void event_select_demultiplexer::remove(handle_t handle, event_type_t type)
@@ -1,15 +1,20 @@
 #include "net/socket.hpp"
+#include <algorithm>
+#include <cstring>
 
 namespace net
 {
 socket_t::socket_t(int fd)
     : fd(fd)
     , is_connection_closed(true)
+    , waiter(nullptr)
 {
 }
 
 socket_t::~socket_t()
 {
+    if (waiter)
+        waiter->detach();
 #ifndef OS_WINDOWS
     close(fd);
 #else
@@ -82,8 +87,7 @@ co::async_result_t<io_result> bsd_socket_t::awrite(co::paramter_t &param, socket
     }
     if (ret == io_result::cont)
     {
-        if (param.get_times() == 0)
-            add_event(event_type::writable);
+        wait_event(param, event_type::writable);
         return {};
     }
     if (ret == io_result::closed)
@@ -149,8 +153,7 @@ co::async_result_t<io_result> bsd_socket_t::aread(co::paramter_t &param, socket_
     }
     if (ret == io_result::cont)
     {
-        if (param.get_times() == 0)
-            add_event(event_type::readable);
+        wait_event(param, event_type::readable);
         return {};
     }
 
@@ -198,8 +201,7 @@ co::async_result_t<io_result> bsd_socket_t::awrite_to(co::paramter_t &param, soc
     }
     if (ret == io_result::cont)
     {
-        if (param.get_times() == 0)
-            add_event(event_type::writable);
+        wait_event(param, event_type::writable);
         return {};
     }
 
@@ -246,8 +248,7 @@ co::async_result_t<io_result> bsd_socket_t::aread_from(co::paramter_t &param, so
     }
     if (ret == io_result::cont)
     {
-        if (param.get_times() == 0)
-            add_event(event_type::readable);
+        wait_event(param, event_type::readable);
         return {};
     }
 
@@ -261,6 +262,192 @@ co::async_result_t<io_result> bsd_socket_t::aread_from(co::paramter_t &param, so
     return ret;
 }
 
+#ifndef OS_WINDOWS
+using io_vec_t = iovec;
+#else
+using io_vec_t = WSABUF;
+#endif
+
+/// fill vectors with data of slices, return count of vectors
+static u64 fill_io_vec(socket_buffer_chain_t &chain, io_vec_t *vec)
+{
+    u64 count = 0;
+    for (u64 i = 0; i < chain.get_slice_count(); i++)
+    {
+        auto &slice = chain.get_slice(i);
+        if (slice.get_length() == 0)
+            continue;
+#ifndef OS_WINDOWS
+        vec[count].iov_base = slice.get();
+        vec[count].iov_len = slice.get_length();
+#else
+        vec[count].buf = (CHAR *)slice.get();
+        vec[count].len = slice.get_length();
+#endif
+        count++;
+    }
+    return count;
+}
+
+/// send vectors without waiting, return bytes sent or -1
+static long long send_io_vec(handle_t fd, io_vec_t *vec, u64 count)
+{
+#ifndef OS_WINDOWS
+    msghdr msg = {};
+    msg.msg_iov = vec;
+    msg.msg_iovlen = count;
+    return sendmsg(fd, &msg, MSG_DONTWAIT);
+#else
+    DWORD len = 0;
+    if (WSASend(fd, vec, (DWORD)count, &len, 0, nullptr, nullptr) == SOCKET_ERROR)
+        return -1;
+    return len;
+#endif
+}
+
+/// receive to vectors without waiting, return bytes received, 0 if EOF or -1
+static long long recv_io_vec(handle_t fd, io_vec_t *vec, u64 count)
+{
+#ifndef OS_WINDOWS
+    msghdr msg = {};
+    msg.msg_iov = vec;
+    msg.msg_iovlen = count;
+    return recvmsg(fd, &msg, MSG_DONTWAIT);
+#else
+    DWORD len = 0;
+    DWORD flag = 0;
+    if (WSARecv(fd, vec, (DWORD)count, &len, &flag, nullptr, nullptr) == SOCKET_ERROR)
+        return -1;
+    return len;
+#endif
+}
+
+co::async_result_t<io_result> bsd_socket_t::awritev(co::paramter_t &param, socket_buffer_chain_t &chain)
+{
+    if (param.is_stop())
+    {
+        if (param.get_times() > 0)
+            remove_event(event_type::writable);
+        return io_result::timeout;
+    }
+    if (is_connection_closed)
+        throw net_connect_exception("socket closed by peer", connection_state::closed);
+
+    io_result ret = io_result::ok;
+    io_vec_t vec[max_chain_slices];
+
+    while (chain.get_length() > 0)
+    {
+        auto len = send_io_vec(fd, vec, fill_io_vec(chain, vec));
+
+        int e = GetErr();
+        if (len == 0)
+        {
+            return io_result::cont;
+        }
+        else if (len < 0)
+        {
+            if (e == EINTR)
+            {
+                len = 0;
+            }
+            else if (e == EPIPE)
+            {
+                // EOF PIPE
+                ret = io_result::closed;
+                break;
+            }
+            else if (e == WOULDBLOCK)
+            {
+                ret = io_result::cont;
+                break;
+            }
+            else if (e == ECONNREFUSED)
+                throw net_connect_exception("recv message failed!", connection_state::connection_refuse);
+            else if (e == ECONNRESET)
+                throw net_connect_exception("recv message failed!", connection_state::close_by_peer);
+            else
+                throw net_io_exception("send message failed!");
+        }
+        chain.walk_step(len);
+    }
+    if (ret == io_result::cont)
+    {
+        wait_event(param, event_type::writable);
+        return {};
+    }
+    if (ret == io_result::closed)
+        is_connection_closed = true;
+
+    if (param.get_times() > 0)
+        remove_event(event_type::writable);
+
+    chain.finish_walk();
+    return ret;
+}
+
+co::async_result_t<io_result> bsd_socket_t::areadv(co::paramter_t &param, socket_buffer_chain_t &chain)
+{
+    if (param.is_stop())
+    {
+        if (param.get_times() > 0)
+            remove_event(event_type::readable);
+        return io_result::timeout;
+    }
+
+    if (is_connection_closed)
+        throw net_connect_exception("socket closed by peer", connection_state::closed);
+
+    io_result ret = io_result::ok;
+    io_vec_t vec[max_chain_slices];
+
+    while (chain.get_length() > 0)
+    {
+        auto len = recv_io_vec(fd, vec, fill_io_vec(chain, vec));
+
+        if (len == 0) // EOF
+        {
+            ret = io_result::closed;
+            break;
+        }
+        else if (len < 0)
+        {
+            int e = GetErr();
+            if (e == EINTR)
+            {
+                len = 0;
+            }
+            else if (e == WOULDBLOCK)
+            {
+                // can't read any data
+                ret = io_result::cont;
+                break;
+            }
+            else if (e == ECONNREFUSED)
+                throw net_connect_exception("recv message failed!", connection_state::connection_refuse);
+            else if (e == ECONNRESET)
+                throw net_connect_exception("recv message failed!", connection_state::close_by_peer);
+            else
+                throw net_io_exception("recv message failed!");
+        }
+        chain.walk_step(len);
+    }
+    if (ret == io_result::cont)
+    {
+        wait_event(param, event_type::readable);
+        return {};
+    }
+
+    if (ret == io_result::closed)
+        is_connection_closed = true;
+
+    if (param.get_times() > 0)
+        remove_event(event_type::readable);
+
+    chain.finish_walk();
+    return ret;
+}
+
 #ifdef OS_WINDOWS
 co::async_result_t<io_result> iocp_socket_t::awrite(co::paramter_t &param, socket_buffer_t &buffer)
 {
@@ -375,7 +562,180 @@ co::async_result_t<io_result> iocp_socket_t::aread(co::paramter_t &param, socket
 
         if (need_recv)
         {
-            int err = WSARecv(fd, (LPWSABUF)&io->wsaBuf, 1, &dwRead, &flag, &io->overlapped, 0);
+            int err = WSARecv(fd, (LPWSABUF)&io->wsaBuf, 1, &dwRead, &flag, &io->overlapped, 0);
+            if (err == SOCKET_ERROR)
+            {
+                err = GetErr();
+                if (err == ERROR_IO_PENDING)
+                    return {};
+                else if (err == WSAEDISCON || err == WSAENOTCONN)
+                    ret = io_result::closed;
+                else
+                    throw net_io_exception("aread fail");
+            }
+            if (ret == io_result::ok)
+                return {};
+        }
+        else
+        {
+            if (io->buffer_do_len > buffer.get_length())
+            {
+                throw net_io_exception("fail buffer size");
+            }
+            buffer.walk_step(io->buffer_do_len);
+            if (io->buffer_do_len == 0 && io->done)
+            {
+                ret = io_result::closed;
+            }
+            if (io->err != 0)
+            {
+                ret = io_result::failed;
+            }
+            io->buffer_do_len = 0;
+        }
+        if (buffer.get_walk_offset() >= buffer.get_data_length())
+        {
+            buffer.finish_walk();
+            break;
+        }
+        if (ret != io_result::ok)
+        {
+            break;
+        }
+        else
+        {
+            // cont
+            io->wsaBuf.buf = (CHAR *)buffer.get();
+            io->wsaBuf.len = buffer.get_length();
+            ZeroMemory(&io->overlapped, sizeof(OVERLAPPED));
+            need_recv = true;
+        }
+    }
+    if (param.is_stop())
+    {
+        BOOL ok = CancelIoEx((HANDLE)fd, &io->overlapped);
+        if (ok == FALSE)
+        {
+            throw net_io_exception("cancel fail");
+        }
+        delete io;
+        return io_result::timeout;
+    }
+    delete io;
+    return ret;
+}
+
+co::async_result_t<io_result> iocp_socket_t::awritev(co::paramter_t &param, socket_buffer_chain_t &chain)
+{
+    auto io = (io_overlapped *)param.get_user_ptr();
+    io_result ret = io_result::ok;
+    bool need_send = false;
+    if (param.get_times() == 0)
+    {
+        if (is_connection_closed)
+            throw net_connect_exception("socket closed by peer", connection_state::closed);
+
+        io = new io_overlapped();
+        io->sock = (HANDLE)fd;
+        io->type = io_type::write;
+        param.set_user_ptr(io);
+        need_send = true;
+    }
+    while (1)
+    {
+        if (need_send)
+        {
+            /// WSABUF structures are captured by WSASend
+            WSABUF vec[max_chain_slices];
+            DWORD dwWrite = 0;
+            int err = WSASend(fd, vec, (DWORD)fill_io_vec(chain, vec), &dwWrite, 0, &io->overlapped, 0);
+
+            if (err == SOCKET_ERROR)
+            {
+                err = GetErr();
+                if (err == ERROR_IO_PENDING)
+                    return {};
+                else if (err == WSAEDISCON || err == WSAENOTCONN)
+                    ret = io_result::closed;
+                else
+                    throw net_io_exception("awrite fail");
+            }
+            chain.walk_step(dwWrite);
+        }
+        else
+        {
+            if (io->buffer_do_len > chain.get_length())
+            {
+                throw net_io_exception("fail buffer size");
+            }
+            chain.walk_step(io->buffer_do_len);
+            if (io->buffer_do_len == 0 && io->done)
+            {
+                ret = io_result::closed;
+            }
+            if (io->err != 0)
+            {
+                ret = io_result::failed;
+            }
+            io->buffer_do_len = 0;
+        }
+
+        if (chain.get_length() == 0)
+        {
+            chain.finish_walk();
+            break;
+        }
+        else
+        {
+            if (ret != io_result::ok)
+            {
+                break;
+            }
+            ZeroMemory(&io->overlapped, sizeof(io->overlapped));
+            need_send = true;
+        }
+    }
+    if (param.is_stop())
+    {
+        BOOL ok = CancelIoEx((HANDLE)fd, &io->overlapped);
+        if (ok == FALSE)
+        {
+            throw net_io_exception("cancel fail");
+        }
+        delete io;
+        return io_result::timeout;
+    }
+    delete io;
+    return ret;
+}
+
+co::async_result_t<io_result> iocp_socket_t::areadv(co::paramter_t &param, socket_buffer_chain_t &chain)
+{
+    auto io = (io_overlapped *)param.get_user_ptr();
+    io_result ret = io_result::ok;
+    bool need_recv = false;
+    if (param.get_times() == 0)
+    {
+        if (is_connection_closed)
+            throw net_connect_exception("socket closed by peer", connection_state::closed);
+
+        io = new io_overlapped();
+        io->sock = (HANDLE)fd;
+        io->type = io_type::read;
+        param.set_user_ptr(io);
+        need_recv = true;
+    }
+
+    while (1)
+    {
+        DWORD dwRead = 0;
+        DWORD flag = 0;
+
+        if (need_recv)
+        {
+            /// WSABUF structures are captured by WSARecv
+            WSABUF vec[max_chain_slices];
+            int err = WSARecv(fd, vec, (DWORD)fill_io_vec(chain, vec), &dwRead, &flag, &io->overlapped, 0);
             if (err == SOCKET_ERROR)
             {
                 err = GetErr();
@@ -391,11 +751,11 @@ co::async_result_t<io_result> iocp_socket_t::aread(co::paramter_t &param, socket
         }
         else
         {
-            if (io->buffer_do_len > buffer.get_length())
+            if (io->buffer_do_len > chain.get_length())
             {
                 throw net_io_exception("fail buffer size");
             }
-            buffer.walk_step(io->buffer_do_len);
+            chain.walk_step(io->buffer_do_len);
             if (io->buffer_do_len == 0 && io->done)
             {
                 ret = io_result::closed;
@@ -406,9 +766,9 @@ co::async_result_t<io_result> iocp_socket_t::aread(co::paramter_t &param, socket
             }
             io->buffer_do_len = 0;
         }
-        if (buffer.get_walk_offset() >= buffer.get_data_length())
+        if (chain.get_length() == 0)
         {
-            buffer.finish_walk();
+            chain.finish_walk();
             break;
         }
         if (ret != io_result::ok)
@@ -418,8 +778,6 @@ co::async_result_t<io_result> iocp_socket_t::aread(co::paramter_t &param, socket
         else
         {
             // cont
-            io->wsaBuf.buf = (CHAR *)buffer.get();
-            io->wsaBuf.len = buffer.get_length();
             ZeroMemory(&io->overlapped, sizeof(OVERLAPPED));
             need_recv = true;
         }
@@ -513,6 +871,390 @@ co::async_result_t<io_result> iocp_socket_t::aread_from(co::paramter_t &param, s
 
 #endif
 
+#ifndef OS_WINDOWS
+uring_socket_t::uring_socket_t(int fd)
+    : bsd_socket_t(fd)
+    , read_op(nullptr)
+    , write_op(nullptr)
+    , fixed_ring(nullptr)
+{
+}
+
+uring_socket_t::~uring_socket_t()
+{
+    drop_op(read_op);
+    drop_op(write_op);
+    /// fixed file holds a reference, unregister before closing
+    if (fixed_ring)
+        fixed_ring->unregister_file(fd);
+}
+
+event_uring_demultiplexer *uring_socket_t::current_ring()
+{
+    if (co::coroutine_t::current() == nullptr || !event_loop_t::has_current())
+        return nullptr;
+    auto &loop = event_loop_t::current();
+    if (loop.get_context().get_strategy() != event_strategy::io_uring)
+        return nullptr;
+    auto ring = static_cast<event_uring_demultiplexer *>(loop.get_demuxer());
+    if (fixed_ring == nullptr && get_loop() == &loop)
+    {
+        if (ring->register_file(fd) >= 0)
+            fixed_ring = ring;
+    }
+    return ring;
+}
+
+uring_op_t *uring_socket_t::make_op(event_uring_demultiplexer *ring, uring_io_type type, u64 size)
+{
+    auto op = ring->acquire_op();
+    op->io_type = type;
+    if (size > 0)
+    {
+        if (size <= ring->get_buffer_size() || type == uring_io_type::read || type == uring_io_type::write)
+            op->buffer_index = ring->acquire_buffer();
+        if (op->buffer_index >= 0)
+        {
+            op->buffer = ring->get_buffer(op->buffer_index);
+            op->buffer_size = ring->get_buffer_size();
+        }
+        else
+        {
+            op->buffer = new byte[size];
+            op->buffer_size = size;
+        }
+    }
+    op->ring = ring;
+    return op;
+}
+
+void uring_socket_t::wait_op(co::paramter_t &param, uring_op_t *op)
+{
+    bool write = op->io_type == uring_io_type::write || op->io_type == uring_io_type::write_to;
+    param.wait_for(op->waiter, write ? event_type::writable : event_type::readable);
+}
+
+void uring_socket_t::drop_op(uring_op_t *&op)
+{
+    if (op == nullptr)
+        return;
+    /// the waiter may outlive an orphan op
+    if (op->waiter)
+        op->waiter->detach();
+    op->waiter = nullptr;
+    auto ring = op->ring;
+    if (ring == nullptr)
+        delete op;
+    else if (op->state.exchange(uring_op_t::orphan) == uring_op_t::done)
+        ring->release_op(op);
+    else
+        ring->cancel_op(op);
+    op = nullptr;
+}
+
+void uring_socket_t::delete_op(uring_op_t *&op)
+{
+    /// ring is gone
+    if (op->ring == nullptr)
+        delete op;
+    else
+        op->ring->release_op(op);
+    op = nullptr;
+}
+
+co::async_result_t<io_result> uring_socket_t::awrite(co::paramter_t &param, socket_buffer_t &buffer)
+{
+    auto ring = current_ring();
+    if (ring == nullptr)
+        return bsd_socket_t::awrite(param, buffer);
+    if (param.is_stop())
+    {
+        drop_op(write_op);
+        return io_result::timeout;
+    }
+
+    io_result ret = io_result::ok;
+    if (write_op == nullptr)
+    {
+        if (is_connection_closed)
+            throw net_connect_exception("socket closed by peer", connection_state::closed);
+        if (buffer.get_length() == 0)
+        {
+            buffer.finish_walk();
+            return io_result::ok;
+        }
+        write_op = make_op(ring, uring_io_type::write, buffer.get_length());
+    }
+    else
+    {
+        if (write_op->state != uring_op_t::done)
+        {
+            wait_op(param, write_op);
+            return {};
+        }
+        int res = write_op->res;
+        if (res > 0)
+        {
+            buffer.walk_step(res);
+        }
+        else if (res == -EPIPE)
+        {
+            ret = io_result::closed;
+        }
+        else if (res == -ECONNREFUSED)
+        {
+            delete_op(write_op);
+            throw net_connect_exception("send message failed!", connection_state::connection_refuse);
+        }
+        else if (res == -ECONNRESET)
+        {
+            delete_op(write_op);
+            throw net_connect_exception("send message failed!", connection_state::close_by_peer);
+        }
+        else if (res < 0 && res != -EINTR && res != -EAGAIN && res != -ECANCELED)
+        {
+            delete_op(write_op);
+            throw net_io_exception("send message failed!");
+        }
+        if (ret != io_result::ok || buffer.get_length() == 0)
+        {
+            delete_op(write_op);
+            if (ret == io_result::closed)
+                is_connection_closed = true;
+            buffer.finish_walk();
+            return ret;
+        }
+    }
+    /// copy the next part into ring buffer
+    u64 len = std::min(buffer.get_length(), (u64)write_op->buffer_size);
+    memcpy(write_op->buffer, buffer.get(), len);
+    write_op->iov.iov_base = write_op->buffer;
+    write_op->iov.iov_len = len;
+    write_op->state = uring_op_t::pending;
+    ring->submit_op(write_op, fd);
+    wait_op(param, write_op);
+    return {};
+}
+
+co::async_result_t<io_result> uring_socket_t::aread(co::paramter_t &param, socket_buffer_t &buffer)
+{
+    auto ring = current_ring();
+    if (ring == nullptr)
+        return bsd_socket_t::aread(param, buffer);
+    if (param.is_stop())
+    {
+        drop_op(read_op);
+        return io_result::timeout;
+    }
+
+    io_result ret = io_result::ok;
+    if (read_op == nullptr)
+    {
+        if (is_connection_closed)
+            throw net_connect_exception("socket closed by peer", connection_state::closed);
+        if (buffer.get_length() == 0)
+        {
+            buffer.finish_walk();
+            return io_result::ok;
+        }
+        read_op = make_op(ring, uring_io_type::read, buffer.get_length());
+    }
+    else
+    {
+        if (read_op->state != uring_op_t::done)
+        {
+            wait_op(param, read_op);
+            return {};
+        }
+        int res = read_op->res;
+        if (res > 0)
+        {
+            memcpy(buffer.get(), read_op->buffer, res);
+            buffer.walk_step(res);
+        }
+        else if (res == 0) // EOF
+        {
+            ret = io_result::closed;
+        }
+        else if (res == -ECONNREFUSED)
+        {
+            delete_op(read_op);
+            throw net_connect_exception("recv message failed!", connection_state::connection_refuse);
+        }
+        else if (res == -ECONNRESET)
+        {
+            delete_op(read_op);
+            throw net_connect_exception("recv message failed!", connection_state::close_by_peer);
+        }
+        else if (res != -EINTR && res != -EAGAIN && res != -ECANCELED)
+        {
+            delete_op(read_op);
+            throw net_io_exception("recv message failed!");
+        }
+        if (ret != io_result::ok || buffer.get_length() == 0)
+        {
+            delete_op(read_op);
+            if (ret == io_result::closed)
+                is_connection_closed = true;
+            buffer.finish_walk();
+            return ret;
+        }
+    }
+    read_op->iov.iov_base = read_op->buffer;
+    read_op->iov.iov_len = std::min(buffer.get_length(), (u64)read_op->buffer_size);
+    read_op->state = uring_op_t::pending;
+    ring->submit_op(read_op, fd);
+    wait_op(param, read_op);
+    return {};
+}
+
+co::async_result_t<io_result> uring_socket_t::awrite_to(co::paramter_t &param, socket_buffer_t &buffer,
+                                                        socket_addr_t target)
+{
+    auto ring = current_ring();
+    if (ring == nullptr)
+        return bsd_socket_t::awrite_to(param, buffer, target);
+    if (param.is_stop())
+    {
+        drop_op(write_op);
+        return io_result::timeout;
+    }
+
+    if (write_op == nullptr)
+    {
+        auto len = buffer.get_length();
+        write_op = make_op(ring, uring_io_type::write_to, len);
+        memcpy(write_op->buffer, buffer.get(), len);
+        write_op->iov.iov_base = write_op->buffer;
+        write_op->iov.iov_len = len;
+        write_op->addr = target.get_raw_addr();
+        ring->submit_op(write_op, fd);
+        wait_op(param, write_op);
+        return {};
+    }
+    if (write_op->state != uring_op_t::done)
+    {
+        wait_op(param, write_op);
+        return {};
+    }
+
+    int res = write_op->res;
+    if (res == -EINTR || res == -EAGAIN)
+    {
+        write_op->state = uring_op_t::pending;
+        ring->submit_op(write_op, fd);
+        wait_op(param, write_op);
+        return {};
+    }
+    delete_op(write_op);
+    if (res == -EACCES)
+        throw net_io_exception("error send to " + target.to_string() + ". permission denied.");
+    if (res == -EPIPE)
+        return io_result::closed;
+    if (res < 0)
+        return io_result::failed;
+    buffer.walk_step(res);
+    buffer.finish_walk();
+    return io_result::ok;
+}
+
+co::async_result_t<io_result> uring_socket_t::aread_from(co::paramter_t &param, socket_buffer_t &buffer,
+                                                         socket_addr_t &target)
+{
+    auto ring = current_ring();
+    if (ring == nullptr)
+        return bsd_socket_t::aread_from(param, buffer, target);
+    if (param.is_stop())
+    {
+        drop_op(read_op);
+        return io_result::timeout;
+    }
+
+    if (read_op == nullptr)
+    {
+        read_op = make_op(ring, uring_io_type::read_from, buffer.get_length());
+        read_op->iov.iov_base = read_op->buffer;
+        read_op->iov.iov_len = std::min(buffer.get_length(), (u64)read_op->buffer_size);
+        ring->submit_op(read_op, fd);
+        wait_op(param, read_op);
+        return {};
+    }
+    if (read_op->state != uring_op_t::done)
+    {
+        wait_op(param, read_op);
+        return {};
+    }
+
+    int res = read_op->res;
+    if (res == -EINTR || res == -EAGAIN || res == -ECANCELED)
+    {
+        read_op->state = uring_op_t::pending;
+        ring->submit_op(read_op, fd);
+        wait_op(param, read_op);
+        return {};
+    }
+    io_result ret = io_result::ok;
+    if (res == 0)
+    {
+        ret = io_result::closed;
+    }
+    else if (res < 0)
+    {
+        ret = io_result::failed;
+    }
+    else
+    {
+        memcpy(buffer.get(), read_op->buffer, res);
+        buffer.walk_step(res);
+        buffer.finish_walk();
+        target = read_op->addr;
+    }
+    delete_op(read_op);
+    return ret;
+}
+
+co::async_result_t<socket_t *> uring_socket_t::aaccept(co::paramter_t &param)
+{
+    auto ring = current_ring();
+    if (ring == nullptr)
+        return bsd_socket_t::aaccept(param);
+    if (param.is_stop())
+    {
+        drop_op(read_op);
+        return nullptr;
+    }
+
+    if (read_op == nullptr)
+    {
+        read_op = make_op(ring, uring_io_type::accept, 0);
+        ring->submit_op(read_op, fd);
+        wait_op(param, read_op);
+        return {};
+    }
+    if (read_op->state != uring_op_t::done)
+    {
+        wait_op(param, read_op);
+        return {};
+    }
+
+    int res = read_op->res;
+    if (res == -EINTR || res == -EAGAIN || res == -ECANCELED || res == -ECONNABORTED)
+    {
+        read_op->state = uring_op_t::pending;
+        ring->submit_op(read_op, fd);
+        wait_op(param, read_op);
+        return {};
+    }
+    delete_op(read_op);
+    if (res < 0)
+        throw net_connect_exception("failed to accept " + local_addr().to_string(), connection_state::no_resource);
+
+    auto socket2 = new uring_socket_t(res);
+    socket2->is_connection_closed = false;
+    return socket2;
+}
+#endif
+
 socket_addr_t socket_t::local_addr()
 {
     sockaddr_in in;
@@ -537,6 +1279,13 @@ socket_addr_t socket_t::remote_addr()
 
 void socket_t::on_event(event_context_t &context, event_type_t type)
 {
+    if (waiter)
+    {
+        /// other readiness can't finish the waiting operation, resuming for it is spurious
+        if (type & event_type::error || waiter->wants(type))
+            waiter->fire();
+        return;
+    }
     if (type & event_type::readable || type & event_type::writable || type & event_type::error ||
         type & event_type::def)
     {
@@ -545,6 +1294,13 @@ void socket_t::on_event(event_context_t &context, event_type_t type)
     // may be destoried here
 }
 
+void socket_t::wait_event(co::paramter_t &param, event_type_t type)
+{
+    if (param.get_times() == 0)
+        add_event(type);
+    param.wait_for(waiter, type);
+}
+
 void socket_t::bind_context(event_context_t &context)
 {
     auto &loop = context.select_loop();
@@ -552,33 +1308,84 @@ void socket_t::bind_context(event_context_t &context)
     loop.add_event_handler(fd, this);
 }
 
+void socket_t::bind_context(event_context_t &context, event_loop_t &loop)
+{
+    set_loop(&loop);
+    loop.add_event_handler(fd, this);
+}
+
+void socket_t::migrate(event_loop_t &from, event_loop_t &to)
+{
+    if (from.find_event_handler(fd) != this)
+        return;
+    auto interest = from.get_interest(fd);
+    from.remove_event_handler(fd, this);
+    to.add_event_handler(fd, this);
+    if (interest)
+        to.link(fd, interest);
+}
+
 void socket_t::unbind_context() { get_loop()->remove_event_handler(fd, this); }
 
 void socket_t::add_event(event_type_t type) { get_loop()->link(fd, type); }
 
 void socket_t::remove_event(event_type_t type) { get_loop()->unlink(fd, type); }
 
+/// count bytes of a finished operation to the load of loop
+template <typename Buffer>
+static co::async_result_t<io_result> count_io_bytes(socket_t *socket, Buffer &buffer,
+                                                    co::async_result_t<io_result> result)
+{
+    if (result.is_finish() && result() == io_result::ok)
+    {
+        if (auto loop = socket->get_loop())
+            loop->add_io_bytes(buffer.get_length());
+    }
+    return result;
+}
+
 co::async_result_t<io_result> socket_awrite(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer)
 {
-    return socket->awrite(param, buffer);
+    return count_io_bytes(socket, buffer, socket->awrite(param, buffer));
 }
 
 co::async_result_t<io_result> socket_aread(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer)
 {
     // async read wrapper
-    return socket->aread(param, buffer);
+    return count_io_bytes(socket, buffer, socket->aread(param, buffer));
+}
+
+co::async_result_t<io_result> socket_awritev(co::paramter_t &param, socket_t *socket, socket_buffer_chain_t &chain)
+{
+    return count_io_bytes(socket, chain, socket->awritev(param, chain));
+}
+
+co::async_result_t<io_result> socket_areadv(co::paramter_t &param, socket_t *socket, socket_buffer_chain_t &chain)
+{
+    return count_io_bytes(socket, chain, socket->areadv(param, chain));
 }
 
 co::async_result_t<io_result> socket_awrite_to(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer,
                                                socket_addr_t target)
 {
-    return socket->awrite_to(param, buffer, target);
+    return count_io_bytes(socket, buffer, socket->awrite_to(param, buffer, target));
 }
 co::async_result_t<io_result> socket_aread_from(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer,
                                                 socket_addr_t &target)
 {
-    return socket->aread_from(param, buffer, target);
+    return count_io_bytes(socket, buffer, socket->aread_from(param, buffer, target));
+}
+
+#ifndef OS_WINDOWS
+/// create socket by the strategy of the event loop in current thread
+static socket_t *new_socket(int fd)
+{
+    if (event_loop_t::has_current() &&
+        event_loop_t::current().get_context().get_strategy() == event_strategy::io_uring)
+        return new uring_socket_t(fd);
+    return new bsd_socket_t(fd);
 }
+#endif
 
 socket_t *new_tcp_socket()
 {
@@ -588,7 +1395,7 @@ socket_t *new_tcp_socket()
         throw net_connect_exception("failed to start socket.", connection_state::no_resource);
     int flags = fcntl(fd, F_GETFL, 0);
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-    return new bsd_socket_t(fd);
+    return new_socket(fd);
 #else
     int fd = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0, WSA_FLAG_OVERLAPPED);
     if (fd < 0)
@@ -611,7 +1418,7 @@ socket_t *new_udp_socket()
         throw net_connect_exception("failed to start socket.", connection_state::no_resource);
     int flags = fcntl(fd, F_GETFL, 0);
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-    return new bsd_socket_t(fd);
+    return new_socket(fd);
 #else
     int fd = WSASocketW(AF_INET, SOCK_DGRAM, IPPROTO_UDP, 0, 0, WSA_FLAG_OVERLAPPED);
     if (fd < 0)
@@ -752,7 +1559,7 @@ co::async_result_t<io_result> connect_to(co::paramter_t &param, socket_t *socket
     int e = GetErr();
     if (e == EINPROGRESS || e == WOULDBLOCK)
     {
-        socket->add_event(event_type::readable | event_type::writable);
+        socket->wait_event(param, event_type::readable | event_type::writable);
         return co::async_result_t<io_result>();
     }
     else if (e == EISCONN)
@@ -790,7 +1597,7 @@ co::async_result_t<io_result> connect_udp(co::paramter_t &param, socket_t *socke
     int e = GetErr();
     if (e == EINPROGRESS)
     {
-        socket->add_event(event_type::readable | event_type::writable);
+        socket->wait_event(param, event_type::readable | event_type::writable);
         return co::async_result_t<io_result>();
     }
     else if (e == EISCONN)
@@ -893,43 +1700,107 @@ co::async_result_t<socket_t *> accept_from(co::paramter_t &param, socket_t *sock
     setsockopt(socket->get_raw_handle(), SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (char *)&sock, sizeof(sock));
     return target;
 }
+
+co::async_result_t<socket_t *> iocp_socket_t::aaccept(co::paramter_t &param) { return accept_from(param, this); }
+
+co::async_result_t<io_result> accept_all_from(co::paramter_t &param, socket_t *socket, std::vector<socket_t *> &sockets,
+                                              int max_count)
+{
+    auto ret = accept_from(param, socket);
+    if (!ret.is_finish())
+        return {};
+    if (ret() == nullptr)
+        return io_result::timeout;
+    sockets.push_back(ret());
+    return io_result::ok;
+}
 #else
-co::async_result_t<socket_t *> accept_from(co::paramter_t &param, socket_t *socket)
+co::async_result_t<socket_t *> bsd_socket_t::aaccept(co::paramter_t &param)
 {
     if (param.is_stop())
     {
-        socket->remove_event(event_type::readable);
+        remove_event(event_type::readable);
         return nullptr;
     }
 
-    int fd = accept(socket->get_raw_handle(), 0, 0);
+    int fd = accept4(get_raw_handle(), 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (fd < 0)
     {
         int r = GetErr();
-        if (r == WOULDBLOCK)
+        if (r == WOULDBLOCK || r == EINTR || r == ECONNABORTED)
         {
             // wait
-            socket->add_event(event_type::readable);
+            wait_event(param, event_type::readable);
             return co::async_result_t<socket_t *>();
         }
-        socket->remove_event(event_type::readable);
+        remove_event(event_type::readable);
 
-        throw net_connect_exception("failed to accept " + socket->local_addr().to_string(),
-                                    connection_state::no_resource);
+        throw net_connect_exception("failed to accept " + local_addr().to_string(), connection_state::no_resource);
     }
-    socket->remove_event(event_type::readable);
+    remove_event(event_type::readable);
 
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
     auto socket2 = new bsd_socket_t(fd);
     socket2->is_connection_closed = false;
     return socket2;
 }
+
+co::async_result_t<socket_t *> accept_from(co::paramter_t &param, socket_t *socket) { return socket->aaccept(param); }
+
+co::async_result_t<io_result> accept_all_from(co::paramter_t &param, socket_t *socket, std::vector<socket_t *> &sockets,
+                                              int max_count)
+{
+    if (param.is_stop())
+    {
+        socket->remove_event(event_type::readable);
+        return io_result::timeout;
+    }
+    /// completion based socket accepts one by one
+    if (dynamic_cast<uring_socket_t *>(socket))
+    {
+        auto ret = socket->aaccept(param);
+        if (!ret.is_finish())
+            return {};
+        sockets.push_back(ret());
+        return io_result::ok;
+    }
+
+    while ((int)sockets.size() < max_count)
+    {
+        int fd = accept4(socket->get_raw_handle(), 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            int r = GetErr();
+            if (r == EINTR || r == ECONNABORTED)
+                continue;
+            if (r == WOULDBLOCK)
+                break;
+            if (!sockets.empty())
+                break;
+            socket->remove_event(event_type::readable);
+            throw net_connect_exception("failed to accept " + socket->local_addr().to_string(),
+                                        connection_state::no_resource);
+        }
+        auto socket2 = new bsd_socket_t(fd);
+        socket2->is_connection_closed = false;
+        sockets.push_back(socket2);
+    }
+    if (sockets.empty())
+    {
+        // wait
+        socket->wait_event(param, event_type::readable);
+        return {};
+    }
+    if (param.get_times() > 0)
+        socket->remove_event(event_type::readable);
+    return io_result::ok;
+}
 #endif
 
 void close_socket(socket_t *socket)
 {
-    socket->remove_event(event_type::readable | event_type::writable | event_type::error);
+    /// a socket failing to bind or listen has no loop yet
+    if (socket->get_loop() != nullptr)
+        socket->remove_event(event_type::readable | event_type::writable | event_type::error);
     delete socket;
 }
 
@@ -1,8 +1,191 @@
 #include "net/socket_buffer.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
 #include <string.h>
 
 namespace net
 {
+
+using socket_buffer_header_t = socket_buffer_t::socket_buffer_header_t;
+
+/// bytes of free blocks kept by a thread for each size class
+static constexpr u64 max_cached_class_bytes = 1024 * 1024;
+
+/// data follows the header with the alignment of malloc
+static constexpr u64 header_size =
+    (sizeof(socket_buffer_header_t) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+struct socket_buffer_cache_t
+{
+    /// owner thread only
+    socket_buffer_header_t *local[buffer_size_class_count] = {};
+    u64 count[buffer_size_class_count] = {};
+    /// blocks freed by other threads, linked by 'next'. 'closed_stack' after the owner thread exits
+    std::atomic<socket_buffer_header_t *> remote{nullptr};
+};
+
+static socket_buffer_header_t *const closed_stack = reinterpret_cast<socket_buffer_header_t *>(1);
+
+thread_local socket_buffer_pool_stat_t buffer_pool_stat = {};
+thread_local socket_buffer_cache_t *thread_buffer_cache = nullptr;
+thread_local bool thread_buffer_cache_closed = false;
+
+static u64 class_size(u32 size_class) { return min_pooled_buffer_size << size_class; }
+
+static u32 size_class_of(u64 size)
+{
+    u32 size_class = 0;
+    while (size_class < buffer_size_class_count && class_size(size_class) < size)
+        size_class++;
+    return size_class;
+}
+
+static byte *data_of(socket_buffer_header_t *header) { return (byte *)header + header_size; }
+
+static socket_buffer_header_t *header_of(void *ptr) { return (socket_buffer_header_t *)((byte *)ptr - header_size); }
+
+static void free_blocks(socket_buffer_header_t *header)
+{
+    while (header)
+    {
+        auto next = header->next.load(std::memory_order_relaxed);
+        std::free(header);
+        header = next;
+    }
+}
+
+/// release cached blocks when thread exits.
+/// Blocks of the thread may be still held by other threads, the cache is never freed, they are freed by the releasing
+/// thread after the stack is closed.
+struct socket_buffer_cache_cleaner_t
+{
+    ~socket_buffer_cache_cleaner_t()
+    {
+        auto cache = thread_buffer_cache;
+        thread_buffer_cache = nullptr;
+        thread_buffer_cache_closed = true;
+        if (cache == nullptr)
+            return;
+        for (u32 i = 0; i < buffer_size_class_count; i++)
+            free_blocks(cache->local[i]);
+        free_blocks(cache->remote.exchange(closed_stack, std::memory_order_acquire));
+        buffer_pool_stat.cached_bytes = 0;
+    }
+};
+
+static socket_buffer_cache_t *get_buffer_cache()
+{
+    if (thread_buffer_cache == nullptr && !thread_buffer_cache_closed)
+    {
+        thread_local socket_buffer_cache_cleaner_t cleaner;
+        (void)cleaner;
+        thread_buffer_cache = new socket_buffer_cache_t();
+    }
+    return thread_buffer_cache;
+}
+
+static void cache_block(socket_buffer_cache_t *cache, socket_buffer_header_t *header)
+{
+    auto size_class = header->size_class;
+    auto size = class_size(size_class);
+    if (cache->count[size_class] * size >= max_cached_class_bytes)
+    {
+        std::free(header);
+        return;
+    }
+    header->next.store(cache->local[size_class], std::memory_order_relaxed);
+    cache->local[size_class] = header;
+    cache->count[size_class]++;
+    buffer_pool_stat.cached_bytes += size;
+}
+
+/// take back all blocks freed by other threads
+static void take_remote_blocks(socket_buffer_cache_t *cache)
+{
+    auto header = cache->remote.exchange(nullptr, std::memory_order_acquire);
+    while (header)
+    {
+        auto next = header->next.load(std::memory_order_relaxed);
+        buffer_pool_stat.remote_frees++;
+        cache_block(cache, header);
+        header = next;
+    }
+}
+
+static socket_buffer_header_t *allocate_block(u64 size)
+{
+    buffer_pool_stat.allocations++;
+    auto size_class = size_class_of(size);
+    socket_buffer_cache_t *cache = nullptr;
+    if (size_class < buffer_size_class_count)
+        cache = get_buffer_cache();
+
+    socket_buffer_header_t *header = nullptr;
+    if (cache)
+    {
+        if (cache->local[size_class] == nullptr && cache->remote.load(std::memory_order_relaxed) != nullptr)
+            take_remote_blocks(cache);
+        header = cache->local[size_class];
+        if (header)
+        {
+            cache->local[size_class] = header->next.load(std::memory_order_relaxed);
+            cache->count[size_class]--;
+            buffer_pool_stat.cached_bytes -= class_size(size_class);
+            buffer_pool_stat.reused++;
+        }
+    }
+    if (header == nullptr)
+    {
+        auto mem = std::malloc(header_size + (cache ? class_size(size_class) : size));
+        if (mem == nullptr)
+            throw std::bad_alloc();
+        buffer_pool_stat.heap_allocations++;
+        header = new (mem) socket_buffer_header_t();
+        header->size_class = cache ? size_class : buffer_size_class_count;
+        header->cache = cache;
+    }
+    header->ref_count.store(1, std::memory_order_relaxed);
+    return header;
+}
+
+static void free_block(socket_buffer_header_t *header)
+{
+    auto cache = header->cache;
+    if (cache == nullptr)
+    {
+        std::free(header);
+        return;
+    }
+    if (cache == thread_buffer_cache)
+    {
+        cache_block(cache, header);
+        return;
+    }
+    auto head = cache->remote.load(std::memory_order_relaxed);
+    do
+    {
+        if (head == closed_stack)
+        {
+            std::free(header);
+            return;
+        }
+        header->next.store(head, std::memory_order_relaxed);
+    } while (!cache->remote.compare_exchange_weak(head, header, std::memory_order_release, std::memory_order_relaxed));
+}
+
+const socket_buffer_pool_stat_t &get_socket_buffer_pool_stat() { return buffer_pool_stat; }
+
+void *socket_buffer_pool_allocate(u64 size) { return data_of(allocate_block(size)); }
+
+void socket_buffer_pool_free(void *ptr)
+{
+    if (ptr)
+        free_block(header_of(ptr));
+}
+
 socket_buffer_t::except_buffer_helper_t socket_buffer_t::except_buffer_helper_t::length(u64 len)
 {
     buf->valid_data_length = len;
@@ -27,13 +210,12 @@ socket_buffer_t::socket_buffer_t()
 }
 
 socket_buffer_t::socket_buffer_t(u64 len)
-    : ptr(new byte[len])
-    , header(new socket_buffer_header_t())
+    : header(allocate_block(len))
     , buffer_size(len)
     , valid_data_length(0)
     , walk_offset(0)
 {
-    header->ref_count = 1;
+    ptr = data_of(header);
 }
 
 socket_buffer_t socket_buffer_t::from_struct_inner(byte *buffer_ptr, u64 buffer_length)
@@ -74,13 +256,14 @@ socket_buffer_t &socket_buffer_t::operator=(const socket_buffer_t &rh)
     if (&rh == this)
         return *this;
 
+    if (rh.header)
+        rh.header->ref_count++;
+    release();
     this->ptr = rh.ptr;
     this->valid_data_length = rh.valid_data_length;
     this->buffer_size = rh.buffer_size;
     this->walk_offset = rh.walk_offset;
     this->header = rh.header;
-    if (this->header)
-        this->header->ref_count++;
     return *this;
 }
 
@@ -99,11 +282,12 @@ socket_buffer_t::socket_buffer_t(socket_buffer_t &&buffer)
     buffer.walk_offset = 0;
 }
 
-socket_buffer_t &socket_buffer_t::operator()(socket_buffer_t &&buffer)
+socket_buffer_t &socket_buffer_t::operator=(socket_buffer_t &&buffer)
 {
-    if (this->ptr)
-        delete[] ptr;
+    if (&buffer == this)
+        return *this;
 
+    release();
     this->ptr = buffer.ptr;
     this->valid_data_length = buffer.valid_data_length;
     this->buffer_size = buffer.buffer_size;
@@ -119,15 +303,18 @@ socket_buffer_t &socket_buffer_t::operator()(socket_buffer_t &&buffer)
     return *this;
 }
 
-socket_buffer_t::~socket_buffer_t()
+socket_buffer_t &socket_buffer_t::operator()(socket_buffer_t &&buffer) { return *this = std::move(buffer); }
+
+void socket_buffer_t::release()
 {
     if (ptr && header && --header->ref_count == 0)
-    {
-        delete[] ptr;
-        delete header;
-    }
+        free_block(header);
+    ptr = nullptr;
+    header = nullptr;
 }
 
+socket_buffer_t::~socket_buffer_t() { release(); }
+
 long socket_buffer_t::write_string(const std::string &str)
 {
     auto len = str.size();
@@ -151,6 +338,18 @@ std::string socket_buffer_t::to_string() const
     return str;
 }
 
+socket_buffer_t socket_buffer_t::slice(u64 offset, u64 len) const
+{
+    socket_buffer_t buffer(*this);
+    offset = std::min(offset, get_length());
+    len = std::min(len, get_length() - offset);
+    buffer.ptr = get() + offset;
+    buffer.buffer_size = len;
+    buffer.valid_data_length = len;
+    buffer.walk_offset = 0;
+    return buffer;
+}
+
 void socket_buffer_t::clear()
 {
     if (ptr)
@@ -161,4 +360,64 @@ void socket_buffer_t::clear()
     }
 }
 
+socket_buffer_chain_t::socket_buffer_chain_t()
+    : count(0)
+{
+}
+
+socket_buffer_chain_t::socket_buffer_chain_t(std::initializer_list<socket_buffer_t> list)
+    : count(0)
+{
+    for (auto &slice : list)
+        append(slice);
+}
+
+void socket_buffer_chain_t::append(socket_buffer_t slice)
+{
+    if (count >= max_chain_slices)
+        throw std::length_error("too many slices in buffer chain");
+    slices[count++] = std::move(slice);
+}
+
+void socket_buffer_chain_t::prepend(socket_buffer_t slice)
+{
+    if (count >= max_chain_slices)
+        throw std::length_error("too many slices in buffer chain");
+    for (u64 i = count; i > 0; i--)
+        slices[i] = std::move(slices[i - 1]);
+    slices[0] = std::move(slice);
+    count++;
+}
+
+void socket_buffer_chain_t::reset()
+{
+    for (u64 i = 0; i < count; i++)
+        slices[i] = socket_buffer_t();
+    count = 0;
+}
+
+u64 socket_buffer_chain_t::get_length() const
+{
+    u64 len = 0;
+    for (u64 i = 0; i < count; i++)
+        len += slices[i].get_length();
+    return len;
+}
+
+void socket_buffer_chain_t::walk_step(u64 delta)
+{
+    for (u64 i = 0; i < count && delta > 0; i++)
+    {
+        auto step = std::min(delta, slices[i].get_length());
+        slices[i].walk_step(step);
+        delta -= step;
+    }
+}
+
+void socket_buffer_chain_t::finish_walk()
+{
+    for (u64 i = 0; i < count; i++)
+        slices[i].finish_walk();
+}
+
 } // namespace net
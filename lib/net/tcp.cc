@@ -5,6 +5,8 @@
 
 namespace net::tcp
 {
+/// maximum connections accepted by a listener per readiness event
+static constexpr int max_accept_per_event = 64;
 
 co::async_result_t<io_result> connection_t::awrite(co::paramter_t &param, socket_buffer_t &buffer)
 {
@@ -36,22 +38,23 @@ co::async_result_t<io_result> connection_t::aread_packet_content(co::paramter_t
     return socket_aread(param, socket, buffer);
 }
 
+/// send 'head' and the data of 'buffer' in one gather write, the head is serialized on stack
 template <typename E>
-co::async_result_t<io_result> set_head_and_send(co::paramter_t &param, E &head, u64 buf_size, socket_t *socket)
+co::async_result_t<io_result> set_head_and_send(co::paramter_t &param, E &head, socket_buffer_t &buffer,
+                                                socket_t *socket)
 {
-    int head_buffer_size = sizeof(E);
-    head.size = buf_size;
-    socket_buffer_t head_buffer(head_buffer_size);
+    head.size = buffer.get_length();
+    E wire_head;
+    auto head_buffer = socket_buffer_t::from_struct(wire_head);
 
     head_buffer.expect().origin_length();
     endian::save_to(head, head_buffer);
-    auto ret = socket_awrite(param, socket, head_buffer);
-    if (ret.is_finish())
+    socket_buffer_chain_t chain = {head_buffer, buffer};
+    auto ret = co::await_p(std::ref(param), socket_awritev, socket, chain);
+    if (ret == io_result::ok)
     {
-        if (ret() == io_result::ok)
-        {
-            return ret;
-        }
+        /// the payload is walked like 'socket_awrite'
+        buffer = chain.get_slice(1);
     }
     return ret;
 }
@@ -59,19 +62,7 @@ co::async_result_t<io_result> set_head_and_send(co::paramter_t &param, E &head,
 co::async_result_t<io_result> connection_t::awrite_packet(co::paramter_t &param, package_head_t &head,
                                                           socket_buffer_t &buffer)
 {
-    int head_buffer_size = sizeof(head);
-    head.size = buffer.get_length();
-    socket_buffer_t head_buffer(head_buffer_size);
-
-    head_buffer.expect().origin_length();
-    endian::save_to(head, head_buffer);
-    auto ret = co::await_p(std::ref(param), socket_awrite, socket, head_buffer);
-    if (ret != io_result::ok)
-    {
-        return ret;
-    }
-
-    return co::await_p(std::ref(param), socket_awrite, socket, buffer);
+    return set_head_and_send(param, head, buffer, socket);
 }
 
 co::async_result_t<io_result> conn_awrite(co::paramter_t &param, connection_t conn, socket_buffer_t &buffer)
@@ -101,6 +92,10 @@ co::async_result_t<io_result> conn_awrite_packet(co::paramter_t &param, connecti
 
 server_t::server_t()
     : server_socket(nullptr)
+    , context(nullptr)
+    , loop_handler_id(-1)
+    , sharded(false)
+    , failed_shards(0)
 {
 }
 
@@ -128,10 +123,108 @@ void server_t::wait_client()
         auto socket = co::await(accept_from, server_socket);
         socket->bind_context(*context);
         socket->run(std::bind(&server_t::client_main, this, socket));
-        socket->wake_up_thread();
     }
 }
 
+void server_t::wait_shard_client(socket_t *listener)
+{
+    /// accepted connections stay in the loop of listener unless it is overloaded
+    auto loop = listener->get_loop();
+    std::vector<socket_t *> sockets;
+    while (1)
+    {
+        sockets.clear();
+        co::await(accept_all_from, listener, sockets, max_accept_per_event);
+        for (auto socket : sockets)
+        {
+            socket->bind_context(*context, context->select_loop(*loop));
+            socket->run(std::bind(&server_t::client_main, this, socket));
+        }
+    }
+}
+
+void server_t::listen_at_loop(event_loop_t &loop)
+{
+    std::lock_guard<std::mutex> lock(shard_mutex);
+    if (!sharded)
+        return;
+    auto socket = new_tcp_socket();
+    reuse_port_socket(socket, true);
+    if (shard_reuse_addr)
+        reuse_addr_socket(socket, true);
+    try
+    {
+        listen_from(bind_at(socket, shard_address), shard_max_client);
+    } catch (net_connect_exception &e)
+    {
+        close_socket(socket);
+        if (std::this_thread::get_id() == shard_caller)
+            throw;
+        /// the loop starts later in its own thread, report it instead of breaking the loop thread
+        if (error_handler)
+            error_handler(*this, nullptr, shard_address, e.get_state());
+        else
+            failed_shards++;
+        return;
+    }
+    /// other listeners bind the same port if port 0 is given
+    if (shard_address.get_port() == 0)
+        shard_address = socket->local_addr();
+
+    if (server_socket == nullptr)
+        server_socket = socket;
+    shard_sockets.push_back(socket);
+    socket->pin_to_loop(true);
+    socket->bind_context(*context, loop);
+    socket->run(std::bind(&server_t::wait_shard_client, this, socket));
+}
+
+void server_t::listen_sharded(event_context_t &context, socket_addr_t address, int max_client, bool reuse_addr)
+{
+#ifdef OS_WINDOWS
+    listen(context, address, max_client, reuse_addr);
+#else
+    if (server_socket != nullptr)
+        return;
+    this->context = &context;
+    shard_address = address;
+    shard_max_client = max_client;
+    shard_reuse_addr = reuse_addr;
+    {
+        std::lock_guard<std::mutex> lock(shard_mutex);
+        sharded = true;
+        shard_caller = std::this_thread::get_id();
+    }
+    /// handlers of running loops are called in this thread
+    try
+    {
+        loop_handler_id =
+            context.add_loop_handler(std::bind(&server_t::listen_at_loop, this, std::placeholders::_1));
+    } catch (...)
+    {
+        std::lock_guard<std::mutex> lock(shard_mutex);
+        sharded = false;
+        shard_caller = std::thread::id();
+        for (auto socket : shard_sockets)
+        {
+            socket->unbind_context();
+            close_socket(socket);
+        }
+        shard_sockets.clear();
+        server_socket = nullptr;
+        throw;
+    }
+    std::lock_guard<std::mutex> lock(shard_mutex);
+    shard_caller = std::thread::id();
+#endif
+}
+
+u64 server_t::get_failed_shards()
+{
+    std::lock_guard<std::mutex> lock(shard_mutex);
+    return failed_shards;
+}
+
 void server_t::listen(event_context_t &context, socket_addr_t address, int max_client, bool reuse_addr)
 {
     if (server_socket != nullptr)
@@ -162,6 +255,21 @@ void server_t::exit_client(socket_t *client)
 
 void server_t::close_server()
 {
+    if (loop_handler_id >= 0)
+    {
+        context->remove_loop_handler(loop_handler_id);
+        std::lock_guard<std::mutex> lock(shard_mutex);
+        loop_handler_id = -1;
+        sharded = false;
+        for (auto socket : shard_sockets)
+        {
+            socket->unbind_context();
+            close_socket(socket);
+        }
+        shard_sockets.clear();
+        server_socket = nullptr;
+        return;
+    }
     if (!server_socket)
         return;
     server_socket->unbind_context();
@@ -233,7 +341,6 @@ void client_t::connect(event_context_t &context, socket_addr_t address, microsec
     connect_addr = address;
     socket->bind_context(context);
     socket->run(std::bind(&client_t::wait_server, this, address, timeout));
-    socket->wake_up_thread();
 }
 
 client_t &client_t::on_server_connect(handler_t handler)
@@ -537,6 +537,66 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 }
 
 
+//---------------------------------------------------------------------
+// user/upper level send gathered from several buffers, returns below
+// zero for error
+//---------------------------------------------------------------------
+int ikcp_sendv(ikcpcb *kcp, const char * const *buffers, const int *lens, int count)
+{
+	IKCPSEG *seg;
+	int len = 0, frg, i, k = 0, offset = 0;
+
+	assert(kcp->mss > 0);
+	for (i = 0; i < count; i++) {
+		if (lens[i] < 0) return -1;
+		len += lens[i];
+	}
+
+	// buffers are joined in streaming mode
+	if (kcp->stream != 0) {
+		for (i = 0; i < count; i++) {
+			int r = ikcp_send(kcp, buffers[i], lens[i]);
+			if (r < 0) return r;
+		}
+		return 0;
+	}
+
+	if (len <= (int)kcp->mss) frg = 1;
+	else frg = (len + kcp->mss - 1) / kcp->mss;
+
+	if (frg >= (int)IKCP_WND_RCV) return -2;
+
+	// fragment, copy across buffers
+	for (i = 0; i < frg; i++) {
+		int size = len > (int)kcp->mss ? (int)kcp->mss : len;
+		int copied = 0;
+		seg = ikcp_segment_new(kcp, size);
+		assert(seg);
+		if (seg == NULL) {
+			return -2;
+		}
+		while (copied < size) {
+			int n = lens[k] - offset;
+			if (n > size - copied) n = size - copied;
+			memcpy(seg->data + copied, buffers[k] + offset, n);
+			copied += n;
+			offset += n;
+			if (offset == lens[k]) {
+				k++;
+				offset = 0;
+			}
+		}
+		seg->len = size;
+		seg->frg = frg - i - 1;
+		iqueue_init(&seg->node);
+		iqueue_add_tail(&seg->node, &kcp->snd_queue);
+		kcp->nsnd_que++;
+		len -= size;
+	}
+
+	return 0;
+}
+
 //---------------------------------------------------------------------
 // parse ack
 //---------------------------------------------------------------------
@@ -1,63 +1,154 @@
 #include "net/thread_pool.hpp"
+#include "net/cpu.hpp"
 namespace net
 {
 
-void thread_pool_t::wrapper()
+/// worker of current thread, nullptr if the thread is not a worker
+thread_local thread_pool_t *current_pool = nullptr;
+thread_local u64 current_worker = 0;
+
+/// rounds of stealing before a worker sleeps
+static constexpr int steal_rounds = 2;
+
+bool thread_pool_t::take(u64 index, callable_t<void()> &task)
+{
+    {
+        auto &self = *workers[index];
+        lock::lock_guard g(self.lock);
+        if (!self.tasks.empty())
+        {
+            task = std::move(self.tasks.back());
+            self.tasks.pop_back();
+            pending--;
+            return true;
+        }
+    }
+    for (u64 i = 1; i < workers.size(); i++)
+    {
+        auto &victim = *workers[(index + i) % workers.size()];
+        lock::lock_guard g(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            pending--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool_t::wrapper(u64 index)
 {
-    while (!exit || !empty())
+    current_pool = this;
+    current_worker = index;
+    if (workers[index]->cpu >= 0)
+        bind_thread_to_cpu(workers[index]->cpu);
+
+    callable_t<void()> task;
+    while (1)
     {
-        std::function<void()> task;
-        counter++;
+        bool found = false;
+        for (int round = 0; round < steal_rounds && !found; round++)
+            found = take(index, task);
+        if (found)
         {
-            std::unique_lock<std::mutex> lock(mutex);
-            cond.wait(lock, [this]() { return !this->empty() || exit; });
-            if (exit && empty())
-                return;
-            task = std::move(tasks.front());
-            tasks.pop();
+            task();
+            task = nullptr;
+            continue;
         }
-        counter--;
-        task();
+        std::unique_lock<std::mutex> lock(mutex);
+        if (exit && pending == 0)
+            return;
+        sleeping++;
+        cond.wait(lock, [this]() { return pending > 0 || exit; });
+        sleeping--;
     }
 }
 
 thread_pool_t::thread_pool_t(int count)
-    : exit(false)
-    , counter(0)
+    : thread_pool_t(count, {})
+{
+}
+
+thread_pool_t::thread_pool_t(int count, const std::vector<int> &cpus)
+    : pending(0)
+    , sleeping(0)
+    , next_worker(0)
+    , exit(false)
 {
     for (auto i = 0; i < count; i++)
     {
-        std::thread thread(std::bind(&thread_pool_t::wrapper, this));
-        threads.emplace_back(std::move(thread));
+        workers.emplace_back(std::make_unique<worker_t>());
+        workers.back()->cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
     }
+    for (auto i = 0; i < count; i++)
+        workers[i]->thread = std::thread(&thread_pool_t::wrapper, this, (u64)i);
 }
 
 thread_pool_t::~thread_pool_t()
 {
-    exit = true;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        exit = true;
+    }
     cond.notify_all();
 
-    for (auto &i : threads)
+    for (auto &i : workers)
     {
-        i.join();
+        i->thread.join();
     }
 }
 
-void thread_pool_t::commit(std::function<void()> task)
+void thread_pool_t::push(callable_t<void()> task)
 {
-    if (exit) // don't push task
+    u64 index;
+    if (current_pool == this)
+        index = current_worker;
+    else
+        index = next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    auto &worker = *workers[index];
+    lock::lock_guard g(worker.lock);
+    worker.tasks.emplace_back(std::move(task));
+    pending++;
+}
+
+void thread_pool_t::commit(callable_t<void()> task)
+{
+    /// tasks can still commit tasks when pool is exiting, they are run by the worker at least
+    if ((exit && current_pool != this) || workers.empty()) // don't push task
         return;
+    push(std::move(task));
+    if (sleeping > 0)
     {
+        /// pairs with the check of sleeping workers, so the wake up is not lost
         std::unique_lock<std::mutex> lock(mutex);
-        tasks.emplace(task);
     }
     cond.notify_one();
 }
 
+void thread_pool_t::commit_bulk(std::vector<callable_t<void()>> tasks)
+{
+    if (exit || workers.empty())
+        return;
+    u64 index = next_worker.fetch_add(tasks.size(), std::memory_order_relaxed);
+    for (auto &task : tasks)
+    {
+        auto &worker = *workers[index++ % workers.size()];
+        lock::lock_guard g(worker.lock);
+        worker.tasks.emplace_back(std::move(task));
+        pending++;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+    }
+    cond.notify_all();
+}
+
 /// return idle thread count
-int thread_pool_t::get_idles() const { return counter; }
+int thread_pool_t::get_idles() const { return sleeping; }
 
-/// return true if there are no tasks in task queue and no threads are running tasks.
-bool thread_pool_t::empty() const { return tasks.empty(); }
+/// return true if there are no tasks in task queues.
+bool thread_pool_t::empty() const { return pending == 0; }
 
-} // namespace net
\ No newline at end of file
+} // namespace net
@@ -1,88 +1,329 @@
 #include "net/timer.hpp"
+#include <algorithm>
 #include <chrono>
+#include <ctime>
 #include <limits>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace net
 {
-timer_t make_timer(microsecond_t span, timer_callback_t callback)
+microsecond_t make_timepoint(microsecond_t span)
 {
     auto cur = get_current_time();
     if (std::numeric_limits<u64>::max() - span < cur) // overflow
-        return timer_t(std::numeric_limits<u64>::max(), callback);
+        return std::numeric_limits<u64>::max();
+    return span + cur;
+}
 
-    return timer_t(span + cur, callback);
+timer_t make_timer(microsecond_t span, timer_callback_t callback)
+{
+    return timer_t(make_timepoint(span), std::move(callback));
 }
 
 std::unique_ptr<time_manager_t> create_time_manager(microsecond_t precision)
 {
-    std::unique_ptr<time_manager_t> time_wheel = std::make_unique<time_manager_t>();
-    time_wheel->precision = precision;
+    return std::make_unique<time_manager_t>(precision);
+}
+
+static int first_bit(u64 bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+static void list_init(timer_link_t &list) { list.prev = list.next = &list; }
+
+static bool list_empty(const timer_link_t &list) { return list.next == &list; }
+
+static void list_push(timer_link_t &list, timer_link_t *node)
+{
+    node->next = &list;
+    node->prev = list.prev;
+    list.prev->next = node;
+    list.prev = node;
+}
 
-    return std::move(time_wheel);
+/// move all nodes of 'from' to empty list 'to'
+static void list_splice(timer_link_t &from, timer_link_t &to)
+{
+    if (list_empty(from))
+        return;
+    to.next = from.next;
+    to.prev = from.prev;
+    to.next->prev = &to;
+    to.prev->next = &to;
+    list_init(from);
 }
 
-void time_manager_t::tick()
+timer_node_t::timer_node_t()
+    : owner(nullptr)
+    , expire(0)
+    , level(time_manager_t::no_level)
+    , slot(0)
+    , pool_index(-1)
+    , generation(0)
 {
-    auto us = get_current_time();
-    while (!queue.empty())
+    prev = next = nullptr;
+}
+
+timer_node_t::~timer_node_t()
+{
+    if (owner)
+        owner->cancel(*this);
+}
+
+time_manager_t::time_manager_t(microsecond_t precision)
+    : precision(precision)
+    , current(get_current_time() / precision)
+    , count(0)
+{
+    for (auto &level : wheels)
+        for (auto &list : level)
+            list_init(list);
+    for (auto &level : bitmaps)
+        for (auto &bits : level)
+            bits = 0;
+    list_init(due);
+}
+
+time_manager_t::~time_manager_t()
+{
+    auto detach = [](timer_link_t &list) {
+        for (auto it = list.next; it != &list; it = it->next)
+            static_cast<timer_node_t *>(it)->owner = nullptr;
+    };
+    for (auto &level : wheels)
+        for (auto &list : level)
+            detach(list);
+    detach(due);
+}
+
+void time_manager_t::link(timer_node_t *node)
+{
+    u64 e = node->expire;
+    if (e <= current)
+    {
+        node->level = no_level;
+        list_push(due, node);
+        return;
+    }
+    u64 delta = e - current;
+    int level = 0;
+    while (level < wheel_levels - 1 && delta >= (1ull << (wheel_bits * (level + 1))))
+        level++;
+    if (delta >= (1ull << (wheel_bits * wheel_levels)))
     {
-        auto timers = queue.top();
-        if (timers->timepoint > us)
+        /// out of range, cascade it again at the last slot
+        e = current + (1ull << (wheel_bits * wheel_levels)) - 1;
+    }
+    u16 slot = (e >> (wheel_bits * level)) & wheel_mask;
+    node->level = level;
+    node->slot = slot;
+    list_push(wheels[level][slot], node);
+    bitmaps[level][slot / 64] |= 1ull << (slot % 64);
+}
+
+void time_manager_t::unlink(timer_node_t *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+    if (node->level != no_level && list_empty(wheels[node->level][node->slot]))
+        bitmaps[node->level][node->slot / 64] &= ~(1ull << (node->slot % 64));
+    node->owner = nullptr;
+    count--;
+}
+
+int time_manager_t::find_slot(int level, int from, int to) const
+{
+    while (from <= to)
+    {
+        u64 bits = bitmaps[level][from / 64] >> (from % 64);
+        if (bits != 0)
         {
+            int slot = from + first_bit(bits);
+            return slot <= to ? slot : -1;
+        }
+        from = (from / 64 + 1) * 64;
+    }
+    return -1;
+}
+
+void time_manager_t::cascade()
+{
+    for (int level = 1; level < wheel_levels; level++)
+    {
+        u16 slot = (current >> (wheel_bits * level)) & wheel_mask;
+        timer_link_t list;
+        list_init(list);
+        list_splice(wheels[level][slot], list);
+        bitmaps[level][slot / 64] &= ~(1ull << (slot % 64));
+        while (!list_empty(list))
+        {
+            auto node = static_cast<timer_node_t *>(list.next);
+            list.next = node->next;
+            node->next->prev = &list;
+            link(node);
+        }
+        if (slot != 0)
             break;
+    }
+}
+
+void time_manager_t::fire(timer_link_t &list, microsecond_t now)
+{
+    timer_link_t firing;
+    list_init(firing);
+    list_splice(list, firing);
+    while (!list_empty(firing))
+    {
+        auto node = static_cast<timer_node_t *>(firing.next);
+        unlink(node);
+        auto callback = std::move(node->callback);
+        lag.record(now > node->timepoint ? now - node->timepoint : 0);
+        /// registration is invalid before callback, it can't cancel itself
+        if (node->pool_index >= 0)
+            release(node);
+        callback();
+    }
+}
+
+void time_manager_t::tick() { tick(get_current_time()); }
+
+void time_manager_t::tick(microsecond_t now)
+{
+    u64 now_tick = now / precision;
+    while (true)
+    {
+        if (!list_empty(due))
+            fire(due, now);
+        if (current >= now_tick)
+            break;
+        u64 base = current & ~wheel_mask;
+        u64 boundary = base + wheel_size;
+        int last = now_tick < boundary ? (int)(now_tick & wheel_mask) : wheel_size - 1;
+        int slot = find_slot(0, (int)(current & wheel_mask) + 1, last);
+        if (slot >= 0)
+            current = base + slot;
+        else if (now_tick < boundary)
+        {
+            /// nothing to fire before now
+            current = now_tick;
+            continue;
         }
-        queue.pop();
-        for (auto &i : timers->callbacks)
+        else
         {
-            if (i.second)
-            {
-                i.first();
-            }
+            /// skip empty rotations
+            current = std::min(now_tick, std::max(boundary, next_tick()));
+            if ((current & wheel_mask) == 0)
+                cascade();
         }
-        map.erase(timers->timepoint);
-        delete timers;
+        auto &list = wheels[0][current & wheel_mask];
+        if (!list_empty(list))
+            fire(list, now);
     }
 }
 
 timer_registered_t time_manager_t::insert(timer_t timer)
 {
-    if (std::numeric_limits<u64>::max() - timer.timepoint < precision - 1) // overflow
+    u32 index;
+    if (!free_pool.empty())
     {
+        index = free_pool.back();
+        free_pool.pop_back();
     }
     else
     {
-        timer.timepoint = (timer.timepoint + precision - 1) / precision * precision; // alignment percistion
+        index = (u32)pool.size();
+        pool.emplace_back(std::make_unique<timer_node_t>());
+        pool.back()->pool_index = index;
     }
+    auto node = pool[index].get();
+    node->timepoint = timer.timepoint;
+    node->callback = std::move(timer.callback);
+    insert(*node);
+    return {(timer_id)(((u64)node->generation << 32) | index), node->timepoint};
+}
 
-    auto it = map.find(timer.timepoint);
-    if (it == map.end())
-    {
-        it = map.emplace(timer.timepoint, new timer_slot_t(timer.timepoint)).first;
-        queue.push(it->second);
-    }
+void time_manager_t::cancel(timer_registered_t reg)
+{
+    if (reg.id < 0)
+        return;
+    u32 index = (u64)reg.id & 0xFFFFFFFF;
+    u32 generation = (u64)reg.id >> 32;
+    if (index >= pool.size())
+        return;
+    auto node = pool[index].get();
+    if (node->generation != generation || !node->is_linked())
+        return;
+    unlink(node);
+    release(node);
+}
 
-    it->second->callbacks.emplace_back(timer.callback, true);
-    return {(timer_id)it->second->callbacks.size(), timer.timepoint};
+void time_manager_t::release(timer_node_t *node)
+{
+    node->callback = nullptr;
+    node->generation = (node->generation + 1) & 0x7FFFFFFF;
+    free_pool.push_back(node->pool_index);
 }
 
-void time_manager_t::cancel(timer_registered_t reg)
+void time_manager_t::insert(timer_node_t &node)
 {
-    auto it = map.find(reg.timepoint);
-    if (it != map.end())
-    {
-        it->second->callbacks[reg.id - 1].second = false;
-    }
+    if (node.owner)
+        node.owner->cancel(node);
+    /// alignment precision
+    node.expire = node.timepoint / precision + (node.timepoint % precision != 0);
+    node.owner = this;
+    count++;
+    link(&node);
 }
 
-microsecond_t time_manager_t::next_tick_timepoint()
+void time_manager_t::cancel(timer_node_t &node)
 {
-    if (!queue.empty())
+    if (node.owner != this)
+        return;
+    unlink(&node);
+}
+
+u64 time_manager_t::next_tick() const
+{
+    u64 next = std::numeric_limits<u64>::max();
+    for (int level = 0; level < wheel_levels; level++)
     {
-        auto timer = queue.top();
-        return timer->timepoint;
+        int shift = wheel_bits * level;
+        u64 cur = current >> shift;
+        int pos = cur & wheel_mask;
+        u64 tick;
+        int slot = find_slot(level, pos + 1, wheel_size - 1);
+        if (slot >= 0)
+            tick = (cur - pos + slot) << shift;
+        else if ((slot = find_slot(level, 0, pos)) >= 0)
+            tick = (cur - pos + slot + wheel_size) << shift;
+        else
+            continue;
+        if (tick < next)
+            next = tick;
     }
+    return next;
+}
 
-    return 0xFFFFFFFFFFFFFFFFLLU;
+microsecond_t time_manager_t::next_tick_timepoint()
+{
+    if (!list_empty(due))
+        return 0;
+    if (count == 0)
+        return 0xFFFFFFFFFFFFFFFFLLU;
+    u64 next = next_tick();
+    if (next > std::numeric_limits<u64>::max() / precision)
+        return 0xFFFFFFFFFFFFFFFFLLU;
+    return next * precision;
 }
 
 microsecond_t get_timestamp()
@@ -92,15 +333,29 @@ microsecond_t get_timestamp()
         .count();
 }
 
+/// cached time of event loop in current thread
+thread_local const microsecond_t *thread_clock = nullptr;
+
+void bind_thread_clock(const microsecond_t *clock) { thread_clock = clock; }
+
 microsecond_t get_current_time()
+{
+    if (thread_clock)
+        return *thread_clock;
+    return get_precise_time();
+}
+
+microsecond_t get_precise_time()
 {
 #ifndef OS_WINDOWS
-    struct timeval timeval;
-    gettimeofday(&timeval, nullptr);
-    return timeval.tv_usec + (microsecond_t)timeval.tv_sec * 1000000;
+    /// vDSO, reads TSC without syscall when it is the clocksource
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (microsecond_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 #else
-    return get_timestamp();
-
+    return std::chrono::time_point_cast<std::chrono::microseconds>(std::chrono::steady_clock::now())
+        .time_since_epoch()
+        .count();
 #endif
 }
 
@@ -19,7 +19,6 @@ void server_t::run(std::function<void()> func)
         func();
         close();
     });
-    socket->wake_up_thread();
 }
 
 server_t::~server_t() { close(); }
@@ -55,7 +54,6 @@ void client_t::run(std::function<void()> func)
         func();
         close();
     });
-    socket->wake_up_thread();
 }
 
 socket_addr_t client_t::get_address() const { return connect_addr; }
@@ -0,0 +1,610 @@
+#include "net/uring.hpp"
+#include "net/execute_context.hpp"
+#include "net/net_exception.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#ifndef OS_WINDOWS
+namespace net
+{
+/// io_uring depth of each loop
+constexpr u32 ring_entries = 1024;
+/// registered buffers of each loop
+constexpr u32 ring_buffer_count = 128;
+constexpr u32 ring_buffer_size = 16384;
+/// registered file slots of each loop
+constexpr u32 ring_max_files = 4096;
+/// free operations kept by each loop
+constexpr u32 ring_free_ops = 1024;
+
+static int uring_setup(u32 entries, io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, u32 to_submit, u32 min_complete, u32 flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_register(int fd, u32 opcode, void *arg, u32 nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+uring_op_t::uring_op_t()
+    : state(pending)
+    , res(0)
+    , ring(nullptr)
+    , waiter(nullptr)
+    , buffer_index(-1)
+    , buffer(nullptr)
+    , buffer_size(0)
+    , addr_len(sizeof(addr))
+{
+    type = uring_request_type::io;
+    prev = next = nullptr;
+    memset(&iov, 0, sizeof(iov));
+    memset(&msg, 0, sizeof(msg));
+    memset(&addr, 0, sizeof(addr));
+}
+
+uring_op_t::~uring_op_t()
+{
+    if (waiter)
+        waiter->detach();
+    if (buffer_index >= 0)
+    {
+        if (ring)
+            ring->release_buffer(buffer_index);
+    }
+    else
+    {
+        delete[] buffer;
+    }
+}
+
+event_uring_demultiplexer::event_uring_demultiplexer()
+    : sq_pending(0)
+    , buffers(nullptr)
+    , buffer_size(ring_buffer_size)
+    , buffer_count(ring_buffer_count)
+    , buffer_registered(false)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = uring_setup(ring_entries, &params);
+    if (ring_fd < 0)
+    {
+        throw net_param_exception("io_uring setup failed!");
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        close(ring_fd);
+        throw net_param_exception("io_uring without timeout wait is not supported!");
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_size = cq_size = std::max(sq_size, cq_size);
+
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    cq_ptr = single_mmap ? sq_ptr
+                         : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                                IORING_OFF_CQ_RING);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                                IORING_OFF_SQES);
+    if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        close(ring_fd);
+        throw net_param_exception("io_uring mmap failed!");
+    }
+
+    byte *sq = (byte *)sq_ptr;
+    sq_head = (u32 *)(sq + params.sq_off.head);
+    sq_tail = (u32 *)(sq + params.sq_off.tail);
+    sq_mask = *(u32 *)(sq + params.sq_off.ring_mask);
+    sq_entries = *(u32 *)(sq + params.sq_off.ring_entries);
+    sq_array = (u32 *)(sq + params.sq_off.array);
+
+    byte *cq = (byte *)cq_ptr;
+    cq_head = (u32 *)(cq + params.cq_off.head);
+    cq_tail = (u32 *)(cq + params.cq_off.tail);
+    cq_mask = *(u32 *)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    inflight.type = uring_request_type::io;
+    inflight.prev = inflight.next = &inflight;
+
+    /// registered buffers. Fallback to normal buffers when memlock limit is too small
+    buffers = (byte *)mmap(nullptr, (u64)buffer_size * buffer_count, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED)
+    {
+        buffers = nullptr;
+        buffer_count = 0;
+    }
+    std::vector<iovec> iovs(buffer_count);
+    for (u32 i = 0; i < buffer_count; i++)
+    {
+        iovs[i].iov_base = get_buffer(i);
+        iovs[i].iov_len = buffer_size;
+        free_buffers.push_back(buffer_count - i - 1);
+    }
+    if (buffer_count > 0)
+        buffer_registered = uring_register(ring_fd, IORING_REGISTER_BUFFERS, iovs.data(), buffer_count) == 0;
+
+    /// sparse fixed file table
+    rlimit limit;
+    u32 file_count = ring_max_files;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < file_count)
+        file_count = limit.rlim_cur;
+    std::vector<int> fds(file_count, -1);
+    if (uring_register(ring_fd, IORING_REGISTER_FILES, fds.data(), file_count) == 0)
+    {
+        for (u32 i = 0; i < file_count; i++)
+            free_files.push_back(file_count - i - 1);
+    }
+
+    wake_request.type = uring_request_type::wake_up;
+    ev_fd = eventfd(1, 0);
+    lock::lock_guard g(sq_lock);
+    arm_wake_up();
+}
+
+event_uring_demultiplexer::~event_uring_demultiplexer()
+{
+    /// owners of the operations are notified by ring == nullptr
+    for (auto req = inflight.next; req != &inflight;)
+    {
+        auto op = static_cast<uring_op_t *>(req);
+        req = req->next;
+        if (op->buffer_index >= 0)
+        {
+            /// memory of registered buffers is unmapped with the ring
+            op->buffer_index = -1;
+            op->buffer = nullptr;
+        }
+        op->ring = nullptr;
+        if (op->state == uring_op_t::orphan)
+            delete op;
+    }
+    for (auto &it : polls)
+        delete it.second;
+    for (auto op : free_ops)
+        delete op;
+
+    close(ring_fd);
+    munmap(sqes, sqes_size);
+    if (cq_ptr != sq_ptr)
+        munmap(cq_ptr, cq_size);
+    munmap(sq_ptr, sq_size);
+    if (buffers)
+        munmap(buffers, (u64)buffer_size * buffer_count);
+    close(ev_fd);
+}
+
+io_uring_sqe *event_uring_demultiplexer::get_sqe()
+{
+    u32 tail = *sq_tail;
+    u32 head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= sq_entries)
+    {
+        /// queue is full
+        flush();
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= sq_entries)
+            throw net_io_exception("io_uring submission queue is full");
+    }
+    u32 index = tail & sq_mask;
+    auto sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    return sqe;
+}
+
+void event_uring_demultiplexer::push_sqe()
+{
+    __atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+    sq_pending++;
+}
+
+void event_uring_demultiplexer::flush()
+{
+    if (sq_pending == 0)
+        return;
+    int ret = uring_enter(ring_fd, sq_pending, 0, 0, nullptr, 0);
+    if (ret > 0)
+        sq_pending -= std::min((u32)ret, sq_pending);
+}
+
+void event_uring_demultiplexer::submit_and_wait(microsecond_t *timeout)
+{
+    u32 to_submit;
+    {
+        lock::lock_guard g(sq_lock);
+        to_submit = sq_pending;
+    }
+    __kernel_timespec ts;
+    ts.tv_sec = *timeout / 1000000;
+    ts.tv_nsec = (*timeout % 1000000) * 1000;
+
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (u64)&ts;
+
+    int ret = uring_enter(ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (ret == -1 && errno == ETIME)
+        *timeout = 0;
+    if (ret > 0)
+    {
+        /// sqes which are not consumed by kernel are submitted next time
+        lock::lock_guard g(sq_lock);
+        sq_pending -= std::min((u32)ret, sq_pending);
+    }
+}
+
+void event_uring_demultiplexer::arm_wake_up()
+{
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = ev_fd;
+    sqe->addr = (u64)&ev_value;
+    sqe->len = sizeof(ev_value);
+    sqe->user_data = (u64)&wake_request;
+    push_sqe();
+}
+
+void event_uring_demultiplexer::arm_poll(uring_poll_t *poll)
+{
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = poll->handle;
+    sqe->poll32_events = poll->mask;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (u64)poll;
+    push_sqe();
+}
+
+int event_uring_demultiplexer::complete(io_uring_cqe *cqe, ready_event_t *event)
+{
+    auto req = (uring_request_t *)cqe->user_data;
+    if (req == nullptr) // result of cancel
+        return 0;
+
+    if (req->type == uring_request_type::io)
+    {
+        auto op = static_cast<uring_op_t *>(req);
+        op->prev->next = op->next;
+        op->next->prev = op->prev;
+        op->prev = op->next = nullptr;
+        op->res = cqe->res;
+        auto waiter = op->waiter;
+        if (op->state.exchange(uring_op_t::done) == uring_op_t::orphan)
+            release_op(op);
+        else if (waiter)
+            waiter->fire();
+        return 0;
+    }
+
+    lock::lock_guard g(sq_lock);
+    if (req->type == uring_request_type::wake_up)
+    {
+        arm_wake_up();
+        return 0;
+    }
+
+    auto poll = static_cast<uring_poll_t *>(req);
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        if (poll->removed)
+        {
+            delete poll;
+            return 0;
+        }
+        if (cqe->res < 0)
+        {
+            auto it = polls.find(poll->handle);
+            if (it != polls.end() && it->second == poll)
+                polls.erase(it);
+            delete poll;
+            return 0;
+        }
+        /// multishot poll is terminated by kernel
+        arm_poll(poll);
+    }
+    if (cqe->res <= 0 || poll->removed)
+        return 0;
+
+    event_type_t type = 0;
+    if (cqe->res & POLLIN)
+        type |= event_type::readable;
+    if (cqe->res & POLLOUT)
+        type |= event_type::writable;
+    if (cqe->res & (POLLERR | POLLHUP))
+        type |= event_type::error;
+    event->handle = poll->handle;
+    event->type = type;
+    return type != 0;
+}
+
+static u32 to_poll_mask(event_type_t type)
+{
+    u32 mask = 0;
+    if (type & event_type::readable)
+        mask |= POLLIN;
+    if (type & event_type::writable)
+        mask |= POLLOUT;
+    if (type & event_type::error)
+        mask |= POLLERR;
+    return mask;
+}
+
+void event_uring_demultiplexer::set_poll(handle_t handle, u32 mask)
+{
+    auto it = polls.find(handle);
+    if (it != polls.end())
+    {
+        auto old = it->second;
+        polls.erase(it);
+        old->removed = true;
+
+        auto sqe = get_sqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = (u64)old;
+        sqe->user_data = 0;
+        push_sqe();
+    }
+    if (mask == 0)
+        return;
+
+    auto poll = new uring_poll_t();
+    poll->type = uring_request_type::poll;
+    poll->prev = poll->next = nullptr;
+    poll->handle = handle;
+    poll->mask = mask;
+    poll->removed = false;
+    polls[handle] = poll;
+    arm_poll(poll);
+}
+
+void event_uring_demultiplexer::add(handle_t handle, event_type_t type)
+{
+    lock::lock_guard g(sq_lock);
+    u32 mask = to_poll_mask(type);
+    auto it = polls.find(handle);
+    if (it != polls.end())
+    {
+        if ((it->second->mask | mask) == it->second->mask)
+            return;
+        mask |= it->second->mask;
+    }
+    set_poll(handle, mask);
+    /// loop may be sleeping in other thread
+    flush();
+}
+
+int event_uring_demultiplexer::select(ready_event_t *events, int max_events, microsecond_t *timeout)
+{
+    submit_and_wait(timeout);
+
+    u32 head = *cq_head;
+    u32 tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    int count = 0;
+    while (head != tail)
+    {
+        auto cqe = &cqes[head & cq_mask];
+        auto req = (uring_request_t *)cqe->user_data;
+        if (req && req->type == uring_request_type::poll && count >= max_events)
+            break;
+        if (req == &wake_request)
+            *timeout = 0;
+        count += complete(cqe, events + count);
+        head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+void event_uring_demultiplexer::remove(handle_t handle, event_type_t type)
+{
+    lock::lock_guard g(sq_lock);
+    auto it = polls.find(handle);
+    if (it == polls.end())
+        return;
+    u32 mask = it->second->mask & ~to_poll_mask(type);
+    /// error is only waited with readable or writable, poll is removed when neither is left
+    if ((mask & (POLLIN | POLLOUT)) == 0)
+        mask = 0;
+    if (mask == it->second->mask)
+        return;
+    set_poll(handle, mask);
+    flush();
+}
+
+void event_uring_demultiplexer::wake_up(event_loop_t &) { eventfd_write(ev_fd, 1); }
+
+void event_uring_demultiplexer::submit_op(uring_op_t *op, handle_t handle)
+{
+    lock::lock_guard g(sq_lock);
+    auto sqe = get_sqe();
+    sqe->fd = handle;
+    int slot = find_file(handle);
+    if (slot >= 0)
+    {
+        sqe->fd = slot;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    bool fixed_buffer = buffer_registered && op->buffer_index >= 0;
+
+    switch (op->io_type)
+    {
+        case uring_io_type::read:
+            sqe->opcode = fixed_buffer ? IORING_OP_READ_FIXED : IORING_OP_RECV;
+            sqe->addr = (u64)op->iov.iov_base;
+            sqe->len = op->iov.iov_len;
+            if (fixed_buffer)
+                sqe->buf_index = op->buffer_index;
+            break;
+        case uring_io_type::write:
+            sqe->opcode = fixed_buffer ? IORING_OP_WRITE_FIXED : IORING_OP_SEND;
+            sqe->addr = (u64)op->iov.iov_base;
+            sqe->len = op->iov.iov_len;
+            if (fixed_buffer)
+                sqe->buf_index = op->buffer_index;
+            else
+                sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+        case uring_io_type::read_from:
+            op->msg.msg_name = &op->addr;
+            op->msg.msg_namelen = sizeof(op->addr);
+            op->msg.msg_iov = &op->iov;
+            op->msg.msg_iovlen = 1;
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->addr = (u64)&op->msg;
+            sqe->len = 1;
+            break;
+        case uring_io_type::write_to:
+            op->msg.msg_name = &op->addr;
+            op->msg.msg_namelen = sizeof(op->addr);
+            op->msg.msg_iov = &op->iov;
+            op->msg.msg_iovlen = 1;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->addr = (u64)&op->msg;
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+        case uring_io_type::accept:
+            op->addr_len = sizeof(op->addr);
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->addr = (u64)&op->addr;
+            sqe->addr2 = (u64)&op->addr_len;
+            sqe->accept_flags = SOCK_NONBLOCK;
+            break;
+    }
+    sqe->user_data = (u64)op;
+    op->ring = this;
+    op->next = &inflight;
+    op->prev = inflight.prev;
+    inflight.prev->next = op;
+    inflight.prev = op;
+    push_sqe();
+    /// submitted in next select
+}
+
+void event_uring_demultiplexer::cancel_op(uring_op_t *op)
+{
+    lock::lock_guard g(sq_lock);
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (u64)op;
+    sqe->user_data = 0;
+    push_sqe();
+    flush();
+}
+
+uring_op_t *event_uring_demultiplexer::acquire_op()
+{
+    {
+        lock::lock_guard g(op_lock);
+        if (!free_ops.empty())
+        {
+            auto op = free_ops.back();
+            free_ops.pop_back();
+            return op;
+        }
+    }
+    return new uring_op_t();
+}
+
+void event_uring_demultiplexer::release_op(uring_op_t *op)
+{
+    /// buffer is given back and waiter is detached by destructor
+    op->~uring_op_t();
+    new (op) uring_op_t();
+    {
+        lock::lock_guard g(op_lock);
+        if (free_ops.size() < ring_free_ops)
+        {
+            free_ops.push_back(op);
+            return;
+        }
+    }
+    delete op;
+}
+
+int event_uring_demultiplexer::acquire_buffer()
+{
+    lock::lock_guard g(buffer_lock);
+    if (free_buffers.empty())
+        return -1;
+    int index = free_buffers.back();
+    free_buffers.pop_back();
+    return index;
+}
+
+void event_uring_demultiplexer::release_buffer(int index)
+{
+    lock::lock_guard g(buffer_lock);
+    free_buffers.push_back(index);
+}
+
+int event_uring_demultiplexer::register_file(handle_t handle)
+{
+    lock::lock_guard g(file_lock);
+    auto it = files.find(handle);
+    if (it != files.end())
+        return it->second;
+    if (free_files.empty())
+        return -1;
+    int slot = free_files.back();
+    int fd = handle;
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = (u64)&fd;
+    if (uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1)
+        return -1;
+    free_files.pop_back();
+    files[handle] = slot;
+    return slot;
+}
+
+void event_uring_demultiplexer::unregister_file(handle_t handle)
+{
+    lock::lock_guard g(file_lock);
+    auto it = files.find(handle);
+    if (it == files.end())
+        return;
+    int fd = -1;
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = it->second;
+    update.fds = (u64)&fd;
+    uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+    free_files.push_back(it->second);
+    files.erase(it);
+}
+
+int event_uring_demultiplexer::find_file(handle_t handle)
+{
+    lock::lock_guard g(file_lock);
+    auto it = files.find(handle);
+    if (it == files.end())
+        return -1;
+    return it->second;
+}
+
+} // namespace net
+
+#endif
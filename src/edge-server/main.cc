@@ -5,7 +5,6 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <optional>
-#include <thread>
 
 DEFINE_string(ip, "0.0.0.0", "edge server ip address");
 DEFINE_uint32(port, 2769, "edge server bind port");
@@ -18,8 +17,6 @@ DEFINE_uint32(timeout, 5000, "tracker server connect timeout (ms)");
 
 net::event_context_t *app_context;
 
-void thread_main() { app_context->run(); }
-
 static void atexit_func() { google::ShutdownGoogleLogging(); }
 
 void server_connect_error(net::p2p::tracker_node_client_t &client, net::socket_addr_t remote,
@@ -176,17 +173,9 @@ int main(int argc, char **argv)
     net::event_context_t context(net::event_strategy::AUTO);
     app_context = &context;
 
-    if (FLAGS_threads == 0)
-    {
-        FLAGS_threads = 4;
-    }
-    LOG(INFO) << "thread detect " << FLAGS_threads;
-
-    for (int i = 0; i < FLAGS_threads - 1; i++)
-    {
-        std::thread thd(thread_main);
-        thd.detach();
-    }
+    /// loops are bound to cpus, the main thread runs a loop too
+    int threads = context.start_loops(FLAGS_threads == 0 ? 0 : FLAGS_threads - 1) + 1;
+    LOG(INFO) << "thread detect " << threads;
 
     std::unique_ptr<net::p2p::tracker_node_client_t> tracker_client =
         std::make_unique<net::p2p::tracker_node_client_t>();
@@ -2,7 +2,6 @@
 #include "net/p2p/tracker.hpp"
 #include <gflags/gflags.h>
 #include <glog/logging.h>
-#include <thread>
 
 DEFINE_string(ip, "0.0.0.0", "tracker server bind ip address");
 DEFINE_uint32(port, 2769, "tracker server port");
@@ -12,8 +11,6 @@ DEFINE_bool(reuse, true, "resuse address");
 
 net::event_context_t *app_context;
 
-void thread_main() { app_context->run(); }
-
 static void atexit_func()
 {
     LOG(INFO) << "exit server...";
@@ -66,17 +63,9 @@ int main(int argc, char **argv)
     net::event_context_t context(net::event_strategy::AUTO);
     app_context = &context;
 
-    if (FLAGS_threads == 0)
-    {
-        FLAGS_threads = 4;
-    }
-    LOG(INFO) << "thread detect " << FLAGS_threads;
-
-    for (int i = 0; i < FLAGS_threads - 1; i++)
-    {
-        std::thread thd(thread_main);
-        thd.detach();
-    }
+    /// loops are bound to cpus, the main thread runs a loop too
+    int threads = context.start_loops(FLAGS_threads == 0 ? 0 : FLAGS_threads - 1) + 1;
+    LOG(INFO) << "thread detect " << threads;
 
     LOG(INFO) << "start tracker server at " << FLAGS_ip << ":" << FLAGS_port;
 
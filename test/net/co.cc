@@ -0,0 +1,318 @@
+#include "net/co.hpp"
+#include "net/event.hpp"
+#include "net/execute_context.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+using namespace net;
+
+/// allocations of the process, counted by the replaced operator new
+static std::atomic<u64> allocation_count(0);
+
+void *operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+TEST(CoTest, StackPool)
+{
+    co::stack_pool_t pool;
+    GTEST_ASSERT_EQ(co::stack_pool_t::round_size(0), co::default_stack_size);
+    GTEST_ASSERT_EQ(co::stack_pool_t::round_size(1), co::min_stack_size);
+    GTEST_ASSERT_EQ(co::stack_pool_t::round_size(20000), 32 * 1024);
+
+    auto stack = pool.allocate(20000);
+    GTEST_ASSERT_EQ(stack.size, 32 * 1024);
+    /// the lowest byte is usable
+    ((char *)stack.sp - stack.size)[0] = 1;
+    ((char *)stack.sp)[-1] = 1;
+    pool.deallocate(stack);
+    GTEST_ASSERT_EQ(pool.get_stat().cached_bytes, 32 * 1024);
+
+    auto again = pool.allocate(32 * 1024);
+    GTEST_ASSERT_EQ(again.sp, stack.sp);
+    GTEST_ASSERT_EQ(pool.get_stat().reused, 1);
+    pool.deallocate(again);
+
+    pool.set_limit(0);
+    GTEST_ASSERT_EQ(pool.get_stat().cached_bytes, 0);
+    auto large = pool.allocate(4 * 1024 * 1024);
+    pool.deallocate(large);
+    GTEST_ASSERT_EQ(pool.get_stat().mapped, 2);
+    GTEST_ASSERT_EQ(pool.get_stat().cached_bytes, 0);
+}
+
+#ifndef OS_WINDOWS
+TEST(CoTest, StackGuardPage)
+{
+    testing::FLAGS_gtest_death_test_style = "threadsafe";
+    EXPECT_DEATH(
+        {
+            co::stack_pool_t pool;
+            auto stack = pool.allocate(co::min_stack_size);
+            volatile char *below = (char *)stack.sp - stack.size - 1;
+            *below = 1;
+        },
+        "");
+}
+#endif
+
+TEST(CoTest, CoroutineReuse)
+{
+    constexpr int rounds = 1000;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    auto &pool = co::stack_pool_t::current();
+    auto before = pool.get_stat();
+    int done = 0;
+    std::unique_ptr<execute_context_t> exectx;
+
+    std::function<void()> next;
+    next = [&]() {
+        exectx = std::make_unique<execute_context_t>();
+        ctx.add_executor(exectx.get(), &loop);
+        exectx->run(
+            [&]() {
+                /// finish this coroutine before the next one is created
+                if (++done == rounds)
+                    ctx.exit_all(0);
+                else
+                    loop.get_dispatcher().add_task(next);
+            },
+            co::min_stack_size);
+    };
+    next();
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    auto after = pool.get_stat();
+    GTEST_ASSERT_EQ(done, rounds);
+    /// one coroutine is alive at a time, its stack is reused by the next one
+    GTEST_ASSERT_LE(after.mapped - before.mapped, 2);
+    GTEST_ASSERT_GE(after.reused - before.reused, rounds - 2);
+}
+
+TEST(CoTest, CallableInline)
+{
+    int calls = 0;
+    u64 a = 1, b = 2, c = 3, d = 4;
+    auto before = allocation_count.load();
+    /// larger than the small buffer of std::function
+    callable_t<void()> func = [&calls, a, b, c, d]() { calls += (int)(a + b + c + d); };
+    callable_t<void()> moved = std::move(func);
+    GTEST_ASSERT_EQ(allocation_count.load(), before);
+    GTEST_ASSERT_FALSE((bool)func);
+    moved();
+    GTEST_ASSERT_EQ(calls, 10);
+
+    /// move-only and large callables
+    auto ptr = std::make_unique<int>(5);
+    callable_t<int(int)> unique = [ptr = std::move(ptr)](int v) { return *ptr + v; };
+    GTEST_ASSERT_EQ(unique(1), 6);
+    char large[128] = {7};
+    callable_t<int()> heap = [large]() { return (int)large[0]; };
+    GTEST_ASSERT_EQ(heap(), 7);
+
+    GTEST_ASSERT_FALSE((bool)callable_t<void()>(std::function<void()>()));
+    GTEST_ASSERT_FALSE((bool)callable_t<void()>((void (*)()) nullptr));
+}
+
+TEST(CoTest, HotPathAllocation)
+{
+    constexpr int warm_up = 100;
+    constexpr int packets = 1000;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    std::atomic_int handled = 0;
+    std::atomic_bool timeout = false;
+    u64 received = 0, fired = 0;
+    int last = -1;
+
+    /// a packet resumes the coroutine with a callback, which sets a timer and sleeps like a rudp tick
+    exectx.run([&]() {
+        while (1)
+        {
+            exectx.stop();
+            loop.add_timer(make_timer(0, [&fired, &received, &last]() {
+                fired++;
+                received += last;
+            }));
+            exectx.sleep(0);
+            handled.fetch_add(1, std::memory_order_release);
+        }
+    });
+
+    u64 before = 0, after = 0;
+    std::thread producer([&]() {
+        for (int i = 0; i < warm_up + packets && !timeout; i++)
+        {
+            if (i == warm_up)
+                before = allocation_count.load();
+            exectx.start_with([&received, &last, i, size = (u64)1472]() {
+                received += size;
+                last = i;
+            });
+            while (handled.load(std::memory_order_acquire) <= i && !timeout)
+                std::this_thread::yield();
+        }
+        after = allocation_count.load();
+        exectx.start_with([&ctx]() { ctx.exit_all(0); });
+    });
+    loop.add_timer(make_timer(make_timespan(20), [&ctx, &timeout]() {
+        timeout = true;
+        ctx.exit_all(-1);
+    }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    producer.join();
+
+    std::cout << "allocations per packet: " << (double)(after - before) / packets << std::endl;
+    GTEST_ASSERT_EQ(last, warm_up + packets - 1);
+    GTEST_ASSERT_EQ(fired, warm_up + packets);
+    GTEST_ASSERT_EQ(after - before, 0);
+}
+
+namespace
+{
+/// completes 'read' when 'ready' is set, fires the registered waiter
+struct fake_source_t
+{
+    co::waiter_t *waiter = nullptr;
+    bool ready = false;
+    int calls = 0;
+};
+
+co::async_result_t<int> fake_read(co::paramter_t &param, fake_source_t &source)
+{
+    source.calls++;
+    if (source.ready)
+        return 1;
+    param.wait_for(source.waiter, event_type::readable);
+    return {};
+}
+} // namespace
+
+TEST(CoTest, WaiterWakeup)
+{
+    constexpr int pokes = 3;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    execute_context_t reader, writer;
+    ctx.add_executor(&reader, &loop);
+    ctx.add_executor(&writer, &loop);
+    fake_source_t source;
+    int result = 0;
+    auto before = co::get_await_stat();
+
+    reader.run([&]() {
+        result = co::await(fake_read, source);
+        ctx.exit_all(0);
+    });
+    writer.run([&]() {
+        /// resumes which are not the readiness are swallowed by the await
+        for (int i = 0; i < pokes; i++)
+        {
+            reader.start();
+            writer.sleep(make_timespan(0, 1));
+        }
+        GTEST_ASSERT_NE(source.waiter, nullptr);
+        source.ready = true;
+        source.waiter->fire();
+    });
+    loop.add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    auto after = co::get_await_stat();
+    GTEST_ASSERT_EQ(result, 1);
+    GTEST_ASSERT_EQ(source.calls, 2);
+    GTEST_ASSERT_EQ(source.waiter, nullptr);
+    GTEST_ASSERT_EQ(after.spurious - before.spurious, pokes);
+    GTEST_ASSERT_EQ(after.resumes - before.resumes, pokes + 1);
+}
+
+namespace
+{
+co::async_result_t<int> fake_read_timeout(co::paramter_t &param, fake_source_t &source)
+{
+    if (param.is_stop())
+        return -1;
+    return fake_read(param, source);
+}
+
+/// waits for 'inner' in a nested await, like tcp::awrite_packet
+co::async_result_t<int> nested_read(co::paramter_t &param, fake_source_t &inner)
+{
+    return co::await_p(param, fake_read_timeout, inner);
+}
+} // namespace
+
+TEST(CoTest, CancelToken)
+{
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    execute_context_t reader, writer;
+    ctx.add_executor(&reader, &loop);
+    ctx.add_executor(&writer, &loop);
+    fake_source_t never, inner, ready;
+    int timeout_result = 0, nested_result = 0, ready_result = 0;
+    u64 timers_waiting = 0, timers_after = 0;
+    microsecond_t elapsed = 0;
+    co::cancel_token_t *outer = nullptr;
+
+    reader.run([&]() {
+        u64 reader_timers = loop.get_timer_count();
+        /// one timer for the whole wait, pokes don't arm another one
+        auto start = get_current_time();
+        timeout_result = co::await_timeout(make_timespan(0, 20), fake_read_timeout, never);
+        elapsed = get_current_time() - start;
+
+        /// canceling the outer token stops the nested await
+        co::cancel_token_t token;
+        outer = &token;
+        nested_result = co::await_with(token, nested_read, inner);
+        outer = nullptr;
+
+        /// timer is removed when the wait finishes before deadline
+        co::cancel_token_t deadline(make_timepoint(make_timespan(10)));
+        ready.ready = true;
+        ready_result = co::await_with(deadline, fake_read_timeout, ready);
+        timers_after = loop.get_timer_count() - reader_timers;
+        ctx.exit_all(0);
+    });
+    u64 timers = 0;
+    writer.run([&]() {
+        for (int i = 0; i < 3; i++)
+        {
+            reader.start();
+            writer.sleep(make_timespan(0, 2));
+        }
+        /// the token timer of reader, the sleep timer of writer is removed after it wakes up
+        timers_waiting = loop.get_timer_count() - timers;
+        while (outer == nullptr || inner.waiter == nullptr)
+            writer.sleep(make_timespan(0, 1));
+        outer->cancel();
+    });
+    loop.add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    timers = loop.get_timer_count();
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(timeout_result, -1);
+    GTEST_ASSERT_GE(elapsed, make_timespan(0, 19));
+    GTEST_ASSERT_EQ(timers_waiting, 1);
+    GTEST_ASSERT_EQ(nested_result, -1);
+    GTEST_ASSERT_EQ(inner.waiter, nullptr);
+    GTEST_ASSERT_EQ(ready_result, 1);
+    GTEST_ASSERT_EQ(timers_after, 0);
+}
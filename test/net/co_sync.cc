@@ -0,0 +1,206 @@
+#include "net/co_sync.hpp"
+#include "net/event.hpp"
+#include "net/execute_context.hpp"
+#include "net/net.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+
+using namespace net;
+
+/// run 'ctx' in another thread, return its loop
+static event_loop_t *start_second_loop(event_context_t &ctx, std::thread &thd)
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    event_loop_t *second = nullptr;
+    auto main_loop = &event_loop_t::current();
+    int id = ctx.add_loop_handler([&](event_loop_t &loop) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (&loop != main_loop)
+            second = &loop;
+        cond.notify_all();
+    });
+    thd = std::thread([&ctx]() { ctx.run(); });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&second]() { return second != nullptr; });
+    }
+    ctx.remove_loop_handler(id);
+    return second;
+}
+
+TEST(CoSyncTest, ChannelBackpressure)
+{
+    constexpr int count = 2000;
+    constexpr u64 capacity = 4;
+    event_context_t ctx(event_strategy::epoll);
+    auto &main_loop = event_loop_t::current();
+    std::thread thd;
+    auto second = start_second_loop(ctx, thd);
+
+    co::channel_t<int> channel(capacity);
+    execute_context_t producer, consumer;
+    ctx.add_executor(&producer, &main_loop);
+    ctx.add_executor(&consumer, second);
+    u64 max_size = 0;
+    u64 sum = 0;
+    int received = 0;
+    bool send_ok = true;
+
+    producer.run([&]() {
+        for (int i = 0; i < count; i++)
+        {
+            send_ok = send_ok && channel.send(i);
+            max_size = std::max(max_size, channel.size());
+        }
+        channel.close();
+        /// later sends fail
+        send_ok = send_ok && !channel.send(0);
+    });
+    consumer.run([&]() {
+        while (auto value = channel.recv())
+        {
+            sum += *value;
+            received++;
+            /// slow consumer, producer waits
+            if (received % 100 == 0)
+                consumer.sleep(make_timespan(0, 1));
+        }
+        ctx.exit_all(0);
+    });
+    main_loop.add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    thd.join();
+
+    GTEST_ASSERT_TRUE(send_ok);
+    GTEST_ASSERT_EQ(received, count);
+    GTEST_ASSERT_EQ(sum, (u64)count * (count - 1) / 2);
+    GTEST_ASSERT_LE(max_size, capacity);
+}
+
+TEST(CoSyncTest, ChannelThreadProducer)
+{
+    constexpr int count = 1000;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    co::channel_t<std::unique_ptr<int>> channel(8);
+    execute_context_t consumer;
+    ctx.add_executor(&consumer, &loop);
+    int received = 0;
+    bool ordered = true;
+
+    /// plain thread blocks when channel is full
+    std::thread producer([&channel]() {
+        for (int i = 0; i < count; i++)
+            channel.send(std::make_unique<int>(i));
+        channel.close();
+    });
+    consumer.run([&]() {
+        while (auto value = channel.recv())
+        {
+            ordered = ordered && **value == received;
+            received++;
+        }
+        ctx.exit_all(0);
+    });
+    loop.add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    producer.join();
+
+    GTEST_ASSERT_EQ(received, count);
+    GTEST_ASSERT_TRUE(ordered);
+}
+
+TEST(CoSyncTest, MutexExclusion)
+{
+    constexpr int workers = 8;
+    constexpr int rounds = 5;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    co::mutex_t mutex;
+    co::semaphore_t done(0);
+    int inside = 0, max_inside = 0, total = 0;
+    std::unique_ptr<execute_context_t> executors[workers];
+    for (auto &exectx : executors)
+    {
+        exectx = std::make_unique<execute_context_t>();
+        ctx.add_executor(exectx.get(), &loop);
+        auto self = exectx.get();
+        self->run([&, self]() {
+            for (int i = 0; i < rounds; i++)
+            {
+                lock::lock_guard<co::mutex_t> guard(mutex);
+                inside++;
+                max_inside = std::max(max_inside, inside);
+                /// held across a yield
+                self->sleep(make_timespan(0, 1));
+                total++;
+                inside--;
+            }
+            done.release();
+        });
+    }
+    execute_context_t waiter;
+    ctx.add_executor(&waiter, &loop);
+    waiter.run([&]() {
+        for (int i = 0; i < workers; i++)
+            done.acquire();
+        ctx.exit_all(0);
+    });
+    loop.add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(max_inside, 1);
+    GTEST_ASSERT_EQ(total, workers * rounds);
+    GTEST_ASSERT_TRUE(mutex.try_lock());
+    GTEST_ASSERT_EQ(done.get_count(), 0);
+}
+
+TEST(CoSyncTest, EventAndCancel)
+{
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    co::event_t event;
+    co::channel_t<int> channel(1);
+    co::semaphore_t semaphore(0);
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    bool recv_canceled = false, acquire_canceled = false, event_ok = false;
+    microsecond_t elapsed = 0;
+    std::thread setter;
+
+    exectx.run([&]() {
+        /// waits end at deadline and leave the wait lists
+        auto start = get_current_time();
+        co::cancel_token_t recv_token(make_timepoint(make_timespan(0, 20)));
+        recv_canceled = !channel.recv(&recv_token).has_value();
+        elapsed = get_current_time() - start;
+        co::cancel_token_t acquire_token(make_timepoint(make_timespan(0, 5)));
+        acquire_canceled = !semaphore.acquire(&acquire_token);
+
+        setter = std::thread([&event]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            event.set();
+        });
+        event_ok = event.wait();
+        ctx.exit_all(0);
+    });
+    loop.add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    setter.join();
+
+    GTEST_ASSERT_TRUE(recv_canceled);
+    GTEST_ASSERT_GE(elapsed, make_timespan(0, 19));
+    GTEST_ASSERT_TRUE(acquire_canceled);
+    GTEST_ASSERT_TRUE(event_ok);
+    GTEST_ASSERT_TRUE(event.is_set());
+    /// canceled waiters are removed, permits go to later callers
+    semaphore.release();
+    GTEST_ASSERT_TRUE(semaphore.try_acquire());
+    int value = 1;
+    GTEST_ASSERT_TRUE(channel.try_send(value));
+    GTEST_ASSERT_EQ(channel.try_recv().value(), 1);
+}
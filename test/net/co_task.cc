@@ -0,0 +1,198 @@
+#include "net/co_task.hpp"
+#include "net/event.hpp"
+#include "net/execute_context.hpp"
+#include "net/net.hpp"
+#include "net/socket.hpp"
+#include "net/socket_buffer.hpp"
+#include "net/udp.hpp"
+#include <gtest/gtest.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#ifndef OS_WINDOWS
+#include <fstream>
+#include <unistd.h>
+#endif
+
+/// tests of stackless coroutines are built with C++20 only
+#ifdef __cpp_impl_coroutine
+
+using namespace net;
+
+namespace
+{
+const std::string test_data = "stackless";
+
+struct task_source_t
+{
+    co::waiter_t *waiter = nullptr;
+    bool ready = false;
+
+    void fire()
+    {
+        ready = true;
+        if (auto w = waiter)
+            w->fire();
+    }
+};
+
+co::async_result_t<int> task_read(co::paramter_t &param, task_source_t &source)
+{
+    if (source.ready)
+        return 1;
+    param.wait_for(source.waiter, event_type::readable);
+    return {};
+}
+
+/// resident bytes of the process, 0 if unknown
+u64 resident_bytes()
+{
+#ifndef OS_WINDOWS
+    std::ifstream file("/proc/self/statm");
+    u64 size = 0, resident = 0;
+    if (file >> size >> resident)
+        return resident * (u64)sysconf(_SC_PAGESIZE);
+#endif
+    return 0;
+}
+
+co::task_t<int> add_later(int a, int b)
+{
+    co_await co::sleep_for(make_timespan(0, 2));
+    co_return a + b;
+}
+
+co::task_t<void> connection_task(task_source_t &source, int &done)
+{
+    done += co_await co::async(task_read, source);
+}
+
+co::task_t<void> echo_server(socket_t *socket, int rounds)
+{
+    socket_buffer_t buffer(test_data.size());
+    socket_addr_t addr;
+    for (int i = 0; i < rounds; i++)
+    {
+        buffer.expect().origin_length();
+        if (co_await co::async(socket_aread_from, socket, buffer, addr) != io_result::ok)
+            co_return;
+        buffer.expect().origin_length();
+        co_await co::async(socket_awrite_to, socket, buffer, addr);
+    }
+}
+
+co::task_t<void> echo_client(socket_t *socket, socket_addr_t server, int rounds, int &done, event_context_t &ctx)
+{
+    auto buffer = socket_buffer_t::from_string(test_data);
+    socket_addr_t addr = server;
+    for (; done < rounds; done++)
+    {
+        buffer.expect().origin_length();
+        if (co_await co::async(socket_awrite_to, socket, buffer, addr) != io_result::ok)
+            break;
+        buffer.expect().origin_length();
+        if (co_await co::async(socket_aread_from, socket, buffer, addr) != io_result::ok)
+            break;
+    }
+    ctx.exit_all(0);
+}
+} // namespace
+
+TEST(CoTaskTest, UDPEcho)
+{
+    constexpr int rounds = 100;
+    socket_addr_t test_addr("127.0.0.1", 2240);
+    event_context_t ctx(event_strategy::epoll);
+    udp::server_t server;
+    server.bind(ctx, test_addr);
+    udp::client_t client;
+    client.connect(ctx, test_addr, false);
+    int done = 0;
+    auto before = co::get_await_stat();
+
+    auto server_socket = server.get_socket();
+    auto client_socket = client.get_socket();
+    co::spawn(*server_socket->get_loop(), echo_server(server_socket, rounds));
+    co::spawn(*client_socket->get_loop(), echo_client(client_socket, test_addr, rounds, done, ctx));
+    event_loop_t::current().add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(done, rounds);
+    /// resumed by readiness only
+    GTEST_ASSERT_EQ(co::get_await_stat().spurious - before.spurious, 0);
+}
+
+TEST(CoTaskTest, Interop)
+{
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    int sum = 0;
+    microsecond_t elapsed = 0;
+
+    /// a stackful coroutine waits for a task
+    exectx.run([&]() {
+        auto start = get_current_time();
+        sum = co::await_task(add_later(1, 2));
+        elapsed = get_current_time() - start;
+        ctx.exit_all(0);
+    });
+    loop.add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(sum, 3);
+    GTEST_ASSERT_GE(elapsed, make_timespan(0, 1));
+    GTEST_ASSERT_EQ(co::get_task_stat().frames, 0);
+}
+
+/// memory of connections waiting for data, stackless tasks against stackful coroutines
+TEST(CoTaskTest, MemoryPerConnection)
+{
+    constexpr int connections = 2000;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    std::vector<task_source_t> sources(connections);
+
+    /// stackless
+    int task_done = 0;
+    auto rss = resident_bytes();
+    for (auto &source : sources)
+        co::spawn(loop, connection_task(source, task_done));
+    loop.get_dispatcher().dispatch();
+    auto task_frame_bytes = co::get_task_stat().frame_bytes / connections;
+    auto task_rss = (resident_bytes() - rss) / connections;
+    for (auto &source : sources)
+        source.fire();
+    loop.get_dispatcher().dispatch();
+    loop.get_dispatcher().dispatch();
+
+    /// stackful
+    for (auto &source : sources)
+        source.ready = false;
+    int fiber_done = 0;
+    std::vector<std::unique_ptr<execute_context_t>> executors;
+    rss = resident_bytes();
+    for (auto &source : sources)
+    {
+        executors.emplace_back(std::make_unique<execute_context_t>());
+        ctx.add_executor(executors.back().get(), &loop);
+        executors.back()->run([&source, &fiber_done]() { fiber_done += co::await(task_read, source); });
+    }
+    loop.get_dispatcher().dispatch();
+    auto fiber_rss = (resident_bytes() - rss) / connections;
+    for (auto &source : sources)
+        source.fire();
+    loop.get_dispatcher().dispatch();
+
+    std::cout << "per connection: task frame " << task_frame_bytes << " bytes, task resident " << task_rss
+              << " bytes, coroutine stack " << co::default_stack_size << " bytes, coroutine resident " << fiber_rss
+              << " bytes" << std::endl;
+    GTEST_ASSERT_EQ(task_done, connections);
+    GTEST_ASSERT_EQ(fiber_done, connections);
+    GTEST_ASSERT_EQ(co::get_task_stat().frames, 0);
+    GTEST_ASSERT_LT(task_frame_bytes, 1024);
+}
+
+#endif
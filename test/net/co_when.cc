@@ -0,0 +1,214 @@
+#include "net/co_sync.hpp"
+#include "net/co_when.hpp"
+#include "net/event.hpp"
+#include "net/execute_context.hpp"
+#include "net/net.hpp"
+#include "net/rudp.hpp"
+#include "net/socket.hpp"
+#include "net/socket_buffer.hpp"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+
+using namespace net;
+static std::string test_data = "test string";
+
+TEST(CoWhenTest, WhenAny)
+{
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    co::channel_t<int> channel(1);
+    execute_context_t exectx, sender;
+    ctx.add_executor(&exectx, &loop);
+    ctx.add_executor(&sender, &loop);
+    u64 timeout_index = 0, recv_index = 0;
+    int value = 0;
+    bool loser_canceled = false;
+    microsecond_t timeout_elapsed = 0, recv_elapsed = 0;
+
+    exectx.run([&]() {
+        auto recv = [&channel](co::cancel_token_t &token) { return channel.recv(&token); };
+        /// timer wins, receive is canceled
+        auto start = get_current_time();
+        auto timeout = [](co::cancel_token_t &token) { co::sleep_with(token, make_timespan(0, 20)); };
+        auto result = co::when_any(recv, timeout);
+        timeout_elapsed = get_current_time() - start;
+        timeout_index = result.index();
+
+        /// receive wins, the long sleep is canceled
+        sender.run([&]() {
+            sender.sleep(make_timespan(0, 2));
+            channel.send(42);
+        });
+        start = get_current_time();
+        auto result2 = co::when_any(recv, [&loser_canceled](co::cancel_token_t &token) {
+            loser_canceled = !co::sleep_with(token, make_timespan(10));
+        });
+        recv_elapsed = get_current_time() - start;
+        recv_index = result2.index();
+        value = std::get<0>(result2).value_or(0);
+        ctx.exit_all(0);
+    });
+    loop.add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(timeout_index, 1);
+    GTEST_ASSERT_GE(timeout_elapsed, make_timespan(0, 19));
+    GTEST_ASSERT_EQ(recv_index, 0);
+    GTEST_ASSERT_EQ(value, 42);
+    GTEST_ASSERT_TRUE(loser_canceled);
+    GTEST_ASSERT_LT(recv_elapsed, make_timespan(1));
+    /// canceled receivers left the channel
+    int one = 1;
+    GTEST_ASSERT_TRUE(channel.try_send(one));
+    GTEST_ASSERT_EQ(channel.try_recv().value(), 1);
+}
+
+TEST(CoWhenTest, WhenAll)
+{
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    int first = 0, second = 0;
+    bool slept = false, timeout_canceled = false, thrown = false;
+    microsecond_t elapsed = 0;
+
+    exectx.run([&]() {
+        auto result = co::when_all(
+            [](co::cancel_token_t &token) {
+                co::sleep_with(token, make_timespan(0, 5));
+                return 1;
+            },
+            [](co::cancel_token_t &token) {
+                co::sleep_with(token, make_timespan(0, 2));
+                return 2;
+            },
+            [&slept](co::cancel_token_t &token) { slept = co::sleep_with(token, make_timespan(0, 1)); });
+        first = std::get<0>(result);
+        second = std::get<1>(result);
+
+        /// deadline of caller's token reaches branches
+        co::cancel_token_t token(make_timepoint(make_timespan(0, 10)));
+        co::when_all_with(token, [&timeout_canceled](co::cancel_token_t &token) {
+            timeout_canceled = !co::sleep_with(token, make_timespan(10));
+        });
+
+        /// exception cancels other branches and is thrown to caller
+        auto start = get_current_time();
+        try
+        {
+            co::when_all([](co::cancel_token_t &token) { co::sleep_with(token, make_timespan(10)); },
+                         [](co::cancel_token_t &) -> int { throw std::runtime_error("branch"); });
+        } catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        elapsed = get_current_time() - start;
+        ctx.exit_all(0);
+    });
+    loop.add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(first, 1);
+    GTEST_ASSERT_EQ(second, 2);
+    GTEST_ASSERT_TRUE(slept);
+    GTEST_ASSERT_TRUE(timeout_canceled);
+    GTEST_ASSERT_TRUE(thrown);
+    GTEST_ASSERT_LT(elapsed, make_timespan(1));
+}
+
+/// a branch reading a socket is resumed by the socket, not by the caller's context
+static void when_any_socket_read(event_strategy strategy)
+{
+    socket_addr_t addr("127.0.0.1", 2240);
+    event_context_t ctx(strategy);
+    auto &loop = event_loop_t::current();
+    auto receiver = new_udp_socket();
+    bind_at(receiver, addr);
+    receiver->bind_context(ctx, loop);
+    auto sender = new_udp_socket();
+    sender->bind_context(ctx, loop);
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    u64 index = 2;
+    std::string data;
+    microsecond_t elapsed = 0;
+
+    exectx.run([&]() {
+        auto read = [&data, receiver](co::cancel_token_t &token) {
+            socket_buffer_t buffer(test_data.size());
+            buffer.expect().origin_length();
+            socket_addr_t from;
+            if (co::await_with(token, socket_aread_from, receiver, buffer, from) == io_result::ok)
+                data = buffer.to_string();
+        };
+        auto timeout = [](co::cancel_token_t &token) { co::sleep_with(token, make_timespan(10)); };
+        sender->run([sender, addr]() {
+            sender->sleep(make_timespan(0, 20));
+            socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+            buffer.expect().origin_length();
+            co::await(socket_awrite_to, sender, buffer, addr);
+        });
+        auto start = get_current_time();
+        index = co::when_any(read, timeout).index();
+        elapsed = get_current_time() - start;
+        ctx.exit_all(0);
+    });
+    loop.add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(index, 0);
+    GTEST_ASSERT_EQ(data, test_data);
+    GTEST_ASSERT_LT(elapsed, make_timespan(1));
+    receiver->unbind_context();
+    close_socket(receiver);
+    sender->unbind_context();
+    close_socket(sender);
+}
+
+TEST(CoWhenTest, WhenAnySocketRead) { when_any_socket_read(event_strategy::epoll); }
+
+#ifndef OS_WINDOWS
+TEST(CoWhenTest, WhenAnyUringRead) { when_any_socket_read(event_strategy::io_uring); }
+#endif
+
+TEST(CoWhenTest, WhenAnyRUDPRead)
+{
+    socket_addr_t addr1("127.0.0.1", 2241);
+    socket_addr_t addr2("127.0.0.1", 2242);
+    event_context_t ctx(event_strategy::epoll);
+    rudp_t rudp1, rudp2;
+    rudp1.bind(ctx, addr1, true);
+    rudp2.bind(ctx, addr2, true);
+    u64 index = 2;
+    std::string data;
+    microsecond_t elapsed = 0;
+
+    rudp1.add_connection(addr2, 0, make_timespan(5), [&](rudp_connection_t conn) {
+        /// input of rudp resumes the branch, not the endpoint context which waits for the branches
+        auto read = [&data, &rudp1, conn](co::cancel_token_t &token) {
+            socket_buffer_t buffer(test_data.size());
+            buffer.expect().origin_length();
+            if (co::await_with(token, rudp_aread, &rudp1, conn, buffer) == io_result::ok)
+                data = buffer.to_string();
+        };
+        auto timeout = [](co::cancel_token_t &token) { co::sleep_with(token, make_timespan(10)); };
+        auto start = get_current_time();
+        index = co::when_any(read, timeout).index();
+        elapsed = get_current_time() - start;
+        ctx.exit_all(0);
+    });
+    rudp2.add_connection(addr1, 0, make_timespan(5), [&rudp2](rudp_connection_t conn) {
+        co::coroutine_t::current()->get_execute_context()->sleep(make_timespan(0, 20));
+        socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+        buffer.expect().origin_length();
+        co::await(rudp_awrite, &rudp2, conn, buffer);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(index, 0);
+    GTEST_ASSERT_EQ(data, test_data);
+    GTEST_ASSERT_LT(elapsed, make_timespan(1));
+}
@@ -0,0 +1,761 @@
+#include "net/cpu.hpp"
+#include "net/event.hpp"
+#include "net/execute_context.hpp"
+#include "net/net.hpp"
+#include "net/uring.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace net;
+
+#ifndef OS_WINDOWS
+/// re-arm the pipe after every readable event, so each pipe is always ready
+class pipe_handler_t : public event_handler_t
+{
+    int rfd, wfd;
+    u64 &counter;
+
+  public:
+    pipe_handler_t(int rfd, int wfd, u64 &counter)
+        : rfd(rfd)
+        , wfd(wfd)
+        , counter(counter)
+    {
+    }
+
+    void on_event(event_context_t &, event_type_t) override
+    {
+        char c;
+        if (read(rfd, &c, 1) == 1)
+        {
+            counter++;
+            write(wfd, &c, 1);
+        }
+    }
+};
+
+/// handled events per second of a loop whose pipes are always ready
+///\param max_events most ready events returned by one select
+static double run_ready_pipes(int batch_size, int pipes, microsecond_t span, u64 &max_events)
+{
+    u64 counter = 0;
+    std::vector<std::unique_ptr<pipe_handler_t>> handlers;
+    std::vector<int> fds;
+    microsecond_t start, end;
+    {
+        event_context_t ctx(event_strategy::epoll, timer_min_precision, batch_size);
+        auto &loop = event_loop_t::current();
+        for (int i = 0; i < pipes; i++)
+        {
+            int fd[2];
+            if (pipe(fd) != 0)
+                break;
+            fcntl(fd[0], F_SETFL, fcntl(fd[0], F_GETFL, 0) | O_NONBLOCK);
+            fds.push_back(fd[0]);
+            fds.push_back(fd[1]);
+            handlers.emplace_back(std::make_unique<pipe_handler_t>(fd[0], fd[1], counter));
+            loop.add_event_handler(fd[0], handlers.back().get());
+            loop.link(fd[0], event_type::readable);
+            write(fd[1], "x", 1);
+        }
+        loop.add_timer(make_timer(span, [&ctx]() { ctx.exit_all(0); }));
+        start = get_precise_time();
+        ctx.run();
+        end = get_precise_time();
+        max_events = loop.get_profile().events.max;
+    }
+    for (auto fd : fds)
+        close(fd);
+
+    return (double)counter * 1000000 / (end - start);
+}
+
+TEST(EventTest, BatchSelectThroughput)
+{
+    constexpr int pipes = 256;
+    auto span = make_timespan(0, 500);
+
+    u64 single_events, batch_events;
+    double single = run_ready_pipes(1, pipes, span, single_events);
+    double batch = run_ready_pipes(default_event_batch_size, pipes, span, batch_events);
+
+    std::cout << "events/sec per loop with " << pipes << " ready fds. batch 1: " << (u64)single << ", batch "
+              << default_event_batch_size << ": " << (u64)batch << std::endl;
+    GTEST_ASSERT_GT(single, 0);
+    GTEST_ASSERT_GT(batch, 0);
+    /// ready pipes are taken together by one select
+    GTEST_ASSERT_EQ(single_events, 1);
+    GTEST_ASSERT_GT(batch_events, 1);
+}
+
+class null_handler_t : public event_handler_t
+{
+  public:
+    void on_event(event_context_t &, event_type_t) override {}
+};
+
+TEST(EventTest, HandlerTable)
+{
+    event_handler_table_t table;
+    null_handler_t h1, h2;
+    GTEST_ASSERT_EQ(table.find(3), nullptr);
+
+    u32 gen = table.add(3, &h1);
+    u32 find_gen = 0;
+    GTEST_ASSERT_EQ(table.find(3, &find_gen), &h1);
+    GTEST_ASSERT_EQ(find_gen, gen);
+    GTEST_ASSERT_EQ(table.size(), 1);
+
+    /// handle is reused by h2, stale remove of h1 is ignored
+    u32 gen2 = table.add(3, &h2);
+    GTEST_ASSERT_NE(gen, gen2);
+    GTEST_ASSERT_EQ(table.remove(3, &h1), false);
+    GTEST_ASSERT_EQ(table.find(3), &h2);
+    GTEST_ASSERT_EQ(table.remove(3, &h2), true);
+    GTEST_ASSERT_EQ(table.find(3), nullptr);
+    GTEST_ASSERT_NE(table.generation(3), gen2);
+    GTEST_ASSERT_EQ(table.size(), 0);
+
+    /// grow to another chunk
+    handle_t far = event_handler_table_t::chunk_size * 3 + 7;
+    table.add(far, &h1);
+    GTEST_ASSERT_EQ(table.find(far), &h1);
+    GTEST_ASSERT_EQ(table.find(far - 1), nullptr);
+    GTEST_ASSERT_EQ(table.find(event_handler_table_t::chunk_size * 5), nullptr);
+    GTEST_ASSERT_EQ(table.size(), 1);
+}
+
+/// wait for readable by link/unlink like bsd_socket_t, the edge is reported while the handler is not waiting
+class relink_pipe_handler_t : public event_handler_t
+{
+    int rfd, wfd;
+
+  public:
+    u64 counter = 0;
+    u64 target;
+
+    relink_pipe_handler_t(int rfd, int wfd, u64 target)
+        : rfd(rfd)
+        , wfd(wfd)
+        , target(target)
+    {
+    }
+
+    void on_event(event_context_t &context, event_type_t) override
+    {
+        char c;
+        if (read(rfd, &c, 1) != 1)
+            return;
+        auto &loop = event_loop_t::current();
+        loop.unlink(rfd, event_type::readable);
+        if (++counter >= target)
+        {
+            context.exit_all(0);
+            return;
+        }
+        write(wfd, &c, 1);
+        loop.add_timer(make_timer(timer_min_precision, [this, &loop]() { loop.link(rfd, event_type::readable); }));
+    }
+};
+
+TEST(EventTest, InterestMaskCache)
+{
+    int fd[2];
+    GTEST_ASSERT_EQ(pipe(fd), 0);
+    fcntl(fd[0], F_SETFL, fcntl(fd[0], F_GETFL, 0) | O_NONBLOCK);
+    relink_pipe_handler_t handler(fd[0], fd[1], 20);
+    {
+        event_context_t ctx(event_strategy::epoll);
+        auto &loop = event_loop_t::current();
+        loop.add_event_handler(fd[0], &handler);
+        loop.link(fd[0], event_type::readable);
+        write(fd[1], "x", 1);
+        loop.add_timer(make_timer(make_timespan(2), [&ctx]() { ctx.exit_all(-1); }));
+        ctx.run();
+
+        auto stat = loop.get_interest_stat();
+        GTEST_ASSERT_EQ(handler.counter, handler.target);
+        /// registered once, each readable edge is delivered again by link
+        GTEST_ASSERT_EQ(stat.demuxer_calls, 1);
+        GTEST_ASSERT_GE(stat.saved_calls, handler.target * 2 - 2);
+        GTEST_ASSERT_EQ(stat.redelivered, handler.target - 1);
+        loop.remove_event_handler(fd[0], &handler);
+    }
+    close(fd[0]);
+    close(fd[1]);
+}
+
+/// run 'ctx' in another thread, return its loop
+static event_loop_t *start_second_loop(event_context_t &ctx, std::thread &thd)
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    event_loop_t *second = nullptr;
+    auto main_loop = &event_loop_t::current();
+    int id = ctx.add_loop_handler([&](event_loop_t &loop) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (&loop != main_loop)
+            second = &loop;
+        cond.notify_all();
+    });
+    thd = std::thread([&ctx]() { ctx.run(); });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&second]() { return second != nullptr; });
+    }
+    ctx.remove_loop_handler(id);
+    return second;
+}
+
+TEST(EventTest, DispatcherMultiProducer)
+{
+    constexpr int producers = 4;
+    constexpr int per_producer = 20000;
+    event_context_t ctx(event_strategy::epoll);
+    execute_context_t exectx;
+    ctx.add_executor(&exectx);
+    u64 counter = 0;
+    exectx.run([&exectx]() {
+        while (1)
+            exectx.stop();
+    });
+
+    std::vector<std::thread> threads;
+    auto start = get_precise_time();
+    for (int i = 0; i < producers; i++)
+    {
+        threads.emplace_back([&]() {
+            for (int j = 0; j < per_producer; j++)
+            {
+                exectx.start_with([&]() {
+                    if (++counter == producers * per_producer)
+                        ctx.exit_all(0);
+                });
+            }
+        });
+    }
+    event_loop_t::current().add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    auto end = get_precise_time();
+    for (auto &thd : threads)
+        thd.join();
+    std::cout << "cross-thread start_with/sec: " << (u64)counter * 1000000 / (end - start + 1) << std::endl;
+    GTEST_ASSERT_EQ(counter, producers * per_producer);
+}
+
+TEST(EventTest, DispatcherCancel)
+{
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    int resumed = 0;
+    execute_context_t exectx;
+    ctx.add_executor(&exectx);
+    exectx.run([&]() {
+        while (1)
+        {
+            exectx.stop();
+            resumed++;
+        }
+    });
+    loop.get_dispatcher().dispatch();
+
+    /// queued entries are dropped, new entries run
+    exectx.start();
+    exectx.start();
+    exectx.cancel();
+    loop.get_dispatcher().dispatch();
+    GTEST_ASSERT_EQ(resumed, 0);
+    exectx.start();
+    loop.get_dispatcher().dispatch();
+    GTEST_ASSERT_EQ(resumed, 1);
+
+    /// entries of destroyed context are dropped
+    {
+        execute_context_t tmp;
+        ctx.add_executor(&tmp);
+        tmp.run([&tmp]() { tmp.stop(); });
+    }
+    loop.get_dispatcher().dispatch();
+    GTEST_ASSERT_TRUE(loop.get_dispatcher().empty());
+}
+
+TEST(EventTest, DispatcherPriority)
+{
+    constexpr int bulk = 200;
+    constexpr int urgent = 10;
+    constexpr int busy_count = 32;
+    constexpr int rounds = 50;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    auto &dispatcher = loop.get_dispatcher();
+    std::vector<int> order;
+    std::vector<std::unique_ptr<execute_context_t>> executors;
+    auto add = [&](dispatch_priority_t priority, int id) {
+        executors.emplace_back(std::make_unique<execute_context_t>());
+        auto exectx = executors.back().get();
+        ctx.add_executor(exectx, &loop);
+        exectx->set_priority(priority);
+        exectx->run([&order, id]() { order.push_back(id); });
+    };
+
+    /// high priority contexts queued behind bulk ones run first
+    for (int i = 0; i < bulk; i++)
+        add(dispatch_priority::low, 0);
+    for (int i = 0; i < urgent; i++)
+        add(dispatch_priority::high, 1);
+    dispatcher.dispatch();
+    GTEST_ASSERT_EQ(order.size(), bulk + urgent);
+    auto last_urgent = std::find(order.rbegin(), order.rend(), 1).base() - order.begin();
+    GTEST_ASSERT_LE(last_urgent, urgent + 1);
+    GTEST_ASSERT_EQ(dispatcher.get_dispatched(dispatch_priority::high), urgent);
+    GTEST_ASSERT_EQ(dispatcher.get_dispatched(dispatch_priority::low), bulk);
+
+    /// low priority contexts are not starved by busy high priority ones
+    order.clear();
+    executors.clear();
+    int high_resumes = 0;
+    int high_resumes_at_last_low = 0;
+    for (int i = 0; i < busy_count; i++)
+    {
+        executors.emplace_back(std::make_unique<execute_context_t>());
+        auto exectx = executors.back().get();
+        ctx.add_executor(exectx, &loop);
+        exectx->set_priority(dispatch_priority::high);
+        exectx->run([exectx, &high_resumes]() {
+            for (int j = 0; j < rounds; j++)
+            {
+                high_resumes++;
+                exectx->start();
+                exectx->stop();
+            }
+        });
+    }
+    for (int i = 0; i < urgent; i++)
+    {
+        executors.emplace_back(std::make_unique<execute_context_t>());
+        auto exectx = executors.back().get();
+        ctx.add_executor(exectx, &loop);
+        exectx->set_priority(dispatch_priority::low);
+        exectx->run([&]() { high_resumes_at_last_low = high_resumes; });
+    }
+    dispatcher.dispatch();
+    GTEST_ASSERT_EQ(high_resumes, busy_count * rounds);
+    /// a low context runs every round of high ones
+    GTEST_ASSERT_LE(high_resumes_at_last_low, urgent * (int)dispatch_priority_quantum[dispatch_priority::high]);
+
+    /// start_with overrides priority of context
+    order.clear();
+    execute_context_t normal, overridden;
+    ctx.add_executor(&normal, &loop);
+    ctx.add_executor(&overridden, &loop);
+    normal.run([&]() {
+        while (1)
+            normal.stop();
+    });
+    overridden.run([&]() {
+        while (1)
+            overridden.stop();
+    });
+    dispatcher.dispatch();
+    for (int i = 0; i < 8; i++)
+        normal.start_with([&order]() { order.push_back(0); });
+    overridden.start_with([&order]() { order.push_back(1); }, dispatch_priority::high);
+    dispatcher.dispatch();
+    GTEST_ASSERT_EQ(order.front(), 1);
+}
+
+TEST(EventTest, WorkStealingGive)
+{
+    constexpr int contexts = 64;
+    constexpr int rounds = 50;
+    event_context_t ctx(event_strategy::epoll);
+    ctx.set_work_stealing(true);
+    auto &main_loop = event_loop_t::current();
+    auto main_thread = std::this_thread::get_id();
+    std::thread thd;
+    auto second = start_second_loop(ctx, thd);
+
+    std::atomic_int done = 0;
+    std::atomic_int other_thread_runs = 0;
+    std::vector<std::unique_ptr<execute_context_t>> executors;
+    for (int i = 0; i < contexts; i++)
+    {
+        executors.emplace_back(std::make_unique<execute_context_t>());
+        auto exectx = executors.back().get();
+        ctx.add_executor(exectx, &main_loop);
+        exectx->run([exectx, &done, &other_thread_runs, &ctx, main_thread]() {
+            for (int j = 0; j < rounds; j++)
+            {
+                if (std::this_thread::get_id() != main_thread)
+                    other_thread_runs++;
+                auto end = get_precise_time() + 20;
+                while (get_precise_time() < end)
+                {
+                }
+                exectx->start();
+                exectx->stop();
+            }
+            if (++done == contexts)
+                ctx.exit_all(0);
+        });
+    }
+    main_loop.add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    thd.join();
+
+    GTEST_ASSERT_EQ(done, contexts);
+    GTEST_ASSERT_GT(main_loop.get_schedule_stat().given, 0);
+    GTEST_ASSERT_EQ(second->get_schedule_stat().stolen, main_loop.get_schedule_stat().given);
+    GTEST_ASSERT_GT(other_thread_runs, 0);
+}
+
+TEST(EventTest, WorkStealingMigrate)
+{
+    constexpr int contexts = 8;
+    event_context_t ctx(event_strategy::epoll);
+    ctx.set_work_stealing(true, make_timespan(0, 20));
+    auto &main_loop = event_loop_t::current();
+    auto main_thread = std::this_thread::get_id();
+    std::thread thd;
+    auto second = start_second_loop(ctx, thd);
+
+    std::atomic_bool exit = false;
+    std::atomic_int other_thread_runs = 0;
+    std::atomic_int finished = 0;
+    std::vector<std::unique_ptr<execute_context_t>> executors;
+    for (int i = 0; i < contexts; i++)
+    {
+        executors.emplace_back(std::make_unique<execute_context_t>());
+        auto exectx = executors.back().get();
+        ctx.add_executor(exectx, &main_loop);
+        exectx->run([exectx, &exit, &other_thread_runs, &finished, main_thread]() {
+            while (!exit)
+            {
+                if (std::this_thread::get_id() != main_thread)
+                    other_thread_runs++;
+                /// timer moves with context
+                exectx->sleep(make_timespan(0, 1));
+            }
+            finished++;
+        });
+    }
+    main_loop.add_timer(make_timer(make_timespan(0, 400), [&exit]() { exit = true; }));
+    main_loop.add_timer(make_timer(make_timespan(0, 500), [&ctx]() { ctx.exit_all(0); }));
+    ctx.run();
+    thd.join();
+
+    auto main_stat = main_loop.get_schedule_stat();
+    auto second_stat = second->get_schedule_stat();
+    std::cout << "migrated " << main_stat.migrated_out << " contexts, give " << main_stat.given << std::endl;
+    GTEST_ASSERT_EQ(finished, contexts);
+    GTEST_ASSERT_GT(main_stat.migrated_out, 0);
+    GTEST_ASSERT_EQ(second_stat.migrated_in, main_stat.migrated_out);
+    GTEST_ASSERT_GT(other_thread_runs, 0);
+}
+
+TEST(EventTest, CpuTopologyPlan)
+{
+    // 2 nodes, 2 cores per node, 2 threads per core
+    std::vector<cpu_info_t> cpus;
+    for (int id = 0; id < 8; id++)
+        cpus.push_back(cpu_info_t{id, id % 4 % 2, id % 4 / 2, id % 4 / 2});
+    cpu_topology_t topology(cpus);
+    GTEST_ASSERT_EQ(topology.get_node_count(), 2);
+    GTEST_ASSERT_EQ(topology.get_core_count(), 4);
+
+    GTEST_ASSERT_EQ(topology.plan(3, 0), std::vector<int>({0, 2, 1}));
+    GTEST_ASSERT_EQ(topology.plan(8, 1), std::vector<int>({1, 2, 3, 5, 6, 7, 1, 2}));
+    GTEST_ASSERT_EQ(topology.plan(2, 10), std::vector<int>({3, 7}));
+    GTEST_ASSERT_TRUE(topology.plan(0, 0).empty());
+
+    auto local = cpu_topology_t::detect();
+    GTEST_ASSERT_GT(local.get_core_count(), 0);
+    GTEST_ASSERT_EQ(local.plan(1, 0).size(), 1);
+}
+
+TEST(EventTest, StartLoops)
+{
+    constexpr int count = 2;
+    event_context_t ctx(event_strategy::epoll);
+    std::mutex mutex;
+    std::vector<int> loop_cpus, thread_cpus;
+    ctx.add_loop_handler([&](event_loop_t &loop) {
+        if (loop.get_cpu() < 0)
+            return;
+        std::unique_lock<std::mutex> lock(mutex);
+        loop_cpus.push_back(loop.get_cpu());
+        thread_cpus.push_back(sched_getcpu());
+        if (loop_cpus.size() == count)
+            ctx.exit_all(0);
+    });
+    GTEST_ASSERT_EQ(ctx.start_loops(count, 0), count);
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    GTEST_ASSERT_EQ(loop_cpus.size(), count);
+    auto plan = cpu_topology_t::detect().plan(count, 0);
+    std::sort(plan.begin(), plan.end());
+    std::sort(loop_cpus.begin(), loop_cpus.end());
+    GTEST_ASSERT_EQ(loop_cpus, plan);
+    for (int i = 0; i < count; i++)
+        GTEST_ASSERT_TRUE(std::find(plan.begin(), plan.end(), thread_cpus[i]) != plan.end());
+}
+
+TEST(EventTest, StartLoopsWithoutRun)
+{
+    std::atomic_int started = 0;
+    {
+        /// loop of this thread is registered and never run
+        event_context_t ctx(event_strategy::epoll);
+        auto main_loop = &event_loop_t::current();
+        ctx.add_loop_handler([&started, main_loop](event_loop_t &loop) {
+            if (&loop != main_loop)
+                started++;
+        });
+        GTEST_ASSERT_EQ(ctx.start_loops(1, 0, false), 1);
+        while (started == 0)
+            std::this_thread::yield();
+    }
+    GTEST_ASSERT_EQ(started, 1);
+}
+
+TEST(EventTest, SelectLoopLoad)
+{
+    event_context_t ctx(event_strategy::epoll);
+    auto &main_loop = event_loop_t::current();
+    std::thread thd;
+    auto second = start_second_loop(ctx, thd);
+
+    load_stat_t main_stat, second_stat;
+    int second_selected = 0;
+    u64 second_assigned = 0;
+    bool prefer_moved = false;
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &main_loop);
+    exectx.run([&]() {
+        /// busy for 90% of time
+        auto end = get_precise_time() + make_timespan(0, 400);
+        while (get_precise_time() < end)
+        {
+            auto step = get_precise_time() + make_timespan(0, 9);
+            while (get_precise_time() < step)
+            {
+            }
+            main_loop.add_io_bytes(1 << 20);
+            exectx.stop_for(make_timespan(0, 1));
+        }
+        main_stat = main_loop.get_load_stat();
+        second_stat = second->get_load_stat();
+        for (int i = 0; i < 100; i++)
+        {
+            if (&ctx.select_loop() == second)
+                second_selected++;
+        }
+        second_assigned = second->get_load_stat().assigned;
+        prefer_moved = &ctx.select_loop(main_loop) == second;
+        ctx.exit_all(0);
+    });
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    thd.join();
+
+    GTEST_ASSERT_GT(main_stat.busy, 500);
+    GTEST_ASSERT_GT(main_stat.bytes_per_second, 0);
+    GTEST_ASSERT_LT(second_stat.busy, 100);
+    GTEST_ASSERT_GT(main_loop.load_factor(), second->load_factor());
+    GTEST_ASSERT_EQ(second_selected, 100);
+    GTEST_ASSERT_EQ(second_assigned, 100);
+    GTEST_ASSERT_TRUE(prefer_moved);
+}
+
+TEST(EventTest, LoopProfile)
+{
+    histogram_t histogram;
+    for (u64 value : {0, 1, 2, 3, 1000})
+        histogram.record(value);
+    auto snapshot = histogram.snapshot();
+    GTEST_ASSERT_EQ(snapshot.count, 5);
+    GTEST_ASSERT_EQ(snapshot.sum, 1006);
+    GTEST_ASSERT_EQ(snapshot.max, 1000);
+    GTEST_ASSERT_EQ(snapshot.buckets[2], 2);
+    GTEST_ASSERT_EQ(snapshot.buckets[10], 1);
+    GTEST_ASSERT_EQ(snapshot.percentile(0.5), 3);
+    GTEST_ASSERT_EQ(snapshot.percentile(1), 1000);
+    histogram.record(5);
+    auto delta = histogram.snapshot() - snapshot;
+    GTEST_ASSERT_EQ(delta.count, 1);
+    GTEST_ASSERT_EQ(delta.buckets[3], 1);
+
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    constexpr int timers = 5;
+    int fired = 0;
+    for (int i = 0; i < timers; i++)
+        loop.add_timer(make_timer(make_timespan(0, 1), [&fired]() { fired++; }));
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    exectx.run([&]() {
+        auto end = get_precise_time() + make_timespan(0, 2);
+        while (get_precise_time() < end)
+        {
+        }
+        exectx.stop_for(make_timespan(0, 5));
+        ctx.exit_all(0);
+    });
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    GTEST_ASSERT_EQ(fired, timers);
+
+    auto profile = loop.get_profile();
+    GTEST_ASSERT_GE(profile.timer_lag.count, timers + 1);
+    GTEST_ASSERT_GE(profile.resumes.sum, 2);
+    GTEST_ASSERT_GE(profile.longest_resume.max, make_timespan(0, 2));
+    GTEST_ASSERT_GT(profile.iteration.count, 0);
+    GTEST_ASSERT_EQ(profile.select.count, profile.events.count);
+    GTEST_ASSERT_GT(profile.select.count, 0);
+}
+
+TEST(EventTest, BusyPoll)
+{
+    constexpr int rounds = 200;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    loop.set_busy_poll(make_timespan(0, 5));
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    int counter = 0;
+    exectx.run([&exectx]() {
+        while (1)
+            exectx.stop();
+    });
+
+    std::thread producer([&]() {
+        for (int i = 0; i < rounds; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            exectx.start_with([&]() {
+                if (++counter == rounds)
+                    ctx.exit_all(0);
+            });
+        }
+    });
+    loop.add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    producer.join();
+
+    auto stat = loop.get_busy_poll_stat();
+    std::cout << "busy poll spins " << stat.spins << ", hits " << stat.hits << ", budget " << stat.budget << std::endl;
+    GTEST_ASSERT_EQ(counter, rounds);
+    GTEST_ASSERT_GT(stat.hits, 0);
+    GTEST_ASSERT_EQ(stat.spins, stat.hits + stat.sleeps);
+    GTEST_ASSERT_LE(stat.budget, make_timespan(0, 5));
+}
+
+TEST(EventTest, BusyPollIdle)
+{
+    constexpr int rounds = 10;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    loop.set_busy_poll(make_timespan(0, 5));
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    /// only timers wake the loop, every select times out without events
+    exectx.run([&]() {
+        for (int i = 0; i < rounds; i++)
+            exectx.stop_for(make_timespan(0, 20));
+        ctx.exit_all(0);
+    });
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    auto stat = loop.get_busy_poll_stat();
+    GTEST_ASSERT_GT(stat.sleeps, 0);
+    GTEST_ASSERT_LT(stat.budget, make_timespan(0, 5) / 2);
+}
+
+TEST(EventTest, CrossThreadWakeup)
+{
+    constexpr int bursts = 2000;
+    constexpr int per_burst = 100;
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    u64 counter = 0;
+    exectx.run([&exectx]() {
+        while (1)
+            exectx.stop();
+    });
+
+    /// packets arrive in bursts like a rudp server socket
+    std::thread producer([&]() {
+        for (int i = 0; i < bursts; i++)
+        {
+            for (int j = 0; j < per_burst; j++)
+            {
+                exectx.start_with([&]() {
+                    if (++counter == bursts * per_burst)
+                        ctx.exit_all(0);
+                });
+            }
+            if (i % 100 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    loop.add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    auto start = get_precise_time();
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    auto end = get_precise_time();
+    producer.join();
+
+    auto wake_ups = loop.get_schedule_stat().wake_ups;
+    std::cout << "cross-thread start_with/sec: " << counter * 1000000 / (end - start + 1)
+              << ", wake up events: " << wake_ups << std::endl;
+    GTEST_ASSERT_EQ(counter, bursts * per_burst);
+    GTEST_ASSERT_LT(wake_ups, bursts * per_burst / 10);
+}
+/// select until an event of handle arrives, cqes of replaced polls are skipped
+static event_type_t select_handle(event_demultiplexer &demuxer, handle_t handle)
+{
+    ready_event_t events[4];
+    for (int i = 0; i < 10; i++)
+    {
+        microsecond_t timeout = make_timespan(0, 20);
+        int n = demuxer.select(events, 4, &timeout);
+        for (int j = 0; j < n; j++)
+        {
+            if (events[j].handle == handle)
+                return events[j].type;
+        }
+    }
+    return 0;
+}
+
+TEST(EventTest, UringPollMask)
+{
+    int fd[2];
+    GTEST_ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fd), 0);
+    event_uring_demultiplexer demuxer;
+
+    /// second add widens the poll
+    demuxer.add(fd[0], event_type::readable);
+    demuxer.add(fd[0], event_type::writable);
+    GTEST_ASSERT_EQ(select_handle(demuxer, fd[0]), event_type::writable);
+
+    /// readable is still polled after writable is removed
+    demuxer.remove(fd[0], event_type::writable);
+    write(fd[1], "x", 1);
+    GTEST_ASSERT_EQ(select_handle(demuxer, fd[0]), event_type::readable);
+
+    demuxer.remove(fd[0], event_type::readable);
+    write(fd[1], "x", 1);
+    GTEST_ASSERT_EQ(select_handle(demuxer, fd[0]), 0);
+    close(fd[0]);
+    close(fd[1]);
+}
+#endif
@@ -179,3 +179,56 @@ TEST(RUDPTest, MultithreadFlowControl)
     GTEST_ASSERT_EQ(count_flag, 2);
     thread.join();
 }
+
+TEST(RUDPTest, ReceivePool)
+{
+    /// writer waits for the send queue, blocks in flight reach the peak after it fills and drains a few times
+    constexpr int warm_up = 1500;
+    constexpr int test_count = 500;
+
+    event_context_t ctx(event_strategy::AUTO);
+
+    socket_addr_t addr1("127.0.0.1", 2006);
+    socket_addr_t addr2("127.0.0.1", 2007);
+
+    rudp_t rudp1, rudp2;
+    rudp1.bind(ctx, addr1, true);
+    rudp2.bind(ctx, addr2, true);
+
+    rudp1.add_connection(addr2, 0, make_timespan(5));
+    rudp2.add_connection(addr1, 0, make_timespan(5));
+
+    int received = 0;
+    socket_buffer_pool_stat_t before = {}, after = {};
+
+    rudp1.on_new_connection([&rudp1](rudp_connection_t conn) {
+        socket_buffer_t buffer(1280);
+        for (int i = 0; i < warm_up + test_count; i++)
+        {
+            buffer.expect().origin_length();
+            if (co::await(rudp_awrite, &rudp1, conn, buffer) != io_result::ok)
+                return;
+        }
+    });
+
+    rudp2.on_new_connection([&rudp2, &ctx, &received, &before, &after](rudp_connection_t conn) {
+        socket_buffer_t buffer(1280);
+        for (; received < warm_up + test_count; received++)
+        {
+            if (received == warm_up)
+                before = get_socket_buffer_pool_stat();
+            buffer.expect().origin_length();
+            if (co::await(rudp_aread, &rudp2, conn, buffer) != io_result::ok)
+                break;
+        }
+        after = get_socket_buffer_pool_stat();
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(net::make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(received, warm_up + test_count);
+    /// datagrams and kcp segments are pooled blocks
+    GTEST_ASSERT_GE(after.allocations - before.allocations, test_count);
+    GTEST_ASSERT_EQ(after.heap_allocations - before.heap_allocations, 0);
+}
@@ -0,0 +1,103 @@
+#include "net/socket_buffer.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace net;
+
+TEST(SocketBufferTest, Pool)
+{
+    byte *base;
+    {
+        socket_buffer_t buffer(1472);
+        base = buffer.get_base_ptr();
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(buffer.write_string("pool"), 4);
+        /// copies share the block, assignment releases the old one
+        socket_buffer_t copy(100);
+        copy = buffer;
+        GTEST_ASSERT_EQ(copy.get_base_ptr(), base);
+        socket_buffer_t moved(100);
+        moved = std::move(copy);
+        GTEST_ASSERT_EQ(moved.get_base_ptr(), base);
+        GTEST_ASSERT_EQ(copy.get_base_ptr(), nullptr);
+    }
+    auto middle = get_socket_buffer_pool_stat();
+    GTEST_ASSERT_GE(middle.cached_bytes, 2048 + 128);
+
+    /// freed blocks are reused by the same size class
+    socket_buffer_t again(2000);
+    GTEST_ASSERT_EQ(again.get_base_ptr(), base);
+    auto after = get_socket_buffer_pool_stat();
+    GTEST_ASSERT_EQ(after.heap_allocations, middle.heap_allocations);
+    GTEST_ASSERT_EQ(after.reused - middle.reused, 1);
+
+    /// large blocks are not cached
+    {
+        socket_buffer_t large(max_pooled_buffer_size + 1);
+        large.expect().origin_length();
+        large.clear();
+    }
+    GTEST_ASSERT_EQ(get_socket_buffer_pool_stat().cached_bytes, after.cached_bytes);
+}
+
+TEST(SocketBufferTest, RemoteFree)
+{
+    constexpr int count = 64;
+    std::vector<socket_buffer_t> buffers;
+    for (int i = 0; i < count; i++)
+        buffers.emplace_back(512);
+    std::vector<byte *> bases;
+    for (auto &buffer : buffers)
+        bases.push_back(buffer.get_base_ptr());
+    auto before = get_socket_buffer_pool_stat();
+
+    /// blocks freed by another thread go back to this thread
+    std::thread thread([&buffers]() { buffers.clear(); });
+    thread.join();
+    GTEST_ASSERT_EQ(get_socket_buffer_pool_stat().remote_frees, before.remote_frees);
+
+    std::vector<socket_buffer_t> again;
+    for (int i = 0; i < count; i++)
+        again.emplace_back(512);
+    auto after = get_socket_buffer_pool_stat();
+    GTEST_ASSERT_EQ(after.remote_frees - before.remote_frees, count);
+    GTEST_ASSERT_EQ(after.heap_allocations, before.heap_allocations);
+    for (auto &buffer : again)
+        GTEST_ASSERT_NE(std::find(bases.begin(), bases.end(), buffer.get_base_ptr()), bases.end());
+}
+
+TEST(SocketBufferTest, Chain)
+{
+    auto buffer = socket_buffer_t::from_string("0123456789");
+    buffer.expect().origin_length();
+    buffer.walk_step(2);
+    /// slices share the block
+    auto slice = buffer.slice(1, 4);
+    GTEST_ASSERT_EQ(slice.get_base_ptr(), buffer.get() + 1);
+    GTEST_ASSERT_EQ(slice.to_string(), "3456");
+    GTEST_ASSERT_EQ(buffer.slice(6, 10).to_string(), "89");
+
+    socket_buffer_chain_t chain = {slice, buffer.slice(5, 3)};
+    auto head = socket_buffer_t::from_string("ab");
+    head.expect().origin_length();
+    chain.prepend(head);
+    GTEST_ASSERT_EQ(chain.get_slice_count(), 3);
+    GTEST_ASSERT_EQ(chain.get_length(), 2 + 4 + 3);
+
+    chain.walk_step(3);
+    GTEST_ASSERT_EQ(chain.get_length(), 6);
+    GTEST_ASSERT_EQ(chain.get_slice(0).get_length(), 0);
+    GTEST_ASSERT_EQ(chain.get_slice(1).to_string(), "456");
+    chain.walk_step(6);
+    chain.finish_walk();
+    GTEST_ASSERT_EQ(chain.get_length(), 9);
+
+    chain.reset();
+    for (u64 i = 0; i < max_chain_slices; i++)
+        chain.append(slice);
+    ASSERT_THROW(chain.append(slice), std::length_error);
+}
@@ -6,6 +6,7 @@
 #include <functional>
 #include <gtest/gtest.h>
 #include <memory>
+#include <thread>
 
 using namespace net;
 static std::string test_data = "test string";
@@ -177,6 +178,45 @@ TEST(TCPTest, PacketConnection)
     ctx.run();
 }
 
+TEST(TCPTest, VectoredConnection)
+{
+    socket_addr_t test_addr("127.0.0.1", 2230);
+    event_context_t ctx(event_strategy::AUTO);
+    tcp::server_t server;
+    std::string received;
+
+    server.on_client_join([&received](tcp::server_t &s, tcp::connection_t conn) {
+        /// scatter a head and the payload
+        socket_buffer_t head(4), payload(test_data.size());
+        head.expect().origin_length();
+        payload.expect().origin_length();
+        socket_buffer_chain_t chain = {head, payload};
+        GTEST_ASSERT_EQ(co::await(socket_areadv, conn.get_socket(), chain), io_result::ok);
+        GTEST_ASSERT_EQ(chain.get_length(), 4 + test_data.size());
+        received = chain.get_slice(0).to_string() + chain.get_slice(1).to_string();
+    });
+    server.listen(ctx, test_addr, 1, true);
+
+    tcp::client_t client;
+    client
+        .on_server_connect([](tcp::client_t &c, tcp::connection_t conn) {
+            /// the payload is shared by two slices
+            auto payload = socket_buffer_t::from_string("head" + test_data);
+            payload.expect().origin_length();
+            socket_buffer_chain_t chain;
+            chain.append(payload.slice(4, test_data.size()));
+            chain.prepend(payload.slice(0, 4));
+            GTEST_ASSERT_EQ(co::await(socket_awritev, conn.get_socket(), chain), io_result::ok);
+            GTEST_ASSERT_EQ(chain.get_length(), 4 + test_data.size());
+        })
+        .on_server_disconnect([&ctx](tcp::client_t &c, tcp::connection_t conn) { ctx.exit_all(0); });
+
+    client.connect(ctx, test_addr, net::make_timespan_full());
+    event_loop_t::current().add_timer(make_timer(make_timespan(1, 500, 0), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    GTEST_ASSERT_EQ(received, "head" + test_data);
+}
+
 TEST(TCPTest, TCPTimeout)
 {
     socket_addr_t test_addr("8.8.8.8", 2222);
@@ -269,4 +309,107 @@ TEST(TCPTest, MultiThreadTest)
     {
         threads[i]->join();
     }
-}
\ No newline at end of file
+}
+
+TEST(TCPTest, ShardedListen)
+{
+    socket_addr_t test_addr("127.0.0.1", 2227);
+    event_context_t ctx(event_strategy::AUTO);
+    tcp::server_t server;
+    std::atomic_int wrong_loop = 0;
+
+    server.on_client_join([&wrong_loop](tcp::server_t &s, tcp::connection_t conn) {
+        /// connection is owned by the loop which accepts it
+        if (conn.get_socket()->get_loop() != &event_loop_t::current())
+            wrong_loop++;
+        socket_buffer_t buffer(test_data.size());
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(tcp::conn_aread, conn, buffer), io_result::ok);
+        GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(tcp::conn_awrite, conn, buffer), io_result::ok);
+    });
+    server.listen_sharded(ctx, test_addr, 100, true);
+
+    constexpr int threadsc = 3;
+    constexpr int counts = 32;
+    std::thread threads[threadsc];
+    for (auto &thd : threads)
+        thd = std::thread([&ctx]() { ctx.run(); });
+
+    tcp::client_t clients[counts];
+    std::atomic_int ref = counts;
+    for (auto &c : clients)
+        client_main(c, &ctx, test_addr, ref);
+
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() {
+        ctx.exit_all(-1);
+        std::string str = "timeout";
+        GTEST_ASSERT_EQ(str, "");
+    }));
+    ctx.run();
+    for (auto &thd : threads)
+        thd.join();
+    GTEST_ASSERT_EQ(wrong_loop, 0);
+    server.close_server();
+}
+
+#ifndef OS_WINDOWS
+TEST(TCPTest, ShardedListenBindFailure)
+{
+    socket_addr_t test_addr("127.0.0.1", 2228);
+    event_context_t ctx(event_strategy::AUTO);
+    /// a listener without SO_REUSEPORT holds the port
+    auto holder = listen_from(bind_at(new_tcp_socket(), test_addr), 1);
+
+    tcp::server_t server;
+    ASSERT_THROW(server.listen_sharded(ctx, test_addr, 10), net_connect_exception);
+    GTEST_ASSERT_EQ(server.get_failed_shards(), 0);
+    close_socket(holder);
+
+    /// nothing is left from the failed call
+    server.listen_sharded(ctx, test_addr, 10);
+    server.close_server();
+}
+#endif
+
+#ifndef OS_WINDOWS
+TEST(TCPTest, UringStreamConnection)
+{
+    socket_addr_t test_addr("127.0.0.1", 2225);
+    event_context_t ctx(event_strategy::io_uring);
+    tcp::server_t server;
+    /// larger than a registered buffer
+    std::string large_data(100000, 'x');
+
+    server.on_client_join([&large_data](tcp::server_t &s, tcp::connection_t conn) {
+        socket_buffer_t buffer(large_data.size());
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(tcp::conn_aread, conn, buffer), io_result::ok);
+        GTEST_ASSERT_EQ(buffer.to_string(), large_data);
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(tcp::conn_awrite, conn, buffer), io_result::ok);
+    });
+    server.listen(ctx, test_addr, 1, true);
+
+    tcp::client_t client;
+    client
+        .on_server_connect([&large_data](tcp::client_t &c, tcp::connection_t conn) {
+            socket_buffer_t buffer = socket_buffer_t::from_string(large_data);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(tcp::conn_awrite, conn, buffer), io_result::ok);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(tcp::conn_aread, conn, buffer), io_result::ok);
+            GTEST_ASSERT_EQ(buffer.to_string(), large_data);
+        })
+        .on_server_disconnect([&ctx](tcp::client_t &c, tcp::connection_t conn) { ctx.exit_all(0); });
+
+    client.connect(ctx, test_addr, net::make_timespan_full());
+    event_loop_t::current().add_timer(make_timer(make_timespan(1, 500, 0), [&ctx]() {
+        ctx.exit_all(-1);
+        std::string str = "timeout";
+        GTEST_ASSERT_EQ(str, "");
+    }));
+    ctx.run();
+}
+#endif
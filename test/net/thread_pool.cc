@@ -1,7 +1,14 @@
 #include "net/thread_pool.hpp"
+#include "net/cpu.hpp"
+#include "net/event.hpp"
+#include "net/execute_context.hpp"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <gtest/gtest.h>
+#include <set>
+#include <stdexcept>
 
 TEST(ThreadPoolTest, BaseTest)
 {
@@ -40,4 +47,101 @@ TEST(ThreadPoolTest, MultiThread)
     }
     std::unique_lock<std::mutex> lock(mutex);
     cv.wait(lock, [&c]() { return c == 0; });
-}
\ No newline at end of file
+}
+TEST(ThreadPoolTest, WorkStealing)
+{
+    constexpr int count = 2000;
+    std::atomic_int done = 0;
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    {
+        net::thread_pool_t pool(4);
+        /// all tasks are pushed to the deque of one worker, others steal them
+        pool.commit([&]() {
+            for (int i = 0; i < count; i++)
+            {
+                pool.commit([&]() {
+                    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+                    while (std::chrono::steady_clock::now() < end)
+                    {
+                    }
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        threads.insert(std::this_thread::get_id());
+                    }
+                    done++;
+                });
+            }
+        });
+    }
+    GTEST_ASSERT_EQ(done, count);
+    GTEST_ASSERT_GT(threads.size(), 1);
+}
+
+TEST(ThreadPoolTest, CommitBulk)
+{
+    constexpr int count = 1000;
+    std::atomic_int done = 0;
+    std::vector<int> cpus = net::cpu_topology_t::detect().plan(2, 0);
+    std::atomic_int bound = 0;
+    {
+        net::thread_pool_t pool(2, cpus);
+        std::vector<net::callable_t<void()>> tasks;
+        for (int i = 0; i < count; i++)
+            tasks.emplace_back([&done, &bound, &cpus]() {
+                auto cpu = net::get_thread_cpu();
+                if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+                    bound++;
+                done++;
+            });
+        pool.commit_bulk(std::move(tasks));
+    }
+    GTEST_ASSERT_EQ(done, count);
+    /// binding may be refused in containers
+    GTEST_ASSERT_TRUE(bound == 0 || bound == count);
+}
+
+static int checksum(const std::vector<int> &data)
+{
+    int sum = 0;
+    for (auto v : data)
+        sum = sum * 31 + v;
+    return sum;
+}
+
+TEST(ThreadPoolTest, AwaitOffload)
+{
+    net::thread_pool_t pool(2);
+    net::event_context_t ctx(net::event_strategy::epoll);
+    auto &loop = net::event_loop_t::current();
+    net::execute_context_t exectx;
+    ctx.add_executor(&exectx, &loop);
+    std::vector<int> data(100000, 7);
+    int result = 0;
+    bool same_thread = false, other_thread = false, thrown = false;
+
+    exectx.run([&]() {
+        auto loop_thread = std::this_thread::get_id();
+        result = net::co::await_offload(pool, [&]() {
+            other_thread = std::this_thread::get_id() != loop_thread;
+            return checksum(data);
+        });
+        same_thread = std::this_thread::get_id() == loop_thread && exectx.get_loop() == &loop;
+        try
+        {
+            net::co::await_offload(pool, []() { throw std::runtime_error("offload"); });
+        } catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        ctx.exit_all(0);
+    });
+    loop.add_timer(net::make_timer(net::make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    GTEST_ASSERT_EQ(result, checksum(data));
+    GTEST_ASSERT_TRUE(other_thread);
+    GTEST_ASSERT_TRUE(same_thread);
+    GTEST_ASSERT_TRUE(thrown);
+    GTEST_ASSERT_FALSE(exectx.is_pinned());
+}
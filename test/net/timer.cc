@@ -6,6 +6,7 @@
 #include "net/tcp.hpp"
 #include <functional>
 #include <gtest/gtest.h>
+#include <thread>
 
 using namespace net;
 
@@ -119,3 +120,94 @@ TEST(TimerTest, SocketTimer)
     ctx.run();
     GTEST_ASSERT_GE(get_current_time() - point, span);
 }
+
+TEST(TimerTest, WheelCascade)
+{
+    auto manager = create_time_manager(timer_min_precision);
+    auto base = manager->current * timer_min_precision;
+    /// spans cover all levels, and a timer out of range
+    std::vector<microsecond_t> spans = {1000,         255000,       256000,         300000,
+                                        70000000,     16777216000,  4294967296000ull, 5000000000000ull};
+    std::vector<std::unique_ptr<timer_node_t>> nodes;
+    std::vector<microsecond_t> fired(spans.size(), 0);
+    microsecond_t now = base;
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+        nodes.emplace_back(std::make_unique<timer_node_t>());
+        nodes.back()->timepoint = base + spans[i];
+        nodes.back()->callback = [&fired, &now, i]() { fired[i] = now; };
+        manager->insert(*nodes.back());
+    }
+    timer_node_t canceled;
+    canceled.timepoint = base + 300000;
+    canceled.callback = []() { FAIL(); };
+    manager->insert(canceled);
+    manager->cancel(canceled);
+    GTEST_ASSERT_FALSE(canceled.is_linked());
+    GTEST_ASSERT_EQ(manager->size(), spans.size());
+
+    /// jump to next timepoint like event loop
+    while (manager->size() > 0)
+    {
+        now = manager->next_tick_timepoint();
+        GTEST_ASSERT_NE(now, make_timespan_full());
+        manager->tick(now);
+    }
+    for (size_t i = 0; i < spans.size(); i++)
+        GTEST_ASSERT_EQ(fired[i], base + spans[i]);
+}
+
+TEST(TimerTest, WheelBenchmark)
+{
+    constexpr int count = 1000000;
+    auto manager = create_time_manager(timer_min_precision);
+    auto base = manager->current * timer_min_precision;
+    std::vector<timer_node_t> nodes(count);
+    u64 fired = 0;
+
+    auto start = get_precise_time();
+    for (int i = 0; i < count; i++)
+    {
+        /// spread in 1 ~ 60s
+        nodes[i].timepoint = base + make_timespan(1) + (u64)i * 59 % 59000 * 1000;
+        nodes[i].callback = [&fired]() { fired++; };
+        manager->insert(nodes[i]);
+    }
+    auto inserted = get_precise_time();
+    for (int i = 0; i < count; i += 2)
+        manager->cancel(nodes[i]);
+    auto canceled = get_precise_time();
+    manager->tick(base + make_timespan(61));
+    auto end = get_precise_time();
+
+    std::cout << count << " timers. insert " << (inserted - start) * 1000.0 / count << "ns/op, cancel "
+              << (canceled - inserted) * 2000.0 / count << "ns/op, fire " << (end - canceled) * 2000.0 / count
+              << "ns/op" << std::endl;
+    GTEST_ASSERT_EQ(fired, count / 2);
+    GTEST_ASSERT_EQ(manager->size(), 0);
+}
+
+TEST(TimerTest, CachedClock)
+{
+    event_context_t ctx(event_strategy::AUTO);
+    microsecond_t cached = 0, cached_after = 0, precise = 0, next_cached = 0;
+    event_loop_t::current().add_timer(make_timer(make_timespan(0, 10), [&]() {
+        cached = get_current_time();
+        auto end = get_precise_time() + make_timespan(0, 5);
+        while (get_precise_time() < end)
+        {
+        }
+        /// not refreshed in a callback
+        cached_after = get_current_time();
+        precise = get_precise_time();
+        /// fires at next loop iteration
+        event_loop_t::current().add_timer(make_timer(make_timespan(0, 1), [&]() {
+            next_cached = get_current_time();
+            ctx.exit_all(0);
+        }));
+    }));
+    ctx.run();
+    GTEST_ASSERT_EQ(cached, cached_after);
+    GTEST_ASSERT_GE(precise - cached, make_timespan(0, 5));
+    GTEST_ASSERT_GE(next_cached, precise);
+}
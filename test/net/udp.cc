@@ -41,4 +41,133 @@ TEST(UDPTest, UDPPackageTest)
         ctx.exit_all(0);
     });
     ctx.run();
-}
\ No newline at end of file
+}
+
+TEST(UDPTest, PreciseWakeup)
+{
+    constexpr int rounds = 200;
+    socket_addr_t test_addr("127.0.0.1", 2228);
+    event_context_t ctx(event_strategy::epoll);
+    udp::server_t server;
+    auto before = co::get_await_stat();
+
+    server.bind(ctx, test_addr);
+    server.run([&server]() {
+        auto socket = server.get_socket();
+        socket_buffer_t buffer(test_data.size());
+        socket_addr_t addr;
+        while (1)
+        {
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, buffer, addr), io_result::ok);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, buffer, addr), io_result::ok);
+        }
+    });
+
+    udp::client_t client;
+    client.connect(ctx, test_addr, false);
+    int done = 0;
+    client.run([&client, &test_addr, &ctx, &done]() {
+        auto socket = client.get_socket();
+        socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+        socket_addr_t addr = test_addr;
+        for (; done < rounds; done++)
+        {
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, buffer, addr), io_result::ok);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, buffer, addr), io_result::ok);
+        }
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+
+    /// sockets are always writable, readers are resumed only by datagrams
+    auto after = co::get_await_stat();
+    std::cout << "waits " << after.waits - before.waits << ", spurious resumes " << after.spurious - before.spurious
+              << std::endl;
+    GTEST_ASSERT_EQ(done, rounds);
+    GTEST_ASSERT_EQ(after.spurious - before.spurious, 0);
+}
+
+#ifndef OS_WINDOWS
+TEST(UDPTest, UringPackageTest)
+{
+    socket_addr_t test_addr("127.0.0.1", 2226);
+    event_context_t ctx(event_strategy::io_uring);
+    udp::server_t server;
+
+    server.bind(ctx, test_addr);
+    server.run([&server, &ctx]() {
+        auto socket = server.get_socket();
+        socket_buffer_t buffer(test_data.size());
+        buffer.expect().origin_length();
+        socket_addr_t addr;
+        GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, buffer, addr), io_result::ok);
+        GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, buffer, addr), io_result::ok);
+    });
+
+    udp::client_t client;
+    client.connect(ctx, test_addr, false);
+    client.run([&client, &test_addr, &ctx]() {
+        auto socket = client.get_socket();
+        socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+        buffer.expect().origin_length();
+        socket_addr_t addr = test_addr;
+        GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, buffer, addr), io_result::ok);
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, buffer, addr), io_result::ok);
+        GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+        ctx.exit_all(0);
+    });
+    ctx.run();
+}
+
+TEST(UDPTest, UringSendError)
+{
+    socket_addr_t test_addr("127.0.0.1", 2229);
+    /// broadcast without SO_BROADCAST is refused by kernel
+    socket_addr_t broadcast_addr("255.255.255.255", 2229);
+    event_context_t ctx(event_strategy::io_uring);
+    udp::server_t server;
+    bool thrown = false;
+    int sent = 0;
+
+    server.bind(ctx, test_addr);
+    server.run([&]() {
+        auto socket = server.get_socket();
+        socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+        buffer.expect().origin_length();
+        /// send waits for its completion, the failure is reported by itself
+        try
+        {
+            co::await(socket_awrite_to, socket, buffer, broadcast_addr);
+        } catch (net_io_exception &)
+        {
+            thrown = true;
+        }
+        /// following datagrams are not affected
+        for (; sent < 100; sent++)
+        {
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, buffer, test_addr), io_result::ok);
+        }
+        for (int i = 0; i < sent; i++)
+        {
+            buffer.expect().origin_length();
+            socket_addr_t addr;
+            GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, buffer, addr), io_result::ok);
+            GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+        }
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    GTEST_ASSERT_TRUE(thrown);
+    GTEST_ASSERT_EQ(sent, 100);
+}
+#endif